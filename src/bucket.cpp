@@ -10,6 +10,7 @@
 #include "bucket.hpp"
 #include "sequences.hpp"
 #include "merge.hpp"
+#include "checksum.hpp"
 
 #include "encoding.hpp"
 
@@ -19,6 +20,7 @@ using namespace std;
 Bucket::Bucket(uint8_t m, bool revcomp) {
 	input_filename = "";
 	output_filename = "";
+	checksum = false;
 
 	this->m = m;
 	this->singleside = !revcomp;
@@ -47,6 +49,7 @@ void Bucket::cli_prepare(CLI::App * app) {
 	CLI::Option * mini_size = subapp->add_option("-m, --minimizer-size", m, "Minimizer size [Max 31].");
 	mini_size->required();
 	subapp->add_flag("-s, --single-side", singleside, "Look for the minimizer only on the forward strand.");
+	subapp->add_flag("--checksum", checksum, "Store a CRC32C checksum of each section in the footer of the output. The checksums are verified by validate.");
 }
 
 
@@ -217,4 +220,7 @@ void Bucket::exec() {
 
 	for (Kff_file * file : files)
 		delete file;
+
+	if (this->checksum)
+		add_section_checksums(output_filename);
 }
\ No newline at end of file
@@ -14,6 +14,7 @@ class Bucket: public KffTool {
 private:
 	std::string input_filename;
 	std::string output_filename;
+	bool checksum;
 
   uint8_t * kmer_buffer;
 	uint8_t * data_buffer;
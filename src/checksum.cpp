@@ -0,0 +1,189 @@
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <map>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#include "checksum.hpp"
+#include "fileio.hpp"
+#include "mapreader.hpp"
+
+
+using namespace std;
+
+
+const string checksum_prefix = "crc32c_";
+
+
+// ----- Software implementation (slicing-by-8) -----
+
+/** Tables of the reflected Castagnoli polynomial. tables[t][b] is the crc of the byte b followed
+ * by t zero bytes.
+ **/
+struct Crc32cTables {
+	uint32_t tables[8][256];
+
+	Crc32cTables() {
+		for (uint32_t b=0 ; b<256 ; b++) {
+			uint32_t crc = b;
+			for (uint i=0 ; i<8 ; i++)
+				crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+			tables[0][b] = crc;
+		}
+		for (uint32_t b=0 ; b<256 ; b++)
+			for (uint t=1 ; t<8 ; t++)
+				tables[t][b] = (tables[t-1][b] >> 8) ^ tables[0][tables[t-1][b] & 0xFF];
+	}
+};
+
+static const Crc32cTables crc_tables;
+
+
+uint32_t crc32c_software(const uint8_t * data, size_t size, uint32_t crc) {
+	const uint32_t (*t)[256] = crc_tables.tables;
+	crc = ~crc;
+
+	// 8 bytes at once
+	while (size >= 8) {
+		uint32_t low = crc ^ ((uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24));
+		crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24]
+		    ^ t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+		data += 8;
+		size -= 8;
+	}
+	// Remaining bytes
+	while (size > 0) {
+		crc = (crc >> 8) ^ t[0][(crc ^ *data) & 0xFF];
+		data += 1;
+		size -= 1;
+	}
+
+	return ~crc;
+}
+
+
+// ----- Hardware implementation (SSE4.2) -----
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(const uint8_t * data, size_t size, uint32_t crc) {
+	uint64_t crc64 = ~crc;
+
+	// Align the reads on 8 bytes
+	while (size > 0 and ((uintptr_t)data & 7) != 0) {
+		crc64 = _mm_crc32_u8((uint32_t)crc64, *data);
+		data += 1;
+		size -= 1;
+	}
+	while (size >= 8) {
+		uint64_t word;
+		memcpy(&word, data, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+		data += 8;
+		size -= 8;
+	}
+	while (size > 0) {
+		crc64 = _mm_crc32_u8((uint32_t)crc64, *data);
+		data += 1;
+		size -= 1;
+	}
+
+	return ~(uint32_t)crc64;
+}
+#endif
+
+
+uint32_t crc32c(const uint8_t * data, size_t size, uint32_t crc) {
+#if defined(__x86_64__)
+	static const bool hardware = __builtin_cpu_supports("sse4.2");
+	if (hardware)
+		return crc32c_sse42(data, size, crc);
+#endif
+	return crc32c_software(data, size, crc);
+}
+
+
+
+// ----- Section checksums -----
+
+void add_section_checksums(const string & filename, const uint threads) {
+	vector<pair<long, long> > sections;
+	map<string, uint64_t> footer_values;
+	long first_index = 0;
+	long tail_position;
+	vector<uint32_t> crcs;
+
+	{
+		MappedFile mapping(filename);
+		MappedKffReader reader(mapping);
+		if (not reader.is_open()) {
+			cerr << "Impossible to map " << filename << " to compute the section checksums." << endl;
+			exit(1);
+		}
+
+		// Previous footer values except the checksums (recomputed) and the footer structure
+		long header_end = reader.position;
+		long footer_position = reader.footer_position();
+		tail_position = footer_position == 0 ? reader.end_position : footer_position;
+		if (footer_position != 0) {
+			reader.jump_to(footer_position);
+			for (auto & p : reader.read_gv()) {
+				if (p.first == "first_index")
+					first_index = p.second;
+				else if (p.first != "footer_size" and p.first.compare(0, checksum_prefix.size(), checksum_prefix) != 0)
+					footer_values[p.first] = p.second;
+			}
+			reader.jump_to(header_end);
+		}
+
+		// Block sections boundaries
+		try {
+			while (reader.position < tail_position) {
+				char section_type = reader.read_section_type();
+				if (section_type == 'v')
+					reader.read_gv();
+				else if (section_type == 'i') {
+					int64_t next_index;
+					reader.read_index(next_index);
+				} else {
+					reader.open_block_section();
+					reader.skip_blocks();
+					sections.emplace_back(reader.section_beginning, reader.position);
+				}
+			}
+		} catch (const char * msg) {
+			cerr << "Impossible to compute the checksums of " << filename << ": " << msg << endl;
+			exit(1);
+		}
+
+		// Checksums of the sections
+		crcs.resize(sections.size());
+		#pragma omp parallel for num_threads(threads) schedule(dynamic)
+		for (uint64_t s_idx=0 ; s_idx<sections.size() ; s_idx++)
+			crcs[s_idx] = crc32c(mapping.data + sections[s_idx].first, sections[s_idx].second - sections[s_idx].first);
+	}
+
+	for (uint64_t s_idx=0 ; s_idx<sections.size() ; s_idx++)
+		footer_values[checksum_prefix + to_string(sections[s_idx].first)] = crcs[s_idx];
+
+	// New end of the file: footer and signature
+	vector<uint8_t> tail = serialize_footer(footer_values, first_index);
+	tail.push_back('K'); tail.push_back('F'); tail.push_back('F');
+
+	int fd = ::open(filename.c_str(), O_WRONLY);
+	if (fd < 0) {
+		cerr << "Impossible to open " << filename << " in write mode." << endl;
+		exit(1);
+	}
+	write_range(fd, tail.data(), tail.size(), tail_position);
+	// Remove the remaining bytes of a larger previous footer
+	if (ftruncate(fd, tail_position + tail.size()) != 0) {
+		cerr << "Impossible to truncate " << filename << endl;
+		exit(1);
+	}
+	::close(fd);
+}
@@ -0,0 +1,53 @@
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+
+/** CRC32C (Castagnoli) of a byte array. The SSE4.2 crc32 instruction is used when the processor
+ * supports it, otherwise a slicing-by-8 table implementation.
+ *
+ * @param data Bytes to checksum
+ * @param size Number of bytes
+ * @param crc Checksum of the previous bytes to continue a computation (0 for a new one).
+ **/
+uint32_t crc32c(const uint8_t * data, size_t size, uint32_t crc=0);
+/** Table implementation of crc32c (no hardware instruction).
+ **/
+uint32_t crc32c_software(const uint8_t * data, size_t size, uint32_t crc=0);
+
+
+// ----- Section checksums -----
+// The checksum of each raw and minimizer section is stored in the footer as a variable
+// "crc32c_<position>" where position is the absolute byte of the section beginning.
+// The checksum covers all the bytes of the section, from its type to the end of its last block.
+
+/** Prefix of the footer variables holding the section checksums.
+ **/
+extern const std::string checksum_prefix;
+
+/** Compute the checksums of all the block sections of a kff file and write them in its footer.
+ * Only the end of the file (footer and signature) is rewritten. Previous checksums are replaced.
+ *
+ * @param filename Kff file fully written on disk.
+ * @param threads Number of threads computing the checksums.
+ **/
+void add_section_checksums(const std::string & filename, const uint threads=1);
+
+/** Extract the section checksums from footer variables.
+ * @return Section position -> checksum
+ **/
+template<typename Map>
+std::unordered_map<long, uint32_t> section_checksums(const Map & footer) {
+  std::unordered_map<long, uint32_t> checksums;
+  for (const auto & p : footer)
+    if (p.first.compare(0, checksum_prefix.size(), checksum_prefix) == 0)
+      checksums[std::stol(p.first.substr(checksum_prefix.size()))] = (uint32_t)p.second;
+  return checksums;
+}
+
+#endif
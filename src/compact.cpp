@@ -10,6 +10,7 @@
 #include "sequences.hpp"
 #include "compact.hpp"
 #include "merge.hpp"
+#include "checksum.hpp"
 
 
 using namespace std;
@@ -19,6 +20,7 @@ Compact::Compact() {
 	input_filename = "";
 	output_filename = "";
 	sorted = false;
+	checksum = false;
 
 	this->buffer_size = 1 << 10;
 	this->next_free = 0;
@@ -44,12 +46,18 @@ void Compact::cli_prepare(CLI::App * app) {
 	input_option->check(CLI::ExistingFile);
 	CLI::Option * out_option = subapp->add_option("-o, --outfile", output_filename, "Kff to write (must be different from the input)");
 	out_option->required();
+	subapp->add_flag("--checksum", checksum, "Store a CRC32C checksum of each section in the footer of the output. The checksums are verified by validate.");
 	// subapp->add_flag("-s, --sorted", sorted, "The output compacted superkmers will be sorted to allow binary search. Sorted superkmer have a lower compaction ratio (ie will be less compacted).");
 }
 
 
 void Compact::exec() {
-	Kff_file infile(input_filename, "r");
+	KffSectionReader * reader = open_kff_reader(input_filename);
+	KffSectionReader & infile = *reader;
+	if (not infile.is_open()) {
+		cerr << input_filename << " is too small to be a kff file" << endl;
+		exit(1);
+	}
 	Kff_file outfile(output_filename, "w");
 
 	outfile.write_encoding(infile.encoding);
@@ -58,76 +66,81 @@ void Compact::exec() {
 	outfile.set_canonicity(infile.canonicity);
 	
 	// Metadata transfer
-	uint8_t * metadata = new uint8_t[infile.metadata_size];
-	infile.read_metadata(metadata);
-	outfile.write_metadata(infile.metadata_size, metadata);
-	delete[] metadata;
+	outfile.write_metadata(infile.metadata_size, infile.metadata);
 
 	bool first_warning = true;
 
-	while (infile.tellp() != infile.end_position) {
-		char section_type = infile.read_section_type();
+	try {
+		while (infile.position < infile.end_position) {
+			char section_type = infile.read_section_type();
 
-		if (section_type == 'v') {
-			Section_GV isgv(&infile);
-			isgv.close();
+			if (section_type == 'v') {
+				map<string, uint64_t> vars = infile.read_gv();
 
-			unordered_map<string, uint64_t> to_copy;
-			for (auto & p : isgv.vars) {
-				if (p.first != "first_index" and p.first != "footer_size") {
-					to_copy[p.first] = p.second;
+				unordered_map<string, uint64_t> to_copy;
+				for (auto & p : vars) {
+					if (p.first != "first_index" and p.first != "footer_size") {
+						to_copy[p.first] = p.second;
+					}
 				}
-			}
 
-			if (to_copy.size() > 0) {
-				Section_GV osgv(&outfile);
-				for (auto & p : isgv.vars)
-					osgv.write_var(p.first, p.second);
-				osgv.close();
+				if (to_copy.size() > 0) {
+					Section_GV osgv(&outfile);
+					for (auto & p : vars)
+						osgv.write_var(p.first, p.second);
+					osgv.close();
+				}
 			}
-		}
-		else if (section_type == 'i') {
-			Section_Index si(&infile);
-			si.close();
-		}
-		else if (section_type == 'r') {
-			if (first_warning) {
-				first_warning = false;
-				cerr << "WARNING: kff-tools has detected R sections inside of the file. The compact tool is only compacting kmers inside of M sections. The R sections are omitted." << endl;
+			else if (section_type == 'i') {
+				int64_t next_index;
+				infile.read_index(next_index);
 			}
+			else if (section_type == 'r') {
+				if (first_warning) {
+					first_warning = false;
+					cerr << "WARNING: kff-tools has detected R sections inside of the file. The compact tool is only compacting kmers inside of M sections. The R sections are omitted." << endl;
+				}
 
-			Section_Raw sr(&infile);
-			sr.close();
-		}
-		else if (section_type == 'm') {
-			uint k = outfile.global_vars["k"];
-			uint m = outfile.global_vars["m"];
+				infile.open_block_section();
+				infile.skip_blocks();
+			}
+			else if (section_type == 'm') {
+				uint k = outfile.global_vars["k"];
+				uint m = outfile.global_vars["m"];
 
-			// Rewrite a value section if max is not sufficently large
-			if (outfile.global_vars["max"] < k - m + 1) {
-				unordered_map<string, uint64_t> values(outfile.global_vars);
-				Section_GV sgv(&outfile);
+				// Rewrite a value section if max is not sufficently large
+				if (outfile.global_vars["max"] < k - m + 1) {
+					unordered_map<string, uint64_t> values(outfile.global_vars);
+					Section_GV sgv(&outfile);
 
-				for (auto & p : values)
-					if (p.first != "max")
-						sgv.write_var(p.first, p.second);
-				sgv.write_var("max", k - m + 1);
+					for (auto & p : values)
+						if (p.first != "max")
+							sgv.write_var(p.first, p.second);
+					sgv.write_var("max", k - m + 1);
 
-				sgv.close();
-			}
+					sgv.close();
+				}
 
-			// Compact and save the kmers
-			Section_Minimizer sm(&infile);
-			this->compact_section(sm, outfile);
-			sm.close();
+				// Compact and save the kmers
+				infile.open_block_section();
+				this->compact_section(infile, outfile);
+			}
+			else
+				throw "Unknown section type";
 		}
+	} catch (const char * msg) {
+		cerr << msg << endl;
+		exit(1);
 	}
 
-	infile.close();
+	delete reader;
 	outfile.close();
+
+	if (this->checksum)
+		add_section_checksums(output_filename);
 }
 
-void Compact::compact_section(Section_Minimizer & ism, Kff_file & outfile) {
+void Compact::compact_section(KffSectionReader & reader, Kff_file & outfile) {
 	// General variables
 	uint k = outfile.global_vars["k"];
 	uint m = outfile.global_vars["m"];
@@ -142,7 +155,7 @@ void Compact::compact_section(Section_Minimizer & ism, Kff_file & outfile) {
 	this->offset_idx = (4 - ((k - m) % 4)) % 4;
 	
 	// 1 - Load the input section
-	vector<vector<uint8_t *> > kmers_per_index = this->prepare_kmer_matrix(ism);
+	vector<vector<uint8_t *> > kmers_per_index = this->prepare_kmer_matrix(reader);
 	
 	// 2 - Compact kmers
 	vector<vector<uint8_t *> > paths;
@@ -155,12 +168,35 @@ void Compact::compact_section(Section_Minimizer & ism, Kff_file & outfile) {
 	}
 
 	Section_Minimizer osm(&outfile);
-	osm.write_minimizer(ism.minimizer);
+	osm.write_minimizer(const_cast<uint8_t *>(reader.minimizer));
 	this->write_paths(paths, osm, data_size);
 	osm.close();
 }
 
 
+void Compact::set_sizes(const uint k, const uint m, const uint data_size, const uint max) {
+	this->k = k;
+	this->m = m;
+	this->data_size = data_size;
+	this->bytes_compacted = (k - m + 3) / 4;
+	// Same size as the one read by write_paths
+	this->mini_pos_size = (static_cast<uint>(ceil(log2(max + k - m))) + 7) / 8;
+	this->offset_idx = (4 - ((k - m) % 4)) % 4;
+	this->next_free = 0;
+}
+
+
+vector<vector<uint8_t *> > Compact::assemble(const vector<uint8_t *> & kmers) {
+	// One column per minimizer position
+	vector<vector<uint8_t *> > kmer_matrix(this->k - this->m + 1);
+	for (uint8_t * kmer : kmers)
+		kmer_matrix[this->k - this->m - this->mini_pos_from_buffer(kmer)].push_back(kmer);
+
+	vector<pair<uint8_t *, uint8_t *> > to_compact = this->greedy_assembly(kmer_matrix);
+	return this->pairs_to_paths(to_compact);
+}
+
+
 long Compact::add_kmer_to_buffer(const uint8_t * seq, const uint8_t * data, uint64_t mini_pos) {
 	// Realloc if needed
 	if (this->buffer_size - this->next_free < this->bytes_compacted + this->data_size + this->mini_pos_size) {
@@ -187,55 +223,44 @@ long Compact::add_kmer_to_buffer(const uint8_t * seq, const uint8_t * data, uint
 	return position;
 }
 
-vector<vector<uint8_t *> > Compact::prepare_kmer_matrix(Section_Minimizer & sm) {
+vector<vector<uint8_t *> > Compact::prepare_kmer_matrix(KffSectionReader & reader) {
 	vector<vector<long> > pos_matrix;
-	pos_matrix.resize(sm.k - sm.m + 1);
+	pos_matrix.resize(reader.k - reader.m + 1);
 	
-	uint64_t max_nucl = sm.k + sm.max - 1;
-	uint64_t max_seq_bytes = (max_nucl + 3) / 4;
-	uint64_t kmer_bytes = (sm.k - sm.m + 3) / 4;
+	uint64_t max_nucl = reader.k + reader.max - 1;
+	uint64_t kmer_bytes = (reader.k - reader.m + 3) / 4;
 	uint64_t mini_pos_size = (static_cast<uint>(ceil(log2(max_nucl))) + 7) / 8;
 
-	uint8_t * seq_buffer = new uint8_t[max_seq_bytes];
-	uint8_t * data_buffer = new uint8_t[sm.data_size * sm.max];
-
 	// 1 - Load the input section
-	for (uint n=0 ; n<sm.nb_blocks ; n++) {
-		uint64_t mini_pos = 0xFFFFFFFFFFFFFFFF;
-		// Read sequence
-		uint nb_kmers = sm.read_compacted_sequence_without_mini(
-			seq_buffer, data_buffer, mini_pos);
-
+	KffBlock block;
+	while (reader.next_block(block)) {
 		// Add kmer by index
-		for (uint kmer_idx=0 ; kmer_idx<nb_kmers ; kmer_idx++) {
-			uint kmer_pos = sm.k - (uint)sm.m - mini_pos + kmer_idx;
+		for (uint kmer_idx=0 ; kmer_idx<block.nb_kmers ; kmer_idx++) {
+			uint kmer_pos = reader.k - (uint)reader.m - block.mini_pos + kmer_idx;
 
 			// Realloc if needed
-			if (this->buffer_size - this->next_free < kmer_bytes + sm.data_size + mini_pos_size) {
+			if (this->buffer_size - this->next_free < kmer_bytes + reader.data_size + mini_pos_size) {
 				this->kmer_buffer = (uint8_t *) realloc((void *)this->kmer_buffer, this->buffer_size*2);
 				memset(this->kmer_buffer + this->buffer_size, 0, this->buffer_size);
 				this->buffer_size *= 2;
 			}
 
 			// Copy kmer sequence
-			subsequence(seq_buffer, sm.k - sm.m + nb_kmers - 1, this->kmer_buffer + next_free, kmer_idx, kmer_idx + sm.k - sm.m - 1);
+			subsequence(block.seq, block.seq_size, this->kmer_buffer + next_free, kmer_idx, kmer_idx + reader.k - reader.m - 1);
 			// Copy data array
-			memcpy(this->kmer_buffer + next_free + kmer_bytes, data_buffer + kmer_idx * sm.data_size, sm.data_size);
+			memcpy(this->kmer_buffer + next_free + kmer_bytes, block.data + kmer_idx * reader.data_size, reader.data_size);
 			// Write mini position
-			uint kmer_mini_pos = mini_pos - kmer_idx;
+			uint kmer_mini_pos = block.mini_pos - kmer_idx;
 			for (int b=mini_pos_size-1 ; b>=0 ; b--) {
-				*(this->kmer_buffer + next_free + kmer_bytes + sm.data_size + b) = kmer_mini_pos & 0xFF;
+				*(this->kmer_buffer + next_free + kmer_bytes + reader.data_size + b) = kmer_mini_pos & 0xFF;
 				kmer_mini_pos >>= 8;
 			}
 			// Update
 			pos_matrix[kmer_pos].push_back(this->next_free);
-			next_free += kmer_bytes + sm.data_size + mini_pos_size;
+			next_free += kmer_bytes + reader.data_size + mini_pos_size;
 		}
 	}
 
-	delete[] seq_buffer;
-	delete[] data_buffer;
-
 	// Transform the position matrix into the kmer matrix
 	vector<vector<uint8_t *> > kmer_matrix;
 	for (vector<long> & positions : pos_matrix) {
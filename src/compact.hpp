@@ -5,6 +5,7 @@
 
 #include "CLI11.hpp"
 #include "kfftools.hpp"
+#include "sectionreader.hpp"
 
 
 #ifndef COMPACT_H
@@ -14,6 +15,7 @@ class Compact: public KffTool {
 private:
 	std::string input_filename;
 	std::string output_filename;
+	bool checksum;
 
 
 public:
@@ -69,7 +71,12 @@ public:
 	 **/
 	uint mini_pos_from_buffer(const uint8_t * kmer) const;
 	
-	std::vector<std::vector<uint8_t *> > prepare_kmer_matrix(Section_Minimizer & sm);
+	/** Load all the kmers of the current minimizer section of the reader into the kmer buffer.
+	 * @param reader Reader positioned after the header of a minimizer section (see open_block_section).
+	 * 
+	 * @return The kmers of the buffer, one column per minimizer position.
+	 **/
+	std::vector<std::vector<uint8_t *> > prepare_kmer_matrix(KffSectionReader & reader);
 
 	/** Return the result of the comparison between kmers in the buffer.
 	 * WARNING: The comparator assumes that the minimizers are at the same place in the words
@@ -143,6 +150,22 @@ public:
 	std::vector<std::pair<uint8_t *, uint8_t *> >  greedy_assembly(std::vector<std::vector<uint8_t *> > & kmers);
 
 
+	/** Set k, m, data_size and the derived sizes of the kmer buffer. Must be called before adding
+	 * kmers to the buffer outside of compact_section.
+	 * @param max Max number of kmers per block of the minimizer sections that will be written.
+	 **/
+	void set_sizes(const uint k, const uint m, const uint data_size, const uint max);
+
+	/** Assemble kmers from the buffer that share the same minimizer into virtual superkmer paths
+	 * (greedy assembly). The paths can be written with write_paths.
+	 * 
+	 * @param kmers Kmers of the buffer (see add_kmer_to_buffer).
+	 * 
+	 * @return The list of paths.
+	 **/
+	std::vector<std::vector<uint8_t *> > assemble(const std::vector<uint8_t *> & kmers);
+
+
 	void cli_prepare(CLI::App * subapp);
 	/** Read a Section_Raw and write a bucketized and compacted file of the kmers.
 	  * @param insection Section to bucketize then compact.
@@ -151,7 +174,10 @@ public:
 	  * @return Name of the file containing the result.
 	  */
 	void exec();
-	void compact_section(Section_Minimizer & ism, Kff_file & outfile);
+	/** Compact the kmers of the current minimizer section of the reader and write them in a new
+	 * minimizer section of outfile.
+	 **/
+	void compact_section(KffSectionReader & reader, Kff_file & outfile);
 
 };
 
@@ -0,0 +1,308 @@
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+#include <array>
+
+#include "count.hpp"
+#include "compact.hpp"
+#include "encoding.hpp"
+#include "fastx.hpp"
+#include "sequences.hpp"
+#include "checksum.hpp"
+
+
+using namespace std;
+
+
+Count::Count() {
+	output_filename = "";
+	k = 0;
+	m = 10;
+	data_size = 4;
+	min_abundance = 1;
+	max_abundance = 0;
+	nb_partitions = 64;
+	threads = 1;
+	checksum = false;
+}
+
+
+void Count::cli_prepare(CLI::App * app) {
+	this->subapp = app->add_subcommand("count", "Count the kmers of FASTA/FASTQ files (possibly compressed) into a kff file. The kmers are canonical and compacted into minimizer sections with their counts as data.");
+	CLI::Option * input_option = subapp->add_option("-i, --inputs", input_filenames, "FASTA/FASTQ files to count. The sequences are split at each non ACGT char.");
+	input_option->required();
+	input_option->expected(1, -1);
+	input_option->check(CLI::ExistingFile);
+	CLI::Option * out_option = subapp->add_option("-o, --outfile", output_filename, "Kff file to write.");
+	out_option->required();
+	CLI::Option * k_opt = subapp->add_option("-k, --kmer-size", k, "Kmer size [Max 32].");
+	k_opt->required();
+	subapp->add_option("-m, --minimizer-size", m, "Minimizer size used to bucket the kmers (default 10, max 31, smaller than k).");
+	subapp->add_option("-d, --data-size", data_size, "Size of the counts in Bytes (default 4, max 8). Larger counts are saturated to the max value.");
+	subapp->add_option("-a, --min-abundance", min_abundance, "Kmers with a smaller count are discarded (default 1).");
+	subapp->add_option("-x, --max-abundance", max_abundance, "Kmers with a larger count are discarded (default 0, no limit).");
+	subapp->add_option("--partitions", nb_partitions, "Number of temporary partitions on disk. Only one partition per thread is loaded in memory at a time (default 64).");
+	subapp->add_option("-t, --threads", threads, "Number of threads (default 1).");
+	subapp->add_flag("--checksum", checksum, "Store a CRC32C checksum of each section in the footer of the output. The checksums are verified by validate.");
+}
+
+
+void Count::exec() {
+	if (this->k == 0 or this->k > 32) {
+		cerr << "The kmer size must be between 1 and 32" << endl;
+		exit(1);
+	}
+	if (this->m == 0 or this->m > 31 or this->m >= this->k) {
+		cerr << "The minimizer size must be between 1 and 31 and smaller than k" << endl;
+		exit(1);
+	}
+	if (this->data_size > 8) {
+		cerr << "The data size must be at most 8 Bytes" << endl;
+		exit(1);
+	}
+	for (const string & input : this->input_filenames)
+		if (not FastxParser::is_fastx(input)) {
+			cerr << input << " is not a FASTA/FASTQ file" << endl;
+			exit(1);
+		}
+	if (this->nb_partitions == 0)
+		this->nb_partitions = 1;
+	if (this->threads == 0)
+		this->threads = 1;
+
+	uint8_t encoding[4] = {0, 1, 3, 2};
+
+	// --- Distribute the superkmers into minimizer partitions ---
+	vector<string> partition_names;
+	for (uint p=0 ; p<this->nb_partitions ; p++)
+		partition_names.push_back(output_filename + ".count_" + to_string(p) + ".tmp");
+	this->partition_sequences(partition_names, encoding);
+
+	// --- Prepare the output file ---
+	Kff_file outfile(output_filename, "w");
+	outfile.write_encoding(encoding);
+	outfile.set_uniqueness(true);
+	outfile.set_canonicity(true);
+
+	// A compacted superkmer contains at most k-m+1 kmers (all the minimizer positions)
+	const uint max_kmers = this->k - this->m + 1;
+	Section_GV sgv(&outfile);
+	sgv.write_var("k", this->k);
+	sgv.write_var("m", this->m);
+	sgv.write_var("max", max_kmers);
+	sgv.write_var("data_size", this->data_size);
+	sgv.close();
+
+	// --- Count the partitions in parallel and write them in the partition order ---
+	#pragma omp parallel num_threads(this->threads)
+	{
+		Compact compact;
+		compact.set_sizes(this->k, this->m, this->data_size, max_kmers);
+		vector<uint8_t> minimizer_seq((this->m + 3) / 4);
+		vector<uint8_t> kmer_seq((this->k - this->m + 3) / 4);
+		vector<uint8_t> data(max(1u, this->data_size));
+		const uint64_t mini_mask = (1ULL << (2 * this->m)) - 1;
+
+		#pragma omp for ordered schedule(dynamic)
+		for (uint p=0 ; p<this->nb_partitions ; p++) {
+			vector<pair<uint64_t, uint64_t> > counts = this->count_partition(partition_names[p], encoding);
+			remove(partition_names[p].c_str());
+
+			// Group the solid kmers per minimizer (minimizer, kmer, minimizer position, count)
+			vector<array<uint64_t, 4> > kmers;
+			for (const pair<uint64_t, uint64_t> & kc : counts) {
+				if (kc.second < this->min_abundance or (this->max_abundance > 0 and kc.second > this->max_abundance))
+					continue;
+
+				// Minimizer on the canonical kmer (forward strand only)
+				uint64_t minimizer = ~0ULL;
+				uint64_t mini_pos = 0;
+				for (uint pos=0 ; pos<=this->k-this->m ; pos++) {
+					uint64_t candidate = (kc.first >> (2 * (this->k - this->m - pos))) & mini_mask;
+					if (candidate < minimizer) {
+						minimizer = candidate;
+						mini_pos = pos;
+					}
+				}
+				kmers.push_back({minimizer, kc.first, mini_pos, kc.second});
+			}
+			counts.clear();
+			sort(kmers.begin(), kmers.end());
+
+			// Kmers without their minimizer in the compaction buffer
+			compact.next_free = 0;
+			vector<long> positions;
+			positions.reserve(kmers.size());
+			for (const array<uint64_t, 4> & kmer : kmers) {
+				uint64_t suffix_nucl = this->k - this->m - kmer[2];
+				uint64_t prefix = suffix_nucl == this->k - this->m ? 0 : kmer[1] >> (2 * (this->k - kmer[2]));
+				uint64_t suffix = kmer[1] & ((1ULL << (2 * suffix_nucl)) - 1);
+				uint_to_seq((prefix << (2 * suffix_nucl)) | suffix, kmer_seq.data(), this->k - this->m);
+				uint_to_data(kmer[3], data.data(), this->data_size);
+				positions.push_back(compact.add_kmer_to_buffer(kmer_seq.data(), data.data(), kmer[2]));
+			}
+
+			// Assemble the kmers of each minimizer into superkmers
+			vector<uint64_t> minimizers;
+			vector<vector<vector<uint8_t *> > > paths;
+			uint64_t idx = 0;
+			while (idx < kmers.size()) {
+				vector<uint8_t *> group;
+				uint64_t minimizer = kmers[idx][0];
+				for ( ; idx<kmers.size() and kmers[idx][0] == minimizer ; idx++)
+					group.push_back(compact.kmer_buffer + positions[idx]);
+
+				minimizers.push_back(minimizer);
+				paths.push_back(compact.assemble(group));
+			}
+
+			// One minimizer section per minimizer
+			#pragma omp ordered
+			{
+				for (uint64_t g=0 ; g<minimizers.size() ; g++) {
+					Section_Minimizer sm(&outfile);
+					uint_to_seq(minimizers[g], minimizer_seq.data(), this->m);
+					sm.write_minimizer(minimizer_seq.data());
+					compact.write_paths(paths[g], sm, this->data_size);
+					sm.close();
+				}
+			}
+		}
+	}
+
+	outfile.close();
+
+	if (this->checksum)
+		add_section_checksums(output_filename, this->threads);
+}
+
+
+void Count::partition_sequences(const vector<string> & partition_names, const uint8_t encoding[4]) {
+	vector<ofstream *> partitions;
+	for (const string & name : partition_names)
+		partitions.push_back(new ofstream(name, ios::binary | ios::trunc));
+
+	// Long sequences are cut into overlapping windows to bound the memory of the minimizer search
+	const uint64_t window_size = 1 << 16;
+	// Binarized windows loaded before a parallel partitioning
+	const uint64_t batch_size = 1 << 24;
+	vector<uint8_t> batch;
+	vector<pair<uint64_t, uint64_t> > windows;
+
+	auto partition_batch = [&]() {
+		#pragma omp parallel num_threads(this->threads)
+		{
+			MinimizerSearcher searcher(this->k, this->m, encoding, window_size);
+			vector<vector<uint8_t> > buffers(this->nb_partitions);
+			vector<uint8_t> skmer_seq((window_size + 3) / 4 + 1);
+
+			#pragma omp for schedule(dynamic)
+			for (uint64_t w=0 ; w<windows.size() ; w++) {
+				const uint8_t * seq = batch.data() + windows[w].first;
+				uint seq_size = windows[w].second;
+
+				// Superkmer record: size on 2 Bytes and binarized sequence
+				for (const skmer & sk : searcher.get_skmers(seq, seq_size)) {
+					uint64_t partition = ((sk.minimizer * 0x9E3779B97F4A7C15) >> 32) % this->nb_partitions;
+					uint16_t skmer_size = sk.stop_position - sk.start_position + 1;
+					subsequence(seq, seq_size, skmer_seq.data(), sk.start_position, sk.stop_position);
+
+					vector<uint8_t> & buffer = buffers[partition];
+					buffer.insert(buffer.end(), (uint8_t *)&skmer_size, (uint8_t *)&skmer_size + 2);
+					buffer.insert(buffer.end(), skmer_seq.data(), skmer_seq.data() + (skmer_size + 3) / 4);
+				}
+			}
+
+			#pragma omp critical
+			{
+				for (uint p=0 ; p<this->nb_partitions ; p++)
+					partitions[p]->write((char *)buffers[p].data(), buffers[p].size());
+			}
+		}
+
+		batch.clear();
+		windows.clear();
+	};
+
+	for (const string & input : this->input_filenames) {
+		FastxParser parser(input, encoding, this->k);
+		uint8_t * seq;
+		uint64_t seq_size = 0;
+
+		while ((seq_size = parser.next_fragment(seq)) > 0) {
+			for (uint64_t start=0 ; start + this->k <= seq_size ; start += window_size - this->k + 1) {
+				uint64_t size = min(seq_size - start, window_size);
+				uint64_t offset = batch.size();
+				// subsequence writes 1 extra Byte
+				batch.resize(offset + (size + 3) / 4 + 1);
+				subsequence(seq, seq_size, batch.data() + offset, start, start + size - 1);
+				batch.resize(offset + (size + 3) / 4);
+				windows.emplace_back(offset, size);
+			}
+
+			if (batch.size() >= batch_size)
+				partition_batch();
+		}
+	}
+	partition_batch();
+
+	for (ofstream * os : partitions) {
+		os->close();
+		delete os;
+	}
+}
+
+
+vector<pair<uint64_t, uint64_t> > Count::count_partition(const string & partition_name, const uint8_t encoding[4]) const {
+	// Load the partition
+	ifstream is(partition_name, ios::binary | ios::ate);
+	uint64_t file_size = is.tellg();
+	is.seekg(0);
+	vector<uint8_t> records(file_size);
+	is.read((char *)records.data(), file_size);
+	is.close();
+
+	// Canonical kmers of the superkmers
+	RevComp rc(encoding);
+	const uint64_t kmer_mask = this->k == 32 ? ~0ULL : (1ULL << (2 * this->k)) - 1;
+	vector<uint64_t> kmers;
+	uint64_t pos = 0;
+	while (pos + 2 <= file_size) {
+		uint16_t skmer_size;
+		memcpy(&skmer_size, records.data() + pos, 2);
+		const uint8_t * seq = records.data() + pos + 2;
+		uint offset = (4 - (skmer_size % 4)) % 4;
+
+		uint64_t fwd = 0;
+		uint64_t rev = 0;
+		for (uint i=0 ; i<skmer_size ; i++) {
+			uint idx = offset + i;
+			uint64_t nucl = (seq[idx / 4] >> (2 * (3 - (idx % 4)))) & 0b11;
+			fwd = ((fwd << 2) | nucl) & kmer_mask;
+			rev = (rev >> 2) | ((uint64_t)rc.reverse[nucl] << (2 * (this->k - 1)));
+			if (i + 1 >= this->k)
+				kmers.push_back(min(fwd, rev));
+		}
+
+		pos += 2 + (skmer_size + 3) / 4;
+	}
+	records.clear();
+	records.shrink_to_fit();
+
+	// Sort and reduce
+	sort(kmers.begin(), kmers.end());
+	vector<pair<uint64_t, uint64_t> > counts;
+	uint64_t idx = 0;
+	while (idx < kmers.size()) {
+		uint64_t next = idx + 1;
+		while (next < kmers.size() and kmers[next] == kmers[idx])
+			next += 1;
+		counts.emplace_back(kmers[idx], next - idx);
+		idx = next;
+	}
+
+	return counts;
+}
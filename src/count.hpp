@@ -0,0 +1,47 @@
+#include <string>
+#include <iostream>
+#include <vector>
+
+#include "CLI11.hpp"
+#include "kfftools.hpp"
+
+
+#ifndef COUNT_H
+#define COUNT_H
+
+class Count: public KffTool {
+private:
+	std::vector<std::string> input_filenames;
+	std::string output_filename;
+
+	uint k;
+	uint m;
+	uint data_size;
+	uint64_t min_abundance;
+	uint64_t max_abundance;
+
+	uint nb_partitions;
+	uint threads;
+	bool checksum;
+
+	/** Read the sequences of the input files and write their superkmers into the partition files.
+	 * The partition of a superkmer is defined by its minimizer (looked for on both strands). So all
+	 * the occurrences of a kmer and of its reverse complement are in the same partition.
+	 **/
+	void partition_sequences(const std::vector<std::string> & partition_names, const uint8_t encoding[4]);
+
+	/** Load a partition file and count its canonical kmers (sort and reduce).
+	 * @return The sorted list of unique canonical kmers (2 bits per nucleotide) and their counts.
+	 **/
+	std::vector<std::pair<uint64_t, uint64_t> > count_partition(const std::string & partition_name, const uint8_t encoding[4]) const;
+
+public:
+	Count();
+	void cli_prepare(CLI::App * subapp);
+	/** Count the kmers of FASTA/FASTQ files into a kff file. The counted kmers are canonical and
+	 * compacted into minimizer sections. The counts are stored as data.
+	 **/
+	void exec();
+};
+
+#endif
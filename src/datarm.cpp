@@ -1,7 +1,11 @@
 #include <vector>
 #include <string>
+#include <map>
+#include <cstring>
 
 #include "datarm.hpp"
+#include "sequences.hpp"
+#include "sectionreader.hpp"
 
 using namespace std;
 
@@ -10,130 +14,173 @@ using namespace std;
 DataRm::DataRm() {
 	input_filename = "";
 	output_filename = "";
+	data_size = 0;
+	log_quantize = false;
 }
 
 void DataRm::cli_prepare(CLI::App * app) {
-	this->subapp = app->add_subcommand("data-rm", "Read the input file and rewrite it in the output, removing all the data associated with the kmers.");
+	this->subapp = app->add_subcommand("data-rm", "Read the input file and rewrite it in the output, removing or projecting the data associated with the kmers. The projection of a kmer data is: selection of bytes (-b), then reading the selected bytes as a big endian value, then log quantization (--log), then saturation into the output data size (-d). Without any option, all the data are removed.");
 	CLI::Option * input_option = subapp->add_option("-i, --infile", input_filename, "The file to copy");
 	input_option->required();
 	input_option->check(CLI::ExistingFile);
 
-	CLI::Option * out_option = subapp->add_option("-o, --outfile", output_filename, "Outfile without data.");
+	CLI::Option * out_option = subapp->add_option("-o, --outfile", output_filename, "Outfile without data (or with projected data).");
 	out_option->required();
+
+	subapp->add_option("-d, --data-size", data_size, "Output data size in Bytes. The values larger than the max value of this size are saturated (default: number of selected bytes, 1 with --log, 0 otherwise).");
+	subapp->add_option("-b, --bytes", selected_bytes, "Comma separated indexes of the input data bytes to keep, in the output order (ie 0,1 to keep the 2 first bytes of a composite payload).")->delimiter(',');
+	subapp->add_flag("--log", log_quantize, "Quantize the values into log2 buckets: 0 -> 0, 1 -> 1, 2-3 -> 2, 4-7 -> 3, ..., [2^(b-1), 2^b[ -> b.");
+}
+
+
+uint DataRm::output_data_size() const {
+	if (this->data_size > 0)
+		return this->data_size;
+	if (this->selected_bytes.size() > 0 and not this->log_quantize)
+		return this->selected_bytes.size();
+	if (this->log_quantize)
+		return 1;
+	return 0;
+}
+
+
+void DataRm::project(const uint8_t * in, const uint in_size, uint8_t * out, const uint64_t nb_kmers) const {
+	uint out_size = this->output_data_size();
+	uint nb_bytes = this->selected_bytes.size() > 0 ? this->selected_bytes.size() : in_size;
+
+	// Byte selection only: copy
+	if (this->selected_bytes.size() == out_size and not this->log_quantize) {
+		for (uint64_t kmer=0 ; kmer<nb_kmers ; kmer++)
+			for (uint b=0 ; b<out_size ; b++)
+				out[kmer * out_size + b] = in[kmer * in_size + this->selected_bytes[b]];
+		return;
+	}
+
+	vector<uint8_t> selection(nb_bytes);
+	for (uint64_t kmer=0 ; kmer<nb_kmers ; kmer++) {
+		const uint8_t * value_bytes = in + kmer * in_size;
+		if (this->selected_bytes.size() > 0) {
+			for (uint b=0 ; b<nb_bytes ; b++)
+				selection[b] = value_bytes[this->selected_bytes[b]];
+			value_bytes = selection.data();
+		}
+
+		// Value of the bytes (saturated if larger than 64 bits)
+		uint64_t value = data_to_uint(value_bytes, nb_bytes);
+		for (uint b=0 ; b+8<nb_bytes ; b++)
+			if (value_bytes[b] != 0)
+				value = data_max_value(8);
+
+		if (this->log_quantize)
+			value = value == 0 ? 0 : 64 - __builtin_clzll(value);
+
+		uint_to_data(value, out + kmer * out_size, out_size);
+	}
 }
 
+
+void DataRm::rewrite_variables(const map<string, uint64_t> & vars, Kff_file & outfile) {
+	Section_GV osgv(&outfile);
+	for (auto var_tuple : vars) {
+		if (var_tuple.first == "data_size") {
+			osgv.write_var("data_size", this->output_data_size());
+			this->in_data_size = var_tuple.second;
+
+			for (uint b : this->selected_bytes)
+				if (b >= this->in_data_size) {
+					cerr << "Byte " << b << " selected but the data size is " << this->in_data_size << endl;
+					exit(1);
+				}
+		} else
+			osgv.write_var(var_tuple.first, var_tuple.second);
+	}
+	osgv.close();
+}
+
+
 void DataRm::exec() {
-	// Rewrite the encoding
-	Kff_file infile(input_filename, "r");
+	this->in_data_size = 0;
 	Kff_file outfile(output_filename, "w");
 	outfile.set_indexation(true);
-	outfile.write_encoding(infile.encoding);
 
-	// Rewrite metadata
-	uint8_t * metadata = new uint8_t[infile.metadata_size];
-	infile.read_metadata(metadata);
-	outfile.write_metadata(infile.metadata_size, metadata);
-	delete[] metadata;
+	// Files that can't be mapped are read through the kff API
+	KffSectionReader * reader = open_kff_reader(input_filename);
+	if (not reader->is_open()) {
+		cerr << input_filename << " is too small to be a kff file" << endl;
+		exit(1);
+	}
+	try {
+		this->rewrite(*reader, outfile);
+	} catch (const char * msg) {
+		cerr << msg << endl;
+		exit(1);
+	}
+	delete reader;
+
+	outfile.close();
+}
+
+
+void DataRm::rewrite(KffSectionReader & reader, Kff_file & outfile) {
+	uint out_data_size = this->output_data_size();
+
+	outfile.write_encoding(reader.encoding);
+	outfile.write_metadata(reader.metadata_size, reader.metadata);
 
-	// Prepare sequence buffer
-	uint8_t * nucleotides = new uint8_t[1];
-	uint8_t * data = new uint8_t[1];
-	uint64_t real_data_size = 1;
+	vector<uint8_t> out_data(1);
 
 	// Read and write section per section
-	char section_type = infile.read_section_type();
-	while (infile.tellp() != infile.end_position) {
-		section_type = infile.read_section_type();
-		// Read variables
+	char section_type = reader.read_section_type();
+	while (section_type != 0) {
 		if (section_type == 'v') {
-			// Load variables
-			Section_GV isgv(&infile);
-
+			map<string, uint64_t> vars = reader.read_gv();
 			// Remove old footer
-			if (isgv.vars.find("footer_size") != isgv.vars.end()) {
+			if (vars.find("footer_size") != vars.end()) {
+				section_type = reader.read_section_type();
 				continue;
 			}
 
-			Section_GV osgv(&outfile);
-
-			bool nucl_buffer_changed = false;
-			bool data_buffer_changed = false;
-			for (auto var_tuple : isgv.vars) {
-				if (var_tuple.first == "data_size") {
-					osgv.write_var("data_size", 0);
-					real_data_size = var_tuple.second;
-				} else {
-					osgv.write_var(var_tuple.first, var_tuple.second);
-
-					if (var_tuple.first == "k" or var_tuple.first == "max")
-						nucl_buffer_changed = true;
-					if (var_tuple.first == "data_size" or var_tuple.first == "max")
-						data_buffer_changed = true;
-				}
-			}
-			isgv.close();
-			osgv.close();
-
-			// Buffer update
-			if (nucl_buffer_changed) {
-				delete[] nucleotides;
-				uint max_nucl = outfile.global_vars["k"] + outfile.global_vars["max"] - 1;
-				nucleotides = new uint8_t[max_nucl / 4 + 1];
-			}
-			if (data_buffer_changed) {
-				delete[] data;
-				uint nb_data = outfile.global_vars["max"];
-				data = new uint8_t[nb_data * real_data_size];
-			}
+			this->rewrite_variables(vars, outfile);
+			out_data.resize(outfile.global_vars["max"] * out_data_size + 1);
 		}
 		else if (section_type == 'i') {
-			Section_Index si(&infile);
-			si.close();
+			int64_t next_index;
+			reader.read_index(next_index);
 		}
 		// rewrite a raw block
 		else if (section_type == 'r') {
-			// Open sections
-			Section_Raw in_section(&infile);
+			reader.open_block_section();
 			Section_Raw out_section(&outfile);
 
-			// Rewrite block per block
-			uint64_t k = outfile.global_vars["k"];
-			for (uint i=0 ; i<in_section.nb_blocks ; i++) {
-				uint nb_kmers = in_section.read_compacted_sequence(nucleotides, data);
-				out_section.write_compacted_sequence(nucleotides, k + nb_kmers - 1, nullptr);
+			KffBlock block;
+			while (reader.next_block(block)) {
+				this->project(block.data, this->in_data_size, out_data.data(), block.nb_kmers);
+				// The API does not modify the written sequence
+				out_section.write_compacted_sequence(const_cast<uint8_t *>(block.seq), reader.k + block.nb_kmers - 1, out_data.data());
 			}
 
-			in_section.close();
 			out_section.close();
 		}
 		// Revwrite a minimizer block
 		else if (section_type == 'm') {
-			// Open sections
-			Section_Minimizer in_section(&infile);
+			reader.open_block_section();
 			Section_Minimizer out_section(&outfile);
+			out_section.write_minimizer(const_cast<uint8_t *>(reader.minimizer));
 
-			// Rewrite the minimizer
-			uint k = outfile.global_vars["k"];
-			uint m = outfile.global_vars["m"];
-			out_section.write_minimizer(in_section.minimizer);
-
-			// Rewrite block per block
-			for (uint i=0 ; i<in_section.nb_blocks ; i++) {
-				// Read
-				uint64_t mini_pos;
-				uint nb_kmers = in_section.read_compacted_sequence_without_mini(nucleotides, data, mini_pos);
-				// Write
-				uint nucl_size = k - m + nb_kmers - 1;
-				out_section.write_compacted_sequence_without_mini(nucleotides, nucl_size, mini_pos, nullptr);
+			KffBlock block;
+			while (reader.next_block(block)) {
+				this->project(block.data, this->in_data_size, out_data.data(), block.nb_kmers);
+				uint nucl_size = reader.k - reader.m + block.nb_kmers - 1;
+				out_section.write_compacted_sequence_without_mini(const_cast<uint8_t *>(block.seq), nucl_size, block.mini_pos, out_data.data());
 			}
 
-			in_section.close();
 			out_section.close();
 		}
-	}
+		else {
+			cerr << "Unknown section type " << section_type << " in the file " << input_filename << endl;
+			exit(1);
+		}
 
-	delete[] nucleotides;
-	delete[] data;
-	infile.close();
-	outfile.close();
+		section_type = reader.read_section_type();
+	}
 }
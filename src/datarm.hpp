@@ -1,9 +1,11 @@
 #include <string>
 #include <iostream>
 #include <vector>
+#include <map>
 
 #include "CLI11.hpp"
 #include "kfftools.hpp"
+#include "sectionreader.hpp"
 
 
 #ifndef DATARM_H
@@ -14,6 +16,31 @@ private:
 	std::string input_filename;
 	std::string output_filename;
 
+	// Projection of the data
+	uint data_size;
+	std::vector<uint> selected_bytes;
+	bool log_quantize;
+
+	/** Output data size: -d value if set, otherwise the number of selected bytes, 1 for a log
+	 * quantization or 0 (data removed).
+	 **/
+	uint output_data_size() const;
+	/** Project the data of nb_kmers kmers (see cli_prepare for the projection steps).
+	 * @param in Input data, in_size bytes per kmer.
+	 * @param out Output data, output_data_size() bytes per kmer.
+	 **/
+	void project(const uint8_t * in, const uint in_size, uint8_t * out, const uint64_t nb_kmers) const;
+
+	// Data size of the input section being rewritten
+	uint64_t in_data_size;
+	/** Write the variables of an input variable section. The data size is replaced by the output
+	 * one.
+	 **/
+	void rewrite_variables(const std::map<std::string, uint64_t> & vars, Kff_file & outfile);
+	/** Rewrite the file section after section. The blocks are read from the reader without copy.
+	 **/
+	void rewrite(KffSectionReader & reader, Kff_file & outfile);
+
 public:
 	DataRm();
 	void cli_prepare(CLI::App * subapp);
@@ -1,9 +1,11 @@
 #include <vector>
 #include <string>
+#include <map>
 #include <cstring>
 
 #include "disjoin.hpp"
 #include "sequences.hpp"
+#include "sectionreader.hpp"
 
 
 using namespace std;
@@ -25,234 +27,193 @@ void Disjoin::cli_prepare(CLI::App * app) {
 	out_option->required();
 }
 
+// Max Bytes of kmers outside of their superkmer kept in memory. Over this limit, the current
+// minimizer section is closed, the kmers are written in a raw section and the minimizer section
+// continues in a new section with the same minimizer.
+static const size_t arena_max_bytes = 1 << 24;
+
+
 void Disjoin::exec() {
-	// Rewrite the encoding
-	Kff_file infile(input_filename, "r");
 	Kff_file outfile(output_filename, "w");
+	this->real_max = 1;
 
-	outfile.write_encoding(infile.encoding);
+	// Files that can't be mapped are read through the kff API
+	KffSectionReader * reader = open_kff_reader(input_filename);
+	if (not reader->is_open()) {
+		cerr << input_filename << " is too small to be a kff file" << endl;
+		exit(1);
+	}
+	try {
+		this->rewrite(*reader, outfile);
+	} catch (const char * msg) {
+		cerr << msg << endl;
+		exit(1);
+	}
+	delete reader;
 
-	// Rewrite metadata
-	uint8_t * metadata = new uint8_t[infile.metadata_size];
-	infile.read_metadata(metadata);
-	outfile.write_metadata(infile.metadata_size, metadata);
-	delete[] metadata;
+	vector<uint8_t>().swap(this->arena);
+	outfile.close();
+}
 
-	// Prepare sequence buffer
-	uint8_t * nucleotide_shifts[4];
-	for (uint i=0 ; i<4 ; i++)
-		nucleotide_shifts[i] = new uint8_t[1];
-	uint8_t * data = new uint8_t[1];
-	uint64_t real_max = 1;
 
-	// Read and write section per section
-	char section_type = infile.read_section_type();
-	while (infile.tellp() != infile.end_position) {
-		section_type = infile.read_section_type();
-		// Read variables
-		if (section_type == 'v') {
-			// Load variables
-			Section_GV isgv(&infile);
-			if (isgv.vars.find("footer_size") != isgv.vars.end()) {
-				continue;
-			}
+void Disjoin::rewrite_variables(const map<string, uint64_t> & vars, Kff_file & outfile) {
+	Section_GV osgv(&outfile);
 
-			Section_GV osgv(&outfile);
-
-			bool nucl_buffer_changed = false;
-			bool data_buffer_changed = false;
-			for (auto var_tuple : isgv.vars) {
-				if (var_tuple.first == "max") {
-					osgv.write_var("max", 1);
-					real_max = var_tuple.second;
-					nucl_buffer_changed = true;
-					data_buffer_changed = true;
-				} else {
-					osgv.write_var(var_tuple.first, var_tuple.second);
-					if (var_tuple.first == "k")
-						nucl_buffer_changed = true;
-					if (var_tuple.first == "data_size")
-						data_buffer_changed = true;
-				}
-			}
+	for (auto var_tuple : vars) {
+		if (var_tuple.first == "max") {
+			osgv.write_var("max", 1);
+			this->real_max = var_tuple.second;
+		} else
+			osgv.write_var(var_tuple.first, var_tuple.second);
+	}
 
-			isgv.close();
-			osgv.close();
+	osgv.close();
 
-			// Buffer update
-			if (nucl_buffer_changed) {
-				uint max_nucl = outfile.global_vars["k"] + real_max - 1;
-				for (uint i=0 ; i<4 ; i++) {
-					delete[] nucleotide_shifts[i];
-					nucleotide_shifts[i] = new uint8_t[max_nucl / 4 + 1];
-				}
-			}
-			if (data_buffer_changed) {
-				delete[] data;
-				data = new uint8_t[outfile.global_vars["data_size"] * real_max];
+	// Buffer update
+	this->kmer.resize((outfile.global_vars["k"] + 3) / 4 + 1);
+}
+
+
+void Disjoin::write_raw_block(Section_Raw & out_section, const uint8_t * seq, const uint64_t nb_kmers, const uint8_t * data, const uint k, const uint data_size) {
+	uint64_t seq_nucl = k + nb_kmers - 1;
+	// Write kmer per kmer
+	for (uint64_t kmer_idx=0 ; kmer_idx<nb_kmers ; kmer_idx++) {
+		extract_subsequence(seq, seq_nucl, this->kmer.data(), kmer_idx, k);
+		out_section.write_compacted_sequence(this->kmer.data(), k, const_cast<uint8_t *>(data) + kmer_idx * data_size);
+	}
+}
+
+
+bool Disjoin::write_minimizer_block(Section_Minimizer & out_section, const uint8_t * seq, const uint64_t nb_kmers, const uint64_t mini_pos, const uint8_t * data, const uint k, const uint m, const uint data_size) {
+	uint64_t seq_nucl = k - m + nb_kmers - 1;
+
+	// Compute limits of the superkmer (sequence induced by the minimizer)
+	int skmer_start = mini_pos - k + m;
+	// Write on block per kmer inside of the superkmer
+	for (int kmer_idx=max(0, skmer_start) ; kmer_idx<min((int)nb_kmers, (int)mini_pos+1) ; kmer_idx++) {
+		extract_subsequence(seq, seq_nucl, this->kmer.data(), kmer_idx, k - m);
+		out_section.write_compacted_sequence_without_mini(
+			this->kmer.data(),
+			k - m,
+			mini_pos - kmer_idx,
+			const_cast<uint8_t *>(data) + kmer_idx * data_size
+		);
+	}
+
+	return skmer_start > 0 or mini_pos > nb_kmers - 1;
+}
+
+
+void Disjoin::save_outside_kmers(const uint8_t * seq, const uint64_t nb_kmers, const uint64_t mini_pos, const uint8_t * data, const uint k, const uint m, const uint data_size) {
+	uint64_t seq_nucl = k + nb_kmers - 1;
+	uint kmer_bytes = (k + 3) / 4;
+
+	// Save the kmers before and after the superkmer into the arena
+	uint64_t skmer_first = max(0, (int)mini_pos - (int)k + (int)m);
+	for (uint64_t kmer_idx=0 ; kmer_idx<nb_kmers ; kmer_idx++) {
+		// Already written in the minimizer section
+		if (kmer_idx >= skmer_first and kmer_idx <= mini_pos)
+			continue;
+
+		uint64_t record = this->arena.size();
+		this->arena.resize(record + kmer_bytes + data_size);
+		extract_subsequence(seq, seq_nucl, this->arena.data() + record, kmer_idx, k);
+		memcpy(this->arena.data() + record + kmer_bytes, data + kmer_idx * data_size, data_size);
+	}
+}
+
+
+Section_Minimizer * Disjoin::flush_arena(Kff_file & outfile, Section_Minimizer * out_section, const uint8_t * minimizer, const uint k, const uint data_size) {
+	out_section->close();
+	delete out_section;
+
+	this->write_arena(outfile, k, data_size);
+
+	// Continue the minimizer section after the raw kmers
+	out_section = new Section_Minimizer(&outfile);
+	out_section->write_minimizer(const_cast<uint8_t *>(minimizer));
+	return out_section;
+}
+
+
+void Disjoin::rewrite(KffSectionReader & reader, Kff_file & outfile) {
+	outfile.write_encoding(reader.encoding);
+	outfile.write_metadata(reader.metadata_size, reader.metadata);
+
+	// Sequence with its minimizer (outside kmers of minimizer blocks)
+	vector<uint8_t> nucleotides(1);
+
+	// Read and write section per section
+	char section_type = reader.read_section_type();
+	while (section_type != 0) {
+		if (section_type == 'v') {
+			map<string, uint64_t> vars = reader.read_gv();
+			// Remove old footer
+			if (vars.find("footer_size") == vars.end()) {
+				this->rewrite_variables(vars, outfile);
+				nucleotides.resize((outfile.global_vars["k"] + this->real_max + 2) / 4 + 1);
 			}
 		}
 		else if (section_type == 'i') {
-			Section_Index si(&infile);
-			si.close();
+			int64_t next_index;
+			reader.read_index(next_index);
 		}
 		// rewrite a raw block
 		else if (section_type == 'r') {
-			// Open sections
-			Section_Raw in_section(&infile);
+			reader.open_block_section();
 			Section_Raw out_section(&outfile);
 
-			// Rewrite block per block
-			uint64_t k = outfile.global_vars["k"];
-			for (uint i=0 ; i<in_section.nb_blocks ; i++) {
-				// Read the block.
-				uint nb_kmers = in_section.read_compacted_sequence(nucleotide_shifts[0], data);
-				uint seq_nucl = k + nb_kmers - 1;
-				uint useful_bytes = seq_nucl%4==0 ? seq_nucl/4 : seq_nucl/4+1;
-				// Generate all possible shifts
-				for (uint shift=1 ; shift<4 ; shift++) {
-					memcpy(nucleotide_shifts[shift], nucleotide_shifts[shift-1], useful_bytes);
-					rightshift8(nucleotide_shifts[shift], useful_bytes, 2);
-				}
-				// Write kmer per kmer
-				uint first_nucl = (4 - (seq_nucl % 4)) % 4;
-				for (uint kmer_idx=0 ; kmer_idx<nb_kmers ; kmer_idx++) {
-					uint shift_idx = (nb_kmers - kmer_idx - 1) % 4;
-					uint first_byte = (first_nucl + kmer_idx + shift_idx) / 4;
-
-					out_section.write_compacted_sequence(
-							nucleotide_shifts[shift_idx] + first_byte,
-							k,
-							data + kmer_idx * outfile.global_vars["data_size"]
-					);
-				}
-			}
+			KffBlock block;
+			while (reader.next_block(block))
+				this->write_raw_block(out_section, block.seq, block.nb_kmers, block.data, reader.k, reader.data_size);
 
-			in_section.close();
 			out_section.close();
 		}
 		// Revwrite a minimizer block
 		else if (section_type == 'm') {
-			// Open sections
-			Section_Minimizer in_section(&infile);
-			Section_Minimizer out_section(&outfile);
-
-			vector<uint8_t *> saved_kmers;
-			vector<uint8_t *> saved_data;
-
-			// Rewrite the minimizer
-			uint k = outfile.global_vars["k"];
-			uint m = outfile.global_vars["m"];
-			uint data_size = outfile.global_vars["data_size"];
-			out_section.write_minimizer(in_section.minimizer);
-
-			// Rewrite block per block
-			for (uint i=0 ; i<in_section.nb_blocks ; i++) {
-				// Read
-				uint64_t mini_pos;
-				uint64_t nb_kmers = in_section.read_compacted_sequence_without_mini(nucleotide_shifts[0], data, mini_pos);
-				uint64_t seq_nucl = k - m + nb_kmers - 1;
-				uint useful_bytes = seq_nucl%4==0 ? seq_nucl/4 : seq_nucl/4+1;
-				// Generate all possible shifts
-				for (uint shift=1 ; shift<4 ; shift++) {
-					memcpy(nucleotide_shifts[shift], nucleotide_shifts[shift-1], useful_bytes);
-					rightshift8(nucleotide_shifts[shift], useful_bytes, 2);
+			uint64_t nb_blocks = reader.open_block_section();
+			uint k = reader.k;
+			uint m = reader.m;
+			uint data_size = reader.data_size;
+			Section_Minimizer * out_section = new Section_Minimizer(&outfile);
+			out_section->write_minimizer(const_cast<uint8_t *>(reader.minimizer));
+
+			KffBlock block;
+			for (uint64_t i=0 ; reader.next_block(block) ; i++) {
+				if (this->write_minimizer_block(*out_section, block.seq, block.nb_kmers, block.mini_pos, block.data, k, m, data_size)) {
+					reader.sequence_with_minimizer(block, nucleotides.data());
+					this->save_outside_kmers(nucleotides.data(), block.nb_kmers, block.mini_pos, block.data, k, m, data_size);
+
+					// Bounded memory
+					if (this->arena.size() >= arena_max_bytes and i < nb_blocks - 1)
+						out_section = this->flush_arena(outfile, out_section, reader.minimizer, k, data_size);
 				}
+			}
 
-				// Compute limits of the superkmer (sequence induced by the minimizer)
-				int skmer_start = mini_pos - k + m;
-				// Write on block per kmer inside of the superkmer
-				uint first_nucl = (4 - (seq_nucl % 4)) % 4;
-				for (int kmer_idx=max(0, skmer_start) ; kmer_idx<min((int)nb_kmers, (int)mini_pos+1) ; kmer_idx++) {
-					uint shift_idx = (nb_kmers - kmer_idx - 1) % 4;
-					uint first_byte = (first_nucl + kmer_idx + shift_idx) / 4;
-
-					out_section.write_compacted_sequence_without_mini(
-						nucleotide_shifts[shift_idx] + first_byte,
-						k - m,
-						mini_pos - kmer_idx,
-						data + kmer_idx * data_size
-					);
-				}
+			out_section->close();
+			delete out_section;
 
-				if (skmer_start > 0 or mini_pos > nb_kmers - 1) {
-					// Prepare sequence with minimizer
-					seq_nucl = k + nb_kmers - 1;
-					useful_bytes = seq_nucl%4==0 ? seq_nucl/4 : seq_nucl/4+1;
-					in_section.add_minimizer(nb_kmers, nucleotide_shifts[0], mini_pos);
-					// Compute all the shifts
-					for (uint shift=1 ; shift<4 ; shift++) {
-						memcpy(nucleotide_shifts[shift], nucleotide_shifts[shift-1], useful_bytes);
-						rightshift8(nucleotide_shifts[shift], useful_bytes, 2);
-					}
-
-					first_nucl = (4 - (seq_nucl % 4)) % 4;
-					// Save the kmers before superkmer
-					for (int kmer_idx=0 ; kmer_idx<skmer_start ; kmer_idx++) {
-						// Compute kmer coordinates
-						uint shift_idx = (nb_kmers - kmer_idx - 1) % 4;
-						uint first_byte = (first_nucl + kmer_idx + shift_idx) / 4;
-
-						// copy the kmer and the data
-						uint8_t * kmer = new uint8_t[useful_bytes];
-						memcpy(kmer, nucleotide_shifts[shift_idx] + first_byte, useful_bytes);
-						uint8_t * data_cpy = new uint8_t[data_size];
-						memcpy(data_cpy, data + kmer_idx * data_size, data_size);
-
-						// save kmer and data
-						saved_kmers.push_back(kmer);
-						saved_data.push_back(data_cpy);
-					}
-
-					// Save the kmers after superkmer
-					for (uint kmer_idx=mini_pos+1 ; kmer_idx<nb_kmers ; kmer_idx++) {
-						// Compute kmer coordinates
-						uint shift_idx = (nb_kmers - kmer_idx - 1) % 4;
-						uint first_byte = (first_nucl + kmer_idx + shift_idx) / 4;
-
-						// copy the kmer and the data
-						uint8_t * kmer = new uint8_t[useful_bytes];
-						memcpy(kmer, nucleotide_shifts[shift_idx] + first_byte, useful_bytes);
-						uint8_t * data_cpy = new uint8_t[data_size];
-						memcpy(data_cpy, data + kmer_idx * data_size, data_size);
-
-						// save kmer and data
-						saved_kmers.push_back(kmer);
-						saved_data.push_back(data_cpy);
-					}
-				}
+			// Final step: Write saved kmers into a raw section
+			if (this->arena.size() > 0)
+				this->write_arena(outfile, k, data_size);
+		}
+		else {
+			cerr << "Unknown section type " << section_type << " in the file " << input_filename << endl;
+			exit(1);
+		}
 
-			}
+		section_type = reader.read_section_type();
+	}
+}
 
-			in_section.close();
-			out_section.close();
 
-			if (saved_kmers.size() > 0) {
-				// Final step: Write saved kmers into a raw section
-				// Open sections
-				Section_Raw raw_section(&outfile);
-
-				// Rewrite block per block
-				uint64_t k = outfile.global_vars["k"];
-				for (uint kmer_idx=0 ; kmer_idx<saved_kmers.size() ; kmer_idx++) {
-					raw_section.write_compacted_sequence(
-							saved_kmers[kmer_idx],
-							k,
-							saved_data[kmer_idx]
-					);
-
-					delete[] saved_kmers[kmer_idx];
-					delete[] saved_data[kmer_idx];
-				}
+void Disjoin::write_arena(Kff_file & outfile, const uint k, const uint data_size) {
+	Section_Raw raw_section(&outfile);
 
-				raw_section.close();
-			}
-		}
-	}
+	uint kmer_bytes = (k + 3) / 4;
+	for (uint64_t record=0 ; record<this->arena.size() ; record+=kmer_bytes+data_size)
+		raw_section.write_compacted_sequence(this->arena.data() + record, k, this->arena.data() + record + kmer_bytes);
 
-	for (uint i=0 ; i<4 ; i++)
-		delete[] nucleotide_shifts[i];
-	delete[] data;
-	infile.close();
-	outfile.close();
+	raw_section.close();
+	this->arena.clear();
 }
@@ -1,9 +1,11 @@
 #include <string>
 #include <iostream>
 #include <vector>
+#include <map>
 
 #include "CLI11.hpp"
 #include "kfftools.hpp"
+#include "sectionreader.hpp"
 
 
 #ifndef DISJOIN_H
@@ -14,6 +16,44 @@ private:
 	std::string input_filename;
 	std::string output_filename;
 
+	// Kmers of the current minimizer section that are outside of their superkmer window. Records:
+	// kmer ((k+3)/4 Bytes) then data. Reused from a section to another.
+	std::vector<uint8_t> arena;
+
+	// max value of the input section being rewritten (always 1 in the output)
+	uint64_t real_max;
+	// Buffer for one kmer
+	std::vector<uint8_t> kmer;
+
+	/** Write the variables of an input variable section (max replaced by 1).
+	 **/
+	void rewrite_variables(const std::map<std::string, uint64_t> & vars, Kff_file & outfile);
+	/** Write one block per kmer of a raw block.
+	 **/
+	void write_raw_block(Section_Raw & out_section, const uint8_t * seq, const uint64_t nb_kmers, const uint8_t * data, const uint k, const uint data_size);
+	/** Write one block per kmer containing the minimizer of a minimizer block.
+	 * @param seq Block sequence without the minimizer.
+	 * @return true if some kmers of the block do not contain the minimizer (see save_outside_kmers).
+	 **/
+	bool write_minimizer_block(Section_Minimizer & out_section, const uint8_t * seq, const uint64_t nb_kmers, const uint64_t mini_pos, const uint8_t * data, const uint k, const uint m, const uint data_size);
+	/** Save the kmers of a minimizer block that do not contain the minimizer into the arena.
+	 * @param seq Block sequence with the minimizer.
+	 **/
+	void save_outside_kmers(const uint8_t * seq, const uint64_t nb_kmers, const uint64_t mini_pos, const uint8_t * data, const uint k, const uint m, const uint data_size);
+	/** Close the minimizer section, write the arena into a raw section and continue the minimizer
+	 * section in a new one.
+	 * @return The new minimizer section.
+	 **/
+	Section_Minimizer * flush_arena(Kff_file & outfile, Section_Minimizer * out_section, const uint8_t * minimizer, const uint k, const uint data_size);
+	/** Write the kmers of the arena into a raw section and empty the arena.
+	 **/
+	void write_arena(Kff_file & outfile, const uint k, const uint data_size);
+
+	/** Disjoin the file section after section. The kmers kept in the arena are copied out of the
+	 * reader (the block pointers do not outlive the next read).
+	 **/
+	void rewrite(KffSectionReader & reader, Kff_file & outfile);
+
 public:
 	Disjoin();
 	void cli_prepare(CLI::App * subapp);
@@ -1,3 +1,8 @@
+#include <cstring>
+#if defined(__x86_64__)
+#include <tmmintrin.h>
+#endif
+
 #include "encoding.hpp"
 #include "sequences.hpp"
 
@@ -24,11 +29,44 @@ Translator::Translator(uint8_t source[4], uint8_t destination[4]) {
 			lookup[i] = lookup[i] | (letter << (2*pos));
 		}
 	}
+
+	for (uint i=0 ; i<16 ; i++) {
+		low_lookup[i] = lookup[i] & 0x0F;
+		high_lookup[i] = low_lookup[i] << 4;
+	}
 }
 
+#if defined(__x86_64__)
+/** Translate the sequence 16 Bytes by 16 Bytes with SSSE3. Each half Byte (2 nucleotides) is
+ * translated with a shuffle.
+ * @return The number of Bytes translated (multiple of 16).
+ **/
+__attribute__((target("ssse3")))
+static size_t translate_ssse3(uint8_t * sequence, const size_t byte_length, const uint8_t low_table[16], const uint8_t high_table[16]) {
+	const __m128i low_lut = _mm_loadu_si128((const __m128i *)low_table);
+	const __m128i high_lut = _mm_loadu_si128((const __m128i *)high_table);
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+
+	size_t done = 0;
+	for ( ; done + 16 <= byte_length ; done += 16) {
+		__m128i bytes = _mm_loadu_si128((const __m128i *)(sequence + done));
+		__m128i low = _mm_shuffle_epi8(low_lut, _mm_and_si128(bytes, nibble));
+		__m128i high = _mm_shuffle_epi8(high_lut, _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble));
+		_mm_storeu_si128((__m128i *)(sequence + done), _mm_or_si128(low, high));
+	}
+	return done;
+}
+#endif
+
 void Translator::translate(uint8_t * sequence, size_t byte_length) {
+	size_t done = 0;
+#if defined(__x86_64__)
+	static const bool ssse3 = __builtin_cpu_supports("ssse3");
+	if (ssse3 and byte_length >= 16)
+		done = translate_ssse3(sequence, byte_length, this->low_lookup, this->high_lookup);
+#endif
 	// Translate Byte per Byte
-	for (size_t idx=0 ; idx<byte_length ; idx++) {
+	for (size_t idx=done ; idx<byte_length ; idx++) {
 		// Translate a Byte
 		sequence[idx] = lookup[sequence[idx]];
 	}
@@ -99,6 +137,7 @@ Stringifyer::Stringifyer(uint8_t encoding[4]) {
 			// Write in the lookup table
 			lookup[i] = nucl_translation[letter] + lookup[i];
 		}
+		memcpy(letters[i], lookup[i].data(), 4);
 	}
 }
 
@@ -125,6 +164,24 @@ string Stringifyer::translate(const uint8_t * sequence, const size_t nucl_length
 }
 
 
+void Stringifyer::translate(const uint8_t * sequence, const size_t nucl_length, char * out) const {
+	if (nucl_length == 0)
+		return;
+
+	// Prefix can be truncated
+	uint prefix = nucl_length % 4 == 0 ? 4 : nucl_length % 4;
+	memcpy(out, letters[sequence[0]] + 4 - prefix, prefix);
+	out += prefix;
+
+	// 4 nucleotides per Byte
+	size_t byte_length = (nucl_length + 3) / 4;
+	for (size_t idx=1 ; idx<byte_length ; idx++) {
+		memcpy(out, letters[sequence[idx]], 4);
+		out += 4;
+	}
+}
+
+
 string Stringifyer::translate(uint64_t sequence, const size_t nucl_length) const {
 	uint8_t bytes[8] = {0, 0, 0, 0, 0, 0, 0, 0};
 	for (uint length=0 ; length*4<nucl_length ;	 length++) {
@@ -150,6 +207,12 @@ Binarizer::Binarizer(const uint8_t encoding[4]) {
 		this->multi_lookup[pos]['T'] = (encoding[3] & 0b11) << (6 - 2 * pos);
 		this->multi_lookup[pos]['t'] = (encoding[3] & 0b11) << (6 - 2 * pos);
 	}
+
+	// (ascii >> 1) & 0b11 is 0 for A, 1 for C, 3 for G and 2 for T
+	this->ascii_codes[0] = encoding[0] & 0b11;
+	this->ascii_codes[1] = encoding[1] & 0b11;
+	this->ascii_codes[3] = encoding[2] & 0b11;
+	this->ascii_codes[2] = encoding[3] & 0b11;
 }
 
 
@@ -172,3 +235,61 @@ void Binarizer::translate(std::string sequence, uint seq_size, uint8_t * binariz
 	}
 }
 
+
+/** Pack 4 nucleotides of ACGT chars into a byte.
+ **/
+static inline uint8_t pack_ascii(const char * nucl, const uint8_t codes[4]) {
+	return (codes[(nucl[0] >> 1) & 0b11] << 6) | (codes[(nucl[1] >> 1) & 0b11] << 4)
+	     | (codes[(nucl[2] >> 1) & 0b11] << 2) | codes[(nucl[3] >> 1) & 0b11];
+}
+
+#if defined(__x86_64__)
+/** Pack the nucleotides 16 by 16 with SSSE3.
+ * @return The number of nucleotides packed (multiple of 16).
+ **/
+__attribute__((target("ssse3")))
+static size_t pack_ascii_ssse3(const char * nucl, const size_t nb_nucl, uint8_t * binarized, const uint8_t codes[4]) {
+	const __m128i lut = _mm_setr_epi8(codes[0], codes[1], codes[2], codes[3], 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i two_bits = _mm_set1_epi8(0b11);
+	// c0 * 4 + c1 in 16 bits lanes, then (c0 * 4 + c1) * 16 + c2 * 4 + c3 in 32 bits lanes
+	const __m128i pair_weights = _mm_set1_epi16(0x0104);
+	const __m128i quad_weights = _mm_set1_epi32(0x00010010);
+	const __m128i gather = _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+
+	size_t done = 0;
+	for ( ; done + 16 <= nb_nucl ; done += 16) {
+		__m128i chars = _mm_loadu_si128((const __m128i *)(nucl + done));
+		__m128i codes_vec = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(chars, 1), two_bits));
+		__m128i pairs = _mm_maddubs_epi16(codes_vec, pair_weights);
+		__m128i quads = _mm_madd_epi16(pairs, quad_weights);
+		int packed = _mm_cvtsi128_si32(_mm_shuffle_epi8(quads, gather));
+		memcpy(binarized + done / 4, &packed, 4);
+	}
+	return done;
+}
+#endif
+
+
+void Binarizer::translate_acgt(const char * sequence, const size_t seq_size, uint8_t * binarized) const {
+	if (seq_size == 0)
+		return;
+
+	// First Byte (padding at the beginning)
+	size_t prefix = seq_size % 4 == 0 ? 4 : seq_size % 4;
+	binarized[0] = 0;
+	for (size_t n=0 ; n<prefix ; n++)
+		binarized[0] = (binarized[0] << 2) | this->ascii_codes[(sequence[n] >> 1) & 0b11];
+	sequence += prefix;
+	binarized += 1;
+	size_t remaining = seq_size - prefix;
+
+	// Following bytes, 16 nucleotides at once when possible
+	size_t done = 0;
+#if defined(__x86_64__)
+	static const bool ssse3 = __builtin_cpu_supports("ssse3");
+	if (ssse3)
+		done = pack_ascii_ssse3(sequence, remaining, binarized, this->ascii_codes);
+#endif
+	for ( ; done<remaining ; done+=4)
+		binarized[done / 4] = pack_ascii(sequence + done, this->ascii_codes);
+}
@@ -15,6 +15,9 @@
 class Translator {
 private:
 	uint8_t lookup[256];
+	// Translation of half Bytes (low and high positions) for the vectorized translation
+	uint8_t low_lookup[16];
+	uint8_t high_lookup[16];
 
 public:
 	/**
@@ -28,6 +31,8 @@ public:
 	Translator(uint8_t source[4], uint8_t destination[4]);
 	/**
 	  * Inplace translate the sequence from the source encoding to the destination.
+	  * 16 Bytes are translated at once with SSSE3 when available (nucleotides translated 2 by 2
+	  * with a 16 entries shuffle table).
 	  *
 	  * @param sequence 2-bit compacted sequence that will be translated regarding
 	  * the encodings.
@@ -59,6 +64,8 @@ public:
 class Stringifyer {
 private:
 	std::string lookup[256];
+	// Same table without strings for the allocation free translation
+	char letters[256][4];
 
 public:
 	/**
@@ -76,6 +83,14 @@ public:
 	  **/
 	std::string translate(const uint8_t * sequence, const size_t nucl_length) const;
 	std::string translate(uint64_t sequence, const size_t nucl_length) const;
+	/**
+	  * Write the nucleotides of a 2-bits/nucl sequence in a char array (no string allocation).
+	  *
+	  * @param sequence 2-bit compacted sequence.
+	  * @param nucl_length Length in nucleotides of the sequence.
+	  * @param out Array of at least nucl_length chars. No trailing \0 is written.
+	  **/
+	void translate(const uint8_t * sequence, const size_t nucl_length, char * out) const;
 };
 
 
@@ -83,6 +98,8 @@ class Binarizer {
 private:
 	std::map<std::string, uint8_t> lookup;
 	std::map<char, uint8_t> multi_lookup[4];
+	// Encoding value of A, C, T, G (index = (ascii >> 1) & 0b11, same for lower case letters)
+	uint8_t ascii_codes[4];
 
 public:
 	/**
@@ -100,6 +117,16 @@ public:
 		* The space must be allocated outside of the function.
 		*/
 	void translate(std::string sequence, uint seq_size, uint8_t * binarized);
+	/**
+		* Fast translation of a sequence that contains only A, C, G, T (upper or lower case).
+		* Other characters are not detected and give undefined nucleotides. 16 nucleotides are packed
+		* at once with SSSE3 instructions when the processor supports them.
+		*
+		* @param sequence chars to translate.
+		* @param seq_size number of nucleotides.
+		* @param binarized array of at least (seq_size + 3) / 4 Bytes.
+		*/
+	void translate_acgt(const char * sequence, const size_t seq_size, uint8_t * binarized) const;
 };
 
 #endif
@@ -0,0 +1,578 @@
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_BZIP2
+#include <bzlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "fastx.hpp"
+
+
+using namespace std;
+
+
+Compression detect_compression(const string & filename) {
+	uint8_t magic[4] = {0, 0, 0, 0};
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return NO_COMPRESSION;
+	ssize_t nb_read = ::read(fd, magic, 4);
+	::close(fd);
+
+	if (nb_read >= 2 and magic[0] == 0x1f and magic[1] == 0x8b)
+		return GZIP;
+	if (nb_read >= 3 and magic[0] == 'B' and magic[1] == 'Z' and magic[2] == 'h')
+		return BZIP2;
+	if (nb_read == 4 and magic[0] == 0x28 and magic[1] == 0xb5 and magic[2] == 0x2f and magic[3] == 0xfd)
+		return ZSTD;
+	return NO_COMPRESSION;
+}
+
+
+BlockReader::BlockReader(const string & filename, const size_t ring_buffer_size, const uint ring_length) {
+	this->compression = detect_compression(filename);
+	this->fd = ::open(filename.c_str(), O_RDONLY);
+	if (this->fd < 0) {
+		cerr << "Impossible to open " << filename << endl;
+		exit(1);
+	}
+	posix_fadvise(this->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	this->produced = 0;
+	this->consumed = 0;
+	this->consumed_offset = 0;
+	this->finished = false;
+	this->stopped = false;
+
+	if (this->compression == NO_COMPRESSION)
+		return;
+
+	bool supported = false;
+	string format;
+	switch (this->compression) {
+	case GZIP:
+		format = "gzip";
+#ifdef HAVE_ZLIB
+		supported = true;
+#endif
+		break;
+	case BZIP2:
+		format = "bzip2";
+#ifdef HAVE_BZIP2
+		supported = true;
+#endif
+		break;
+	case ZSTD:
+		format = "zstd";
+#ifdef HAVE_ZSTD
+		supported = true;
+#endif
+		break;
+	default:
+		break;
+	}
+	if (not supported) {
+		cerr << filename << " is compressed with " << format << " but kff-tools was compiled without " << format << " support." << endl;
+		exit(1);
+	}
+
+	this->ring.resize(ring_length, vector<char>(ring_buffer_size));
+	this->ring_sizes.resize(ring_length, 0);
+	this->decompressor = thread(&BlockReader::decompress, this);
+}
+
+BlockReader::~BlockReader() {
+	if (this->decompressor.joinable()) {
+		{
+			lock_guard<mutex> lock(this->ring_mutex);
+			this->stopped = true;
+		}
+		this->ring_cv.notify_all();
+		this->decompressor.join();
+	}
+	::close(this->fd);
+}
+
+
+size_t BlockReader::read_file(char * buffer, const size_t size) {
+	while (true) {
+		ssize_t nb_read = ::read(this->fd, buffer, size);
+		if (nb_read >= 0)
+			return nb_read;
+		if (errno != EINTR) {
+			cerr << "Error while reading the input: " << strerror(errno) << endl;
+			exit(1);
+		}
+	}
+}
+
+
+size_t BlockReader::read(char * buffer, const size_t size) {
+	if (this->compression == NO_COMPRESSION)
+		return this->read_file(buffer, size);
+
+	uint64_t slot;
+	{
+		unique_lock<mutex> lock(this->ring_mutex);
+		this->ring_cv.wait(lock, [this]{ return this->produced > this->consumed or this->finished; });
+		if (this->produced == this->consumed) {
+			if (this->error != "") {
+				cerr << "Error while decompressing the input: " << this->error << endl;
+				exit(1);
+			}
+			return 0;
+		}
+		slot = this->consumed % this->ring.size();
+	}
+
+	// The decompression thread does not touch this buffer until it is consumed
+	size_t nb_read = min(size, this->ring_sizes[slot] - this->consumed_offset);
+	memcpy(buffer, this->ring[slot].data() + this->consumed_offset, nb_read);
+	this->consumed_offset += nb_read;
+
+	if (this->consumed_offset == this->ring_sizes[slot]) {
+		{
+			lock_guard<mutex> lock(this->ring_mutex);
+			this->consumed += 1;
+		}
+		this->consumed_offset = 0;
+		this->ring_cv.notify_all();
+	}
+
+	return nb_read;
+}
+
+
+char * BlockReader::acquire_buffer() {
+	unique_lock<mutex> lock(this->ring_mutex);
+	this->ring_cv.wait(lock, [this]{ return this->produced - this->consumed < this->ring.size() or this->stopped; });
+	if (this->stopped)
+		return nullptr;
+	return this->ring[this->produced % this->ring.size()].data();
+}
+
+void BlockReader::release_buffer(const size_t size) {
+	if (size == 0)
+		return;
+	{
+		lock_guard<mutex> lock(this->ring_mutex);
+		this->ring_sizes[this->produced % this->ring.size()] = size;
+		this->produced += 1;
+	}
+	this->ring_cv.notify_all();
+}
+
+void BlockReader::finish(const string & message) {
+	{
+		lock_guard<mutex> lock(this->ring_mutex);
+		this->error = message;
+		this->finished = true;
+	}
+	this->ring_cv.notify_all();
+}
+
+
+void BlockReader::decompress() {
+	switch (this->compression) {
+	case GZIP:
+		this->decompress_gzip();
+		break;
+	case BZIP2:
+		this->decompress_bzip2();
+		break;
+	case ZSTD:
+		this->decompress_zstd();
+		break;
+	default:
+		this->finish("");
+	}
+}
+
+
+void BlockReader::decompress_gzip() {
+#ifdef HAVE_ZLIB
+	vector<char> input(1 << 20);
+	const size_t capacity = this->ring[0].size();
+
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	// 15 + 32: gzip or zlib header automatically detected
+	if (inflateInit2(&zs, 15 + 32) != Z_OK) {
+		this->finish("zlib initialization failed");
+		return;
+	}
+
+	char * out = this->acquire_buffer();
+	zs.next_out = (Bytef *)out;
+	zs.avail_out = capacity;
+	bool in_member = false;
+	// Pending output can remain inside of the decompressor when the output buffer is full
+	bool output_full = false;
+	string message = "";
+
+	while (out != nullptr) {
+		if (zs.avail_in == 0 and not output_full) {
+			size_t nb_read = this->read_file(input.data(), input.size());
+			if (nb_read == 0) {
+				if (in_member)
+					message = "truncated gzip file";
+				break;
+			}
+			zs.next_in = (Bytef *)input.data();
+			zs.avail_in = nb_read;
+		}
+
+		if (zs.avail_in > 0)
+			in_member = true;
+		int ret = inflate(&zs, Z_NO_FLUSH);
+		if (ret == Z_STREAM_END) {
+			// Multiple members (concatenated gzip files, bgzf blocks)
+			inflateReset(&zs);
+			in_member = false;
+		} else if (ret != Z_OK and ret != Z_BUF_ERROR) {
+			message = zs.msg != nullptr ? zs.msg : "corrupted gzip file";
+			break;
+		}
+
+		output_full = zs.avail_out == 0;
+		if (output_full) {
+			this->release_buffer(capacity);
+			out = this->acquire_buffer();
+			zs.next_out = (Bytef *)out;
+			zs.avail_out = capacity;
+		}
+	}
+
+	if (out != nullptr)
+		this->release_buffer(capacity - zs.avail_out);
+	inflateEnd(&zs);
+	this->finish(message);
+#endif
+}
+
+
+void BlockReader::decompress_bzip2() {
+#ifdef HAVE_BZIP2
+	vector<char> input(1 << 20);
+	const size_t capacity = this->ring[0].size();
+
+	bz_stream bs;
+	memset(&bs, 0, sizeof(bs));
+	if (BZ2_bzDecompressInit(&bs, 0, 0) != BZ_OK) {
+		this->finish("bzip2 initialization failed");
+		return;
+	}
+
+	char * out = this->acquire_buffer();
+	bs.next_out = out;
+	bs.avail_out = capacity;
+	bool in_stream = false;
+	bool output_full = false;
+	string message = "";
+
+	while (out != nullptr) {
+		if (bs.avail_in == 0 and not output_full) {
+			size_t nb_read = this->read_file(input.data(), input.size());
+			if (nb_read == 0) {
+				if (in_stream)
+					message = "truncated bzip2 file";
+				break;
+			}
+			bs.next_in = input.data();
+			bs.avail_in = nb_read;
+		}
+
+		if (bs.avail_in > 0)
+			in_stream = true;
+		int ret = BZ2_bzDecompress(&bs);
+		if (ret == BZ_STREAM_END) {
+			// Multiple streams (concatenated files, parallel bzip2 compressors)
+			char * next_in = bs.next_in;
+			uint avail_in = bs.avail_in;
+			char * next_out = bs.next_out;
+			uint avail_out = bs.avail_out;
+			BZ2_bzDecompressEnd(&bs);
+			memset(&bs, 0, sizeof(bs));
+			BZ2_bzDecompressInit(&bs, 0, 0);
+			bs.next_in = next_in;
+			bs.avail_in = avail_in;
+			bs.next_out = next_out;
+			bs.avail_out = avail_out;
+			in_stream = false;
+		} else if (ret != BZ_OK) {
+			message = "corrupted bzip2 file";
+			break;
+		}
+
+		output_full = bs.avail_out == 0;
+		if (output_full) {
+			this->release_buffer(capacity);
+			out = this->acquire_buffer();
+			bs.next_out = out;
+			bs.avail_out = capacity;
+		}
+	}
+
+	if (out != nullptr)
+		this->release_buffer(capacity - bs.avail_out);
+	BZ2_bzDecompressEnd(&bs);
+	this->finish(message);
+#endif
+}
+
+
+void BlockReader::decompress_zstd() {
+#ifdef HAVE_ZSTD
+	vector<char> input(ZSTD_DStreamInSize());
+	const size_t capacity = this->ring[0].size();
+
+	ZSTD_DStream * ds = ZSTD_createDStream();
+	ZSTD_initDStream(ds);
+
+	char * out = this->acquire_buffer();
+	ZSTD_outBuffer zout = {out, capacity, 0};
+	ZSTD_inBuffer zin = {input.data(), 0, 0};
+	// 0 when the last frame is complete
+	size_t frame_remaining = 0;
+	bool output_full = false;
+	string message = "";
+
+	while (out != nullptr) {
+		if (zin.pos == zin.size and not output_full) {
+			size_t nb_read = this->read_file(input.data(), input.size());
+			if (nb_read == 0) {
+				if (frame_remaining != 0)
+					message = "truncated zstd file";
+				break;
+			}
+			zin.size = nb_read;
+			zin.pos = 0;
+		}
+
+		// Multiple frames are decompressed one after the other
+		frame_remaining = ZSTD_decompressStream(ds, &zout, &zin);
+		if (ZSTD_isError(frame_remaining)) {
+			message = ZSTD_getErrorName(frame_remaining);
+			break;
+		}
+
+		output_full = zout.pos == zout.size;
+		if (output_full) {
+			this->release_buffer(capacity);
+			out = this->acquire_buffer();
+			zout.dst = out;
+			zout.pos = 0;
+		}
+	}
+
+	if (out != nullptr)
+		this->release_buffer(zout.pos);
+	ZSTD_freeDStream(ds);
+	this->finish(message);
+#endif
+}
+
+
+
+LineReader::LineReader(const string & filename, const size_t block_size) : reader(filename), buffer(block_size) {
+	this->begin = 0;
+	this->end = 0;
+	this->end_of_file = false;
+}
+
+
+bool LineReader::refill() {
+	if (this->end_of_file)
+		return false;
+
+	// Keep the beginning of the current line
+	if (this->begin > 0) {
+		memmove(this->buffer.data(), this->buffer.data() + this->begin, this->end - this->begin);
+		this->end -= this->begin;
+		this->begin = 0;
+	}
+	// Line larger than the buffer
+	if (this->end == this->buffer.size())
+		this->buffer.resize(2 * this->buffer.size());
+
+	size_t nb_read = this->reader.read(this->buffer.data() + this->end, this->buffer.size() - this->end);
+	if (nb_read == 0) {
+		this->end_of_file = true;
+		return false;
+	}
+	this->end += nb_read;
+	return true;
+}
+
+
+bool LineReader::next_line(const char * & line, size_t & size) {
+	size_t searched = this->begin;
+	while (true) {
+		char * eol = (char *)memchr(this->buffer.data() + searched, '\n', this->end - searched);
+		if (eol != nullptr) {
+			line = this->buffer.data() + this->begin;
+			size = eol - line;
+			this->begin = eol - this->buffer.data() + 1;
+			break;
+		}
+
+		// No more end of line: the last line of the file has no '\n'
+		searched = this->end - this->begin;
+		if (not this->refill()) {
+			if (this->begin == this->end)
+				return false;
+			line = this->buffer.data() + this->begin;
+			size = this->end - this->begin;
+			this->begin = this->end;
+			break;
+		}
+	}
+
+	// Windows end of lines
+	if (size > 0 and line[size - 1] == '\r')
+		size -= 1;
+	return true;
+}
+
+
+bool LineReader::next_lines(vector<char> & chunk, const size_t chunk_size) {
+	while (true) {
+		size_t available = this->end - this->begin;
+		if (available >= chunk_size or this->end_of_file) {
+			if (available == 0)
+				return false;
+
+			const char * start = this->buffer.data() + this->begin;
+			size_t limit = min(available, chunk_size);
+			// Last end of line before the limit, or first one after it for a very long line
+			const char * eol = (const char *)memrchr(start, '\n', limit);
+			if (eol == nullptr)
+				eol = (const char *)memchr(start + limit, '\n', available - limit);
+
+			size_t size = 0;
+			if (eol != nullptr)
+				size = eol - start + 1;
+			else if (this->end_of_file)
+				size = available;
+
+			if (size > 0) {
+				chunk.assign(start, start + size);
+				this->begin += size;
+				return true;
+			}
+		}
+
+		// Not enough bytes in the buffer (grows if needed)
+		this->refill();
+	}
+}
+
+
+char LineReader::peek() {
+	if (this->begin == this->end and not this->refill())
+		return 0;
+	return this->buffer[this->begin];
+}
+
+
+
+/** Chars accepted as nucleotides (ACGTacgt)
+ **/
+struct NucleotideTable {
+	bool valid[256];
+
+	NucleotideTable() {
+		memset(valid, 0, 256);
+		for (char c : string("ACGTacgt"))
+			valid[(uint8_t)c] = true;
+	}
+};
+
+static const NucleotideTable nucleotides;
+
+
+FastxParser::FastxParser(const string & filename, const uint8_t encoding[4], const uint k)
+		: lines(filename), bz(encoding) {
+	this->k = k;
+	this->fastq = this->lines.peek() == '@';
+	this->record_position = 0;
+}
+
+
+bool FastxParser::is_fastx(const string & filename) {
+	BlockReader reader(filename);
+	char first = 0;
+	reader.read(&first, 1);
+	return first == '>' or first == '@';
+}
+
+
+bool FastxParser::next_record() {
+	this->record.clear();
+	this->record_position = 0;
+
+	const char * line;
+	size_t size;
+	char first = this->fastq ? '@' : '>';
+
+	// Skip everything until the next header
+	while (this->lines.peek() != first) {
+		if (not this->lines.next_line(line, size))
+			return false;
+	}
+	this->lines.next_line(line, size);
+
+	// Sequence lines until the next header (FASTA) or the separator line (FASTQ)
+	char stop = this->fastq ? '+' : '>';
+	while (this->lines.peek() != stop and this->lines.peek() != 0) {
+		this->lines.next_line(line, size);
+		this->record.insert(this->record.end(), line, line + size);
+	}
+
+	// FASTQ: skip the separator and as many quality chars as nucleotides
+	if (this->fastq and this->lines.next_line(line, size)) {
+		size_t nb_qualities = 0;
+		while (nb_qualities < this->record.size() and this->lines.next_line(line, size))
+			nb_qualities += size;
+	}
+
+	return true;
+}
+
+
+uint64_t FastxParser::next_fragment(uint8_t * & seq) {
+	while (true) {
+		const char * chars = this->record.data();
+		size_t record_size = this->record.size();
+
+		while (this->record_position < record_size) {
+			// Skip the chars that are not nucleotides
+			while (this->record_position < record_size and not nucleotides.valid[(uint8_t)chars[this->record_position]])
+				this->record_position += 1;
+
+			size_t start = this->record_position;
+			while (this->record_position < record_size and nucleotides.valid[(uint8_t)chars[this->record_position]])
+				this->record_position += 1;
+			size_t fragment_size = this->record_position - start;
+
+			if (fragment_size >= this->k) {
+				if (this->binarized.size() < (fragment_size + 3) / 4)
+					this->binarized.resize((fragment_size + 3) / 4);
+				this->bz.translate_acgt(chars + start, fragment_size, this->binarized.data());
+				seq = this->binarized.data();
+				return fragment_size;
+			}
+		}
+
+		if (not this->next_record())
+			return 0;
+	}
+}
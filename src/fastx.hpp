@@ -0,0 +1,152 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "encoding.hpp"
+
+
+#ifndef FASTX_H
+#define FASTX_H
+
+
+/** Compression of an input file, detected from its first bytes.
+ **/
+enum Compression {NO_COMPRESSION, GZIP, BZIP2, ZSTD};
+
+/** Look at the magic bytes of a file (1f 8b: gzip, "BZh": bzip2, 28 b5 2f fd: zstd).
+ **/
+Compression detect_compression(const std::string & filename);
+
+
+/** Read a file by large blocks (read syscalls of several MB, no line by line iostream).
+ * Compressed files (gzip, bzip2 or zstd) are transparently decompressed by a dedicated thread
+ * that fills a ring of buffers in advance. So the decompression overlaps the parsing of the
+ * previous buffers.
+ **/
+class BlockReader {
+private:
+  int fd;
+  Compression compression;
+
+  // Ring of decompressed buffers. The decompression thread fills the buffer produced % ring size
+  // while the reader empties the buffer consumed % ring size.
+  std::vector<std::vector<char> > ring;
+  std::vector<size_t> ring_sizes;
+  uint64_t produced;
+  uint64_t consumed;
+  size_t consumed_offset;
+  bool finished;
+  bool stopped;
+  std::string error;
+  std::mutex ring_mutex;
+  std::condition_variable ring_cv;
+  std::thread decompressor;
+
+  /** Read the file bytes (compressed or not) **/
+  size_t read_file(char * buffer, const size_t size);
+
+  /** Main function of the decompression thread **/
+  void decompress();
+  void decompress_gzip();
+  void decompress_bzip2();
+  void decompress_zstd();
+  /** Wait for a free buffer in the ring.
+   * @return The buffer to fill or nullptr if the reader has been destroyed.
+   **/
+  char * acquire_buffer();
+  /** Give a filled buffer to the reader **/
+  void release_buffer(const size_t size);
+  /** End of the decompression. An empty message means no error. **/
+  void finish(const std::string & message);
+
+public:
+  /** Open the file. Exit if the file can't be opened or if it is compressed with a format that is
+   * not supported by this build.
+   * @param ring_buffer_size Size of each decompressed buffer.
+   * @param ring_length Number of decompressed buffers that can be ready in advance.
+   **/
+  BlockReader(const std::string & filename, const size_t ring_buffer_size=1 << 22, const uint ring_length=4);
+  ~BlockReader();
+
+  /** Read the next (decompressed) bytes of the file.
+   * @return The number of bytes read, 0 at the end of the file.
+   **/
+  size_t read(char * buffer, const size_t size);
+};
+
+
+/** Line reader over a BlockReader. The lines are given as pointers inside of a large buffer.
+ **/
+class LineReader {
+private:
+  BlockReader reader;
+  std::vector<char> buffer;
+  size_t begin;
+  size_t end;
+  bool end_of_file;
+
+  /** Move the remaining bytes at the beginning of the buffer and read the next block.
+   * @return false if nothing more can be read.
+   **/
+  bool refill();
+
+public:
+  LineReader(const std::string & filename, const size_t block_size=1 << 23);
+
+  /** Get the next line, without its end of line chars ('\n' and '\r').
+   * The pointer is valid until the next call.
+   * @return false at the end of the file.
+   **/
+  bool next_line(const char * & line, size_t & size);
+  /** Get the next complete lines, about chunk_size bytes (more if a single line is larger).
+   * @param chunk Replaced by the lines, including their end of line chars.
+   * @return false at the end of the file.
+   **/
+  bool next_lines(std::vector<char> & chunk, const size_t chunk_size);
+  /** Look at the first char of the next line without reading it.
+   * @return 0 at the end of the file.
+   **/
+  char peek();
+};
+
+
+/** FASTA (single or multi-line) and FASTQ parser. The format is detected from the first char of the
+ * file ('>' or '@'). The sequences are split at every char that is not A, C, G or T (upper or
+ * lower case), ie N or other IUPAC codes. The fragments shorter than k are dropped.
+ **/
+class FastxParser {
+private:
+  LineReader lines;
+  Binarizer bz;
+  uint k;
+  bool fastq;
+
+  // Sequence of the current record (lines concatenated)
+  std::vector<char> record;
+  // Position of the next fragment search in the record
+  size_t record_position;
+  std::vector<uint8_t> binarized;
+
+  /** Load the sequence of the next record.
+   * @return false at the end of the file.
+   **/
+  bool next_record();
+
+public:
+  FastxParser(const std::string & filename, const uint8_t encoding[4], const uint k);
+
+  /** Get the next fragment of at least k nucleotides.
+   * @param seq Filled with a pointer to the binarized fragment. The array is erased during the
+   * next call.
+   * @return The size of the fragment in nucleotides, 0 at the end of the file.
+   **/
+  uint64_t next_fragment(uint8_t * & seq);
+  /** Tell if a file looks like a FASTA or FASTQ file (first char '>' or '@' after decompression).
+   **/
+  static bool is_fastx(const std::string & filename);
+};
+
+#endif
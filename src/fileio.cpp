@@ -0,0 +1,344 @@
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fileio.hpp"
+
+
+using namespace std;
+
+
+MappedFile::MappedFile(const string & filename, const bool writable) {
+	this->data = nullptr;
+	this->size = 0;
+
+	int fd = ::open(filename.c_str(), writable ? O_RDWR : O_RDONLY);
+	if (fd < 0)
+		return;
+
+	// Only plain files can be mapped
+	struct stat st;
+	if (fstat(fd, &st) != 0 or not S_ISREG(st.st_mode) or st.st_size == 0) {
+		::close(fd);
+		return;
+	}
+
+	void * addr = mmap(nullptr, st.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	// The mapping stays valid after the descriptor is closed
+	::close(fd);
+	if (addr == MAP_FAILED)
+		return;
+
+	madvise(addr, st.st_size, MADV_SEQUENTIAL);
+	this->data = (uint8_t *)addr;
+	this->size = st.st_size;
+}
+
+MappedFile::~MappedFile() {
+	if (this->data != nullptr)
+		munmap(this->data, this->size);
+}
+
+
+
+SectionCopier::~SectionCopier() {
+	for (auto & p : this->mappings)
+		delete p.second;
+}
+
+
+MappedFile * SectionCopier::get_mapping(Kff_file * infile) {
+	auto it = this->mappings.find(infile->filename);
+	if (it != this->mappings.end())
+		return it->second;
+
+	MappedFile * mf = new MappedFile(infile->filename);
+	// The file on disk must be the complete kff file (a file can be present only in memory)
+	if (not mf->is_open() or mf->size < (size_t)infile->end_position + 3) {
+		delete mf;
+		mf = nullptr;
+	}
+
+	this->mappings[infile->filename] = mf;
+	return mf;
+}
+
+
+void SectionCopier::release(const string & filename) {
+	auto it = this->mappings.find(filename);
+	if (it != this->mappings.end()) {
+		delete it->second;
+		this->mappings.erase(it);
+	}
+}
+
+
+void SectionCopier::buffered_copy(Kff_file * infile, Kff_file * outfile, long size) {
+	const long buffer_size = 1048576; // 1 MB
+	uint8_t * buffer = new uint8_t[buffer_size];
+
+	// Read from input and write into output
+	while (size > 0) {
+		size_t size_to_copy = size > buffer_size ? buffer_size : size;
+
+		infile->read(buffer, size_to_copy);
+		outfile->write(buffer, size_to_copy);
+
+		size -= size_to_copy;
+	}
+
+	delete[] buffer;
+}
+
+
+void SectionCopier::copy(Kff_file * infile, Kff_file * outfile, long size) {
+	// Max number of bytes given at once to the output file
+	const long window_size = 1l << 26; // 64 MB
+	const long probe_size = 64;
+
+	MappedFile * mf = this->get_mapping(infile);
+	long position = infile->tellp();
+	if (mf == nullptr or (size_t)(position + size) > mf->size) {
+		this->buffered_copy(infile, outfile, size);
+		return;
+	}
+
+	// Verify that the bytes on disk are the same than the bytes seen by the API
+	uint8_t probe[probe_size];
+	long to_probe = size < probe_size ? size : probe_size;
+	infile->read(probe, to_probe);
+	outfile->write(probe, to_probe);
+	if (memcmp(probe, mf->data + position, to_probe) != 0) {
+		this->release(infile->filename);
+		this->mappings[infile->filename] = nullptr;
+		this->buffered_copy(infile, outfile, size - to_probe);
+		return;
+	}
+
+	// Direct transfer from the mapped pages
+	long remaining = size - to_probe;
+	uint8_t * current = mf->data + position + to_probe;
+	while (remaining > 0) {
+		long to_copy = remaining > window_size ? window_size : remaining;
+		outfile->write(current, to_copy);
+		current += to_copy;
+		remaining -= to_copy;
+	}
+	infile->jump(size - to_probe);
+}
+
+
+
+void copy_range(int in_fd, long in_position, int out_fd, long out_position, long size) {
+#ifdef __linux__
+	// In kernel copy
+	loff_t in_off = in_position;
+	loff_t out_off = out_position;
+	while (size > 0) {
+		ssize_t copied = copy_file_range(in_fd, &in_off, out_fd, &out_off, size, 0);
+		if (copied <= 0)
+			break;
+		size -= copied;
+	}
+	in_position = in_off;
+	out_position = out_off;
+#endif
+
+	// Fallback (or remaining bytes)
+	const long buffer_size = 1048576; // 1 MB
+	uint8_t * buffer = nullptr;
+	if (size > 0)
+		buffer = new uint8_t[buffer_size];
+
+	while (size > 0) {
+		long to_read = size > buffer_size ? buffer_size : size;
+		ssize_t nb_read = pread(in_fd, buffer, to_read, in_position);
+		if (nb_read <= 0) {
+			cerr << "Error while reading " << to_read << " bytes at position " << in_position << endl;
+			exit(1);
+		}
+		write_range(out_fd, buffer, nb_read, out_position);
+
+		in_position += nb_read;
+		out_position += nb_read;
+		size -= nb_read;
+	}
+
+	delete[] buffer;
+}
+
+
+OutputBuffer::OutputBuffer(int fd, size_t capacity) {
+	this->fd = fd;
+	this->capacity = capacity;
+	this->buffer = new char[capacity];
+	this->used = 0;
+}
+
+OutputBuffer::~OutputBuffer() {
+	this->flush();
+	delete[] this->buffer;
+}
+
+
+void OutputBuffer::write(const char * bytes, size_t size) {
+	if (this->fd < 0)
+		this->reserve(size);
+
+	while (size > 0) {
+		if (this->used == this->capacity)
+			this->flush();
+		size_t chunk = min(size, this->capacity - this->used);
+		memcpy(this->buffer + this->used, bytes, chunk);
+		this->used += chunk;
+		bytes += chunk;
+		size -= chunk;
+	}
+}
+
+
+void OutputBuffer::write_uint(uint64_t value) {
+	// Digits written from the end
+	char digits[20];
+	uint nb_digits = 0;
+	do {
+		digits[19 - nb_digits] = '0' + value % 10;
+		value /= 10;
+		nb_digits += 1;
+	} while (value != 0);
+
+	memcpy(this->reserve(nb_digits), digits + 20 - nb_digits, nb_digits);
+	this->used += nb_digits;
+}
+
+
+void OutputBuffer::make_room(const size_t nb_bytes) {
+	if (this->fd >= 0)
+		this->flush();
+	if (this->used + nb_bytes <= this->capacity)
+		return;
+
+	this->capacity = max(2 * this->capacity, this->used + nb_bytes);
+	char * larger = new char[this->capacity];
+	memcpy(larger, this->buffer, this->used);
+	delete[] this->buffer;
+	this->buffer = larger;
+}
+
+
+void OutputBuffer::flush() {
+	if (this->fd < 0)
+		return;
+
+	size_t written = 0;
+	while (written < this->used) {
+		ssize_t nb = ::write(this->fd, this->buffer + written, this->used - written);
+		if (nb < 0 and errno == EINTR)
+			continue;
+		if (nb <= 0) {
+			cerr << "Error while writing the output: " << strerror(errno) << endl;
+			exit(1);
+		}
+		written += nb;
+	}
+	this->used = 0;
+}
+
+
+void write_range(int fd, const uint8_t * bytes, long size, long position) {
+	while (size > 0) {
+		ssize_t written = pwrite(fd, bytes, size, position);
+		if (written <= 0) {
+			cerr << "Error while writing " << size << " bytes at position " << position << endl;
+			exit(1);
+		}
+		bytes += written;
+		position += written;
+		size -= written;
+	}
+}
+
+
+
+void append_value(vector<uint8_t> & bytes, uint64_t value, const uint nb_bytes) {
+	for (int b=nb_bytes-1 ; b>=0 ; b--)
+		bytes.push_back((uint8_t)(value >> (8 * b)));
+}
+
+
+vector<uint8_t> serialize_header(const uint8_t major, const uint8_t minor, const uint8_t encoding[4],
+																 const bool uniqueness, const bool canonicity,
+																 const uint8_t * metadata, const uint32_t metadata_size) {
+	vector<uint8_t> bytes = {'K', 'F', 'F', major, minor};
+	// Encoding: 2 bits per nucleotide in the order A, C, G, T
+	uint8_t code = 0;
+	for (uint i=0 ; i<4 ; i++)
+		code = (code << 2) | (encoding[i] & 0b11);
+	bytes.push_back(code);
+	bytes.push_back(uniqueness ? 1 : 0);
+	bytes.push_back(canonicity ? 1 : 0);
+	// Metadata
+	append_value(bytes, metadata_size, 4);
+	bytes.insert(bytes.end(), metadata, metadata + metadata_size);
+
+	return bytes;
+}
+
+
+vector<uint8_t> serialize_gv(const map<string, uint64_t> & vars) {
+	vector<uint8_t> bytes = {'v'};
+	append_value(bytes, vars.size());
+	for (const auto & p : vars) {
+		bytes.insert(bytes.end(), p.first.begin(), p.first.end());
+		bytes.push_back(0);
+		append_value(bytes, p.second);
+	}
+
+	return bytes;
+}
+
+
+vector<uint8_t> serialize_index(const vector<pair<char, long> > & sections,
+																const long index_position, const long next_index) {
+	// Offsets are relative to the end of the index section
+	long end_position = index_position + 17 + 9 * sections.size();
+
+	vector<uint8_t> bytes = {'i'};
+	append_value(bytes, sections.size());
+	for (const auto & p : sections) {
+		bytes.push_back(p.first);
+		append_value(bytes, (uint64_t)(p.second - end_position));
+	}
+	append_value(bytes, next_index == 0 ? 0 : (uint64_t)(next_index - end_position));
+
+	return bytes;
+}
+
+
+vector<uint8_t> serialize_footer(const map<string, uint64_t> & values, const long first_index) {
+	vector<uint8_t> bytes = {'v'};
+	append_value(bytes, values.size() + 2);
+	for (const auto & p : values) {
+		bytes.insert(bytes.end(), p.first.begin(), p.first.end());
+		bytes.push_back(0);
+		append_value(bytes, p.second);
+	}
+
+	string fi_name = "first_index";
+	bytes.insert(bytes.end(), fi_name.begin(), fi_name.end());
+	bytes.push_back(0);
+	append_value(bytes, first_index);
+
+	// footer_size must be the last variable to be read from the end of the file
+	string fs_name = "footer_size";
+	bytes.insert(bytes.end(), fs_name.begin(), fs_name.end());
+	bytes.push_back(0);
+	append_value(bytes, bytes.size() + 8);
+
+	return bytes;
+}
@@ -0,0 +1,170 @@
+#include <cstdint>
+#include <string>
+#include <map>
+#include <vector>
+#include <unordered_map>
+
+#include "kff_io.hpp"
+
+
+#ifndef FILEIO_H
+#define FILEIO_H
+
+
+/** Memory mapping of a complete file (read-only by default).
+ * The mapping is released when the object is destroyed. If the file cannot be mapped, data is a
+ * nullptr and size is 0.
+ **/
+class MappedFile {
+public:
+  uint8_t * data;
+  size_t size;
+
+  /** @param writable Shared writable mapping: the modified bytes are written back to the file.
+   **/
+  MappedFile(const std::string & filename, const bool writable=false);
+  ~MappedFile();
+
+  bool is_open() const { return this->data != nullptr; }
+};
+
+
+/** Object used to copy sections from a kff file to another without going through a user space
+ * buffer. When the input file is a plain file fully written on disk, it is memory mapped and the
+ * section bytes are directly given to the output file (one copy less, no read syscall).
+ * Otherwise (file only present in memory, pipe, ...) the copy fallbacks on a buffered read/write.
+ * The mappings are kept open during the copier lifetime to be reused from a section to another.
+ **/
+class SectionCopier {
+private:
+  std::unordered_map<std::string, MappedFile *> mappings;
+
+  /** Return the mapping of the input file or nullptr if the file can't be used for zero copy.
+   **/
+  MappedFile * get_mapping(Kff_file * infile);
+  void buffered_copy(Kff_file * infile, Kff_file * outfile, long size);
+
+public:
+  SectionCopier() {};
+  ~SectionCopier();
+
+  /** Copy the next size bytes of infile at the end of outfile.
+   * The infile cursor is moved size bytes forward.
+   *
+   * @param infile File where to read the bytes (from its current position).
+   * @param outfile File where to append the bytes.
+   * @param size Number of bytes to transfer.
+   **/
+  void copy(Kff_file * infile, Kff_file * outfile, long size);
+  /** Release the mapping related to a file (ie before its deletion).
+   **/
+  void release(const std::string & filename);
+};
+
+
+
+/** Large output buffer written on a file descriptor (ie stdout) with few write calls.
+ * The text is formatted directly inside of the buffer, without any intermediate string.
+ * The remaining bytes are written when the object is destroyed.
+ * With a negative file descriptor, the buffer is only in memory and grows when needed (ie to
+ * format a part of an output in a thread before writing it).
+ **/
+class OutputBuffer {
+private:
+  int fd;
+  char * buffer;
+  size_t capacity;
+  size_t used;
+
+  /** Flush the buffer or grow it (memory only buffer) to fit nb_bytes more bytes.
+   **/
+  void make_room(const size_t nb_bytes);
+
+public:
+  OutputBuffer(int fd, size_t capacity=1 << 22);
+  OutputBuffer(const OutputBuffer &) = delete;
+  OutputBuffer & operator=(const OutputBuffer &) = delete;
+  ~OutputBuffer();
+
+  /** Get a pointer where at least nb_bytes can be written. The written bytes are then added to
+   * the buffer with commit.
+   **/
+  char * reserve(const size_t nb_bytes) {
+    if (this->used + nb_bytes > this->capacity)
+      this->make_room(nb_bytes);
+    return this->buffer + this->used;
+  };
+  void commit(const size_t nb_bytes) { this->used += nb_bytes; };
+
+  void write(const char * bytes, size_t size);
+  void put(const char c) { *this->reserve(1) = c; this->used += 1; };
+  /** Write the decimal representation of a value.
+   **/
+  void write_uint(uint64_t value);
+  /** Write all the buffered bytes on the file descriptor. Exit on error.
+   * Nothing is done for a memory only buffer.
+   **/
+  void flush();
+
+  const char * data() const { return this->buffer; };
+  size_t size() const { return this->used; };
+  void clear() { this->used = 0; };
+};
+
+
+
+// ----- Raw file descriptor operations -----
+
+/** Copy a byte range from a file to another at explicit positions. The copy is performed inside
+ * of the kernel (copy_file_range) when possible, otherwise with pread/pwrite. As no file cursor
+ * is used, multiple threads can copy concurrently into the same output descriptor.
+ *
+ * @param in_fd Input file descriptor
+ * @param in_position First byte to copy in the input
+ * @param out_fd Output file descriptor
+ * @param out_position Position of the first byte in the output
+ * @param size Number of bytes to copy
+ **/
+void copy_range(int in_fd, long in_position, int out_fd, long out_position, long size);
+
+/** Write all the bytes at a given position of a file (pwrite loop). Exit on error.
+ **/
+void write_range(int fd, const uint8_t * bytes, long size, long position);
+
+
+// ----- Raw kff serialization -----
+// Used when the sections are written without a Kff_file object (ie parallel writes)
+
+/** Append a big endian value of nb_bytes bytes to a byte vector.
+ **/
+void append_value(std::vector<uint8_t> & bytes, uint64_t value, const uint nb_bytes=8);
+
+/** Serialize a kff header (from the KFF signature to the end of the metadata).
+ **/
+std::vector<uint8_t> serialize_header(const uint8_t major, const uint8_t minor, const uint8_t encoding[4],
+                                      const bool uniqueness, const bool canonicity,
+                                      const uint8_t * metadata, const uint32_t metadata_size);
+
+/** Serialize a global variable section.
+ **/
+std::vector<uint8_t> serialize_gv(const std::map<std::string, uint64_t> & vars);
+
+/** Serialize an index section.
+ *
+ * @param sections Type and absolute position of each indexed section.
+ * @param index_position Absolute position where the index section will be written.
+ * @param next_index Absolute position of the next index section (0 if none).
+ **/
+std::vector<uint8_t> serialize_index(const std::vector<std::pair<char, long> > & sections,
+                                     const long index_position, const long next_index=0);
+
+/** Serialize a footer (global variable section read from the end of the file).
+ * The first_index and footer_size variables are added after the other values, footer_size being
+ * the last one.
+ *
+ * @param values Footer values to write (ie summed values from merged footers).
+ * @param first_index Absolute position of the first index section (0 if there is no index).
+ **/
+std::vector<uint8_t> serialize_footer(const std::map<std::string, uint64_t> & values, const long first_index);
+
+#endif
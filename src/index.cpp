@@ -1,4 +1,8 @@
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "index.hpp"
+#include "fileio.hpp"
 
 using namespace std;
 
@@ -6,6 +10,7 @@ using namespace std;
 Index::Index() {
   input_filename = "";
   output_filename = "";
+  in_place = false;
 }
 
 
@@ -14,12 +19,82 @@ void Index::cli_prepare(CLI::App * app) {
   CLI::Option * input_option = subapp->add_option("-i, --infile", input_filename, "Input kff file to index.");
   input_option->required();
   input_option->check(CLI::ExistingFile);
-  CLI::Option * out_option = subapp->add_option("-o, --outfile", output_filename, "Indexed kff to write (must be different from the input)");
-  out_option->required();
+  subapp->add_option("-o, --outfile", output_filename, "Indexed kff to write (must be different from the input)");
+  subapp->add_flag("--in-place", in_place, "Append the index to the input file instead of writing a copy. Only the end of the file (footer) is rewritten.");
+}
+
+
+void Index::index_in_place() {
+  Kff_file infile(this->input_filename, "r");
+  uint8_t * meta = new uint8_t[infile.metadata_size];
+  infile.read_metadata(meta);
+  delete[] meta;
+
+  // Scan the section boundaries
+  vector<pair<char, long> > sections;
+  map<string, uint64_t> footer_values;
+  long cut_position = infile.end_position;
+  while (infile.tellp() != infile.end_position) {
+    char section_type = infile.read_section_type();
+    long position = infile.tellp();
+
+    if (section_type == 'v') {
+      Section_GV sgv(&infile);
+      sgv.close();
+      // The footer is replaced
+      if (sgv.vars.find("footer_size") != sgv.vars.end()) {
+        cut_position = position;
+        for (const auto & p : sgv.vars)
+          if (p.first != "footer_size" and p.first != "first_index")
+            footer_values[p.first] = p.second;
+        continue;
+      }
+    } else if (section_type == 'i') {
+      // Previous indexes are not referenced anymore
+      Section_Index si(&infile);
+      si.close();
+      continue;
+    } else if (not infile.jump_next_section()) {
+      cerr << "Error inside of the input file." << endl;
+      cerr << "Impossible to jump over the section " << section_type << endl;
+      exit(1);
+    }
+
+    sections.emplace_back(section_type, position);
+  }
+  infile.close();
+
+  // New end of the file: index, footer and signature
+  vector<uint8_t> tail = serialize_index(sections, cut_position);
+  vector<uint8_t> footer = serialize_footer(footer_values, cut_position);
+  tail.insert(tail.end(), footer.begin(), footer.end());
+  tail.push_back('K'); tail.push_back('F'); tail.push_back('F');
+
+  int fd = ::open(this->input_filename.c_str(), O_WRONLY);
+  if (fd < 0) {
+    cerr << "Impossible to open " << this->input_filename << " in write mode." << endl;
+    exit(1);
+  }
+  write_range(fd, tail.data(), tail.size(), cut_position);
+  // Remove the remaining bytes of a larger previous footer
+  if (ftruncate(fd, cut_position + tail.size()) != 0) {
+    cerr << "Impossible to truncate " << this->input_filename << endl;
+    exit(1);
+  }
+  ::close(fd);
 }
 
 
 void Index::exec() {
+  if (this->in_place) {
+    this->index_in_place();
+    return;
+  }
+  if (this->output_filename == "") {
+    cerr << "An output file (-o) is needed when the index is not added in place." << endl;
+    exit(1);
+  }
+
   Kff_file infile(this->input_filename, "r");
   Kff_file outfile(this->output_filename, "w");
 
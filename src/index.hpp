@@ -14,6 +14,12 @@ class Index: public KffTool {
 private:
 	std::string input_filename;
 	std::string output_filename;
+	bool in_place;
+
+	/** Add the index at the end of the input file. The previous footer is truncated and replaced by
+	 * the index section followed by a new footer. The sections are not rewritten.
+	 **/
+	void index_in_place();
 
 public:
 	Index();
@@ -1,8 +1,10 @@
 #include <string>
-#include <fstream>
 #include <vector>
+#include <map>
 #include <unordered_map>
 #include <queue>
+#include <array>
+#include <algorithm>
 #include <cstring>
 #include <cstdio>
 #include <cstdlib>
@@ -11,6 +13,8 @@
 #include "encoding.hpp"
 #include "merge.hpp"
 #include "sequences.hpp"
+#include "fastx.hpp"
+#include "fileio.hpp"
 
 
 using namespace std;
@@ -18,20 +22,27 @@ using namespace std;
 
 
 Instr::Instr() {
-	input_filename = "";
+	list_filename = "";
 	output_filename = "";
 	data_size = 0;
 	k = 0;
 	max_kmerseq = 255;
 	delimiter = " ";
 	data_delimiter = ",";
+	threads = 1;
+	one_section = false;
+	m = 0;
+	singleside = false;
+	searcher = nullptr;
+	rc = nullptr;
 }
 
 void Instr::cli_prepare(CLI::App * app) {
-	this->subapp = app->add_subcommand("instr", "Convert a text kmer file or a text sequence file into a kff file. Kmers or sequences must be 1 per line. If data size is more than 0, then the delimiters are used to split each line.");
-	CLI::Option * input_option = subapp->add_option("-i, --infile", input_filename, "A text file with one sequence per line (sequence omitted if its size < k). Empty data is added (size defined by -d option).");
-	input_option->required();
+	this->subapp = app->add_subcommand("instr", "Convert a text kmer file, a text sequence file or a FASTA/FASTQ file into a kff file. In text files, kmers or sequences must be 1 per line. If data size is more than 0, then the delimiters are used to split each line.");
+	CLI::Option * input_option = subapp->add_option("-i, --infile", input_filenames, "Text files with one sequence per line (sequence omitted if its size < k) or FASTA/FASTQ files (detected from the first char). FASTA/FASTQ sequences are split at each non ACGT char and the fragments smaller than k are omitted. Empty data is added (size defined by -d option). gzip, bzip2 and zstd compressed files are decompressed on the fly.");
 	input_option->check(CLI::ExistingFile);
+	CLI::Option * list_option = subapp->add_option("-l, --file-list", list_filename, "A file containing the paths of the input files (one per line). Added after the -i files.");
+	list_option->check(CLI::ExistingFile);
 	CLI::Option * output_option = subapp->add_option("-o, --outfile", output_filename, "The kff output file name.");
 	output_option->required();
 	CLI::Option * k_opt = subapp->add_option("-k, --kmer-size", k, "Mandatory kmer size");
@@ -40,163 +51,447 @@ void Instr::cli_prepare(CLI::App * app) {
 	subapp->add_option("--delimiter", this->delimiter, "Character used as a delimiter between the sequence and the data (default ' ').");
 	subapp->add_option("--data-delimiter", this->data_delimiter, "Character used as a delimiter between two kmers data from the same sequence (default ',').");
 	subapp->add_option("-m, --max-kmer-seq", max_kmerseq, "The maximum number of kmer that can be inside of sequence in the output (default 255).");
+	subapp->add_option("--minimizer-size", m, "Write minimizer sections instead of a raw section. The sequences are split into superkmers that are bucketized in memory regarding their minimizer of this size [Max 31]. WARNING: If the minimizer is on the reverse strand of a superkmer, the superkmer is reverse complemented (see --single-side).");
+	subapp->add_flag("--single-side", singleside, "With --minimizer-size, look for the minimizers only on the forward strand.");
+	subapp->add_option("-t, --threads", threads, "Number of threads (Default 1). With a single text input, the lines are split into chunks parsed in parallel. With multiple inputs, the files are parsed in parallel. The sequences are always written in the input order.");
+	subapp->add_flag("--one-section", one_section, "With multiple inputs, write the sequences of all the files in the same section(s). By default, each file has its own section(s).");
 }
 
 
-/** Read txt sequence file (1 sequence per line)
- */
-class TxtSeqStream : public SequenceStream {
-private:
-  std::fstream fs;
-  Binarizer bz;
-
-  uint buffer_size;
-  uint8_t * seq_buffer;
-  uint8_t * data_buffer;
-
-  uint k;
-  uint data_size;
-  bool data_present;
-
-  string delimiter;
-  string data_delimiter;
-
-public:
-  TxtSeqStream(const std::string filename, const uint8_t encoding[4], uint k, uint data_size, string delim, string data_delim) 
-      : fs(filename, std::fstream::in)
-      , bz(encoding)
-      , buffer_size(1024)
-      , seq_buffer(new uint8_t[1024])
-      , data_buffer(new uint8_t[(1024 * 4 - k + 1	) * data_size])
-      , k(k)
-      , data_size(data_size)
-      , delimiter(delim)
-      , data_delimiter(data_delim)
-  {};
-  ~TxtSeqStream() {
-    this->fs.close();
-    delete[] this->seq_buffer;
-    delete[] this->data_buffer;
-  }
-
-	uint next_sequence(uint8_t * & seq, uint8_t * & data) {
-		// Verify stream integrity
-		if (not this->fs)
-			return 0;
-
-		// read next sequence
-		string line;
-		getline(this->fs, line);
-		if (line.size() == 0)
-			return 0;
+/** Sequences and data parsed from a chunk of lines of a txt file.
+ **/
+struct TxtChunk {
+	std::vector<char> text;
+	// Binarized sequences, each one starting on a new Byte
+	std::vector<uint8_t> sequences;
+	std::vector<uint8_t> data;
+	// Offset in sequences, size in nucleotides and offset in data of each sequence
+	std::vector<std::array<uint64_t, 3> > records;
+	// An empty line has been found: end of the input
+	bool last;
+};
+
+
+/** Parse an unsigned integer after optional spaces. Stops at the first non digit char.
+ **/
+static inline uint64_t parse_uint(const char * & str, const char * end) {
+	while (str < end and (*str == ' ' or *str == '\t'))
+		str += 1;
+
+	uint64_t value = 0;
+	while (str < end and (uint8_t)(*str - '0') < 10) {
+		value = value * 10 + (*str - '0');
+		str += 1;
+	}
+	return value;
+}
+
+
+/** Parse the lines of a chunk (1 sequence per line, followed by the kmer data if data_size > 0).
+ * The sequences smaller than k are omitted.
+ **/
+static void parse_txt_chunk(TxtChunk & chunk, const Binarizer & bz, const uint k, const uint data_size, const string & delimiter) {
+	chunk.sequences.clear();
+	chunk.data.clear();
+	chunk.records.clear();
+	chunk.last = false;
+
+	const char * text = chunk.text.data();
+	const char * text_end = text + chunk.text.size();
+	while (text < text_end) {
+		// Next line
+		const char * line = text;
+		const char * eol = (const char *)memchr(line, '\n', text_end - line);
+		const char * line_end = eol == nullptr ? text_end : eol;
+		text = line_end + 1;
+		if (line_end > line and *(line_end - 1) == '\r')
+			line_end -= 1;
+
+		if (line_end == line) {
+			chunk.last = true;
+			return;
+		}
 
 		// Get the split limit
-		size_t seq_size = 0;
-		if (this->data_size == 0)
-			seq_size = line.size();
-		else {
-			seq_size = line.find(this->delimiter);
-			if (seq_size == string::npos) {
-				cerr << "Delimiter not found in" << endl << "\t" << line << endl;
+		size_t seq_size = line_end - line;
+		if (data_size > 0) {
+			const char * delim = search(line, line_end, delimiter.begin(), delimiter.end());
+			if (delim == line_end) {
+				cerr << "Delimiter not found in" << endl << "\t" << string(line, line_end) << endl;
 				exit(1);
 			}
+			seq_size = delim - line;
 		}
 
-		uint nb_kmers = seq_size - k + 1;
-
-		// Update buffers
-		if (seq_size > this->buffer_size * 4) {
-			delete[] this->seq_buffer;
-			this->buffer_size = (seq_size + 3) / 4;
-			this->seq_buffer = new uint8_t[this->buffer_size];
-
-			delete[] this->data_buffer;
-			this->data_buffer = new uint8_t[(seq_size - k + 1) * this->data_size];
-		}
-		// convert/copy the sequence
-		this->bz.translate(line, seq_size, this->seq_buffer);
-		seq = this->seq_buffer;
-
-		// If counts
-		if (this->data_size > 0) {
-			char * str_data = (char *)line.c_str() + seq_size + 1;
-
-			for (uint i=0 ; i<nb_kmers ; i++) {
-				unsigned long count = strtoul(str_data, &str_data, 10);
-				str_data += 1;
-				for (uint d=0 ; d<this->data_size ; d++) {
+		// Sequence too small
+		if (seq_size < k)
+			continue;
+		uint64_t nb_kmers = seq_size - k + 1;
+
+		// convert the sequence
+		uint64_t seq_offset = chunk.sequences.size();
+		chunk.sequences.resize(seq_offset + (seq_size + 3) / 4);
+		bz.translate_acgt(line, seq_size, chunk.sequences.data() + seq_offset);
+
+		// Kmer data (0 when missing)
+		uint64_t data_offset = chunk.data.size();
+		chunk.data.resize(data_offset + nb_kmers * data_size);
+		if (data_size > 0) {
+			uint8_t * data = chunk.data.data() + data_offset;
+			const char * str_data = line + seq_size + delimiter.size();
+
+			for (uint64_t i=0 ; i<nb_kmers ; i++) {
+				uint64_t count = parse_uint(str_data, line_end);
+				if (str_data < line_end)
+					str_data += 1;
+				for (uint d=0 ; d<data_size ; d++) {
 					data[data_size * i + (data_size-1-d)] = (uint8_t)count & 0xFF;
 					count >>= 8;
 				}
 			}
 		}
 
-		return seq_size;
+		chunk.records.push_back({seq_offset, seq_size, data_offset});
 	}
+}
 
-	int next_sequence(uint8_t * & seq, uint max_seq_size, uint8_t * & data, uint max_data_size) {
-		return this->next_sequence(seq, data);
-  }
-};
+
+/** Parse a whole input file (txt or FASTA/FASTQ). The sequences of a txt file are split into
+ * multiple chunks of lines, a FASTA/FASTQ file is loaded in a single chunk (empty data).
+ **/
+static void parse_file(const string & filename, vector<TxtChunk> & chunks, const Binarizer & bz, const uint8_t encoding[4], const uint k, const uint data_size, const string & delimiter) {
+	chunks.clear();
+
+	if (FastxParser::is_fastx(filename)) {
+		chunks.emplace_back();
+		TxtChunk & chunk = chunks.back();
+		chunk.last = false;
+
+		FastxParser parser(filename, encoding, k);
+		uint8_t * seq;
+		uint64_t seq_size = 0;
+		while ((seq_size = parser.next_fragment(seq)) > 0) {
+			uint64_t seq_offset = chunk.sequences.size();
+			uint64_t data_offset = chunk.data.size();
+			chunk.sequences.insert(chunk.sequences.end(), seq, seq + (seq_size + 3) / 4);
+			chunk.data.resize(data_offset + (seq_size - k + 1) * data_size, 0);
+			chunk.records.push_back({seq_offset, seq_size, data_offset});
+		}
+	} else {
+		LineReader lines(filename);
+		const size_t chunk_size = 1 << 22;
+		chunks.emplace_back();
+		while (lines.next_lines(chunks.back().text, chunk_size)) {
+			parse_txt_chunk(chunks.back(), bz, k, data_size, delimiter);
+			vector<char>().swap(chunks.back().text);
+			// An empty line ends the file
+			if (chunks.back().last)
+				break;
+			chunks.emplace_back();
+		}
+	}
+}
 
 
 
 void Instr::exec() {
+	if (this->m > 0 and (this->m > 31 or this->m >= this->k)) {
+		cerr << "The minimizer size must be at most 31 and smaller than k" << endl;
+		exit(1);
+	}
+	if (this->threads == 0)
+		this->threads = 1;
+
+	// Input files from the command line then from the list
+	vector<string> filenames = this->input_filenames;
+	if (this->list_filename != "") {
+		LineReader list(this->list_filename);
+		const char * line;
+		size_t size;
+		while (list.next_line(line, size))
+			if (size > 0)
+				filenames.emplace_back(line, size);
+	}
+	if (filenames.size() == 0) {
+		cerr << "No input file (-i or -l option)" << endl;
+		exit(1);
+	}
+
 	// Open a KFF for output
 	Kff_file outfile(this->output_filename, "w");
+	// Table of the input files: 1 line "index\tpath" per file
+	if (filenames.size() > 1) {
+		string meta = "";
+		for (uint64_t f=0 ; f<filenames.size() ; f++)
+			meta += to_string(f) + "\t" + filenames[f] + "\n";
+		outfile.write_metadata(meta.length(), (uint8_t *)meta.c_str());
+	}
 	// Write needed variables
 	Section_GV sgv(&outfile);
 	sgv.write_var("k", this->k);
 	sgv.write_var("data_size", this->data_size);
 	sgv.write_var("ordered", 0);
 	sgv.write_var("max", this->max_kmerseq);
+	if (this->m > 0)
+		sgv.write_var("m", this->m);
 	sgv.close();
 
-	// Open the input seq stream
 	const uint8_t encoding[4] = {0, 1, 3, 2};
-	TxtSeqStream stream(input_filename, encoding, this->k, this->data_size, this->delimiter, this->data_delimiter);
+	if (this->m > 0) {
+		this->searcher = new MinimizerSearcher(this->k, this->m, encoding, 0, this->singleside);
+		this->rc = new RevComp(encoding);
+	}
 
-	// Write the sequences inside of a raw section
-	Section_Raw sr(&outfile);
+	if (filenames.size() == 1)
+		this->monofile(outfile, filenames[0], encoding);
+	else
+		this->multifile(outfile, filenames, encoding);
 
-	uint8_t * seq;
-	uint8_t * sub_seq = new uint8_t[(max_kmerseq + 3) / 4];
-	uint8_t * data = new uint8_t[data_size * max_kmerseq];
-	uint seq_size = 0;
-	// read the next line from the txt file
-	while ((seq_size = stream.next_sequence(seq, data)) > 0) {
-		// Sequence too small
-		if (seq_size < k)
-			continue;
-		
-		uint nb_kmers = seq_size - this->k + 1;
-		// Full sequence copy
-		if (nb_kmers <= this->max_kmerseq) {
-			sr.write_compacted_sequence(seq, seq_size, data);
-		} else {
-			// Sequence saved slice per slice
-			uint first_nucl = 0;
-			while (nb_kmers > 0) {
-				uint nb_kmer_copied = min(nb_kmers, this->max_kmerseq);
-				uint copy_size = nb_kmer_copied + (k - 1);
-				
-				uint last_nucl = first_nucl + (copy_size - 1);
-				subsequence(seq, seq_size, sub_seq, first_nucl, last_nucl);
-				first_nucl = last_nucl + 1 - (k - 1);
-
-				// Write the sequence
-				sr.write_compacted_sequence(sub_seq, copy_size, data);
-
-				// reduce the number of remaining kmers
-				nb_kmers -= nb_kmer_copied;
+	if (this->m > 0) {
+		delete this->searcher;
+		delete this->rc;
+	}
+	outfile.close();
+}
+
+
+void Instr::monofile(Kff_file & outfile, const string & filename, const uint8_t encoding[4]) {
+	// Write the sequences inside of a raw section or bucketize them
+	Section_Raw * sr = nullptr;
+	if (this->m == 0)
+		sr = new Section_Raw(&outfile);
+
+	uint8_t * sub_seq = new uint8_t[(max_kmerseq + k + 3) / 4 + 1];
+
+	if (FastxParser::is_fastx(filename)) {
+		// FASTA/FASTQ fragments (no data)
+		FastxParser parser(filename, encoding, this->k);
+		vector<uint8_t> data;
+		uint8_t * seq;
+		uint64_t seq_size = 0;
+		while ((seq_size = parser.next_fragment(seq)) > 0) {
+			// Empty data for all the kmers of the fragment
+			if (data.size() < (seq_size - k + 1) * data_size)
+				data.resize((seq_size - k + 1) * data_size, 0);
+			this->write_sequence(sr, seq, seq_size, data.data(), sub_seq);
+		}
+	} else {
+		// Text lines parsed by chunks in parallel and written in the file order
+		LineReader lines(filename);
+		Binarizer bz(encoding);
+		const size_t chunk_size = 1 << 22;
+		vector<TxtChunk> chunks(4 * this->threads);
+		bool end_of_input = false;
+		// An empty line ends the input: the following chunks are ignored
+		bool empty_line = false;
+
+		while (not end_of_input) {
+			uint64_t nb_chunks = 0;
+			while (nb_chunks < chunks.size() and lines.next_lines(chunks[nb_chunks].text, chunk_size))
+				nb_chunks += 1;
+			end_of_input = nb_chunks < chunks.size();
+
+			#pragma omp parallel for ordered schedule(dynamic) num_threads(this->threads)
+			for (uint64_t c=0 ; c<nb_chunks ; c++) {
+				TxtChunk & chunk = chunks[c];
+				parse_txt_chunk(chunk, bz, this->k, this->data_size, this->delimiter);
+
+				// Blocks written in the file order
+				#pragma omp ordered
+				{
+					if (not empty_line) {
+						for (const array<uint64_t, 3> & record : chunk.records)
+							this->write_sequence(sr, chunk.sequences.data() + record[0], record[1], chunk.data.data() + record[2], sub_seq);
+						empty_line = chunk.last;
+					}
+				}
 			}
+			end_of_input = end_of_input or empty_line;
 		}
 	}
-	sr.close();
+	if (sr != nullptr) {
+		sr->close();
+		delete sr;
+	} else
+		this->write_buckets(outfile);
 
 	delete[] sub_seq;
-	delete[] data;
-	outfile.close();
+}
+
+
+void Instr::multifile(Kff_file & outfile, const vector<string> & filenames, const uint8_t encoding[4]) {
+	Binarizer bz(encoding);
+	uint8_t * sub_seq = new uint8_t[(max_kmerseq + k + 3) / 4 + 1];
+	map<string, uint64_t> footer_values;
+
+	Section_Raw * sr = nullptr;
+	if (this->one_section and this->m == 0)
+		sr = new Section_Raw(&outfile);
+
+	// The files are parsed by windows of 2 files per thread. Each file is fully loaded in memory.
+	vector<vector<TxtChunk> > parsed(2 * this->threads);
+	for (uint64_t window=0 ; window<filenames.size() ; window+=parsed.size()) {
+		uint64_t window_end = min((uint64_t)filenames.size(), window + parsed.size());
+
+		#pragma omp parallel for ordered schedule(dynamic) num_threads(this->threads)
+		for (uint64_t f=window ; f<window_end ; f++) {
+			vector<TxtChunk> & chunks = parsed[f - window];
+			parse_file(filenames[f], chunks, bz, encoding, this->k, this->data_size, this->delimiter);
+
+			// Files written in the input order
+			#pragma omp ordered
+			{
+				if (not this->one_section and this->m == 0)
+					sr = new Section_Raw(&outfile);
+
+				uint64_t nb_sequences = 0;
+				uint64_t nb_kmers = 0;
+				for (TxtChunk & chunk : chunks) {
+					for (const array<uint64_t, 3> & record : chunk.records)
+						this->write_sequence(sr, chunk.sequences.data() + record[0], record[1], chunk.data.data() + record[2], sub_seq);
+					nb_sequences += chunk.records.size();
+					for (const array<uint64_t, 3> & record : chunk.records)
+						nb_kmers += record[1] - this->k + 1;
+				}
+
+				string prefix = "file_" + to_string(f) + "_";
+				footer_values[prefix + "sequences"] = nb_sequences;
+				footer_values[prefix + "kmers"] = nb_kmers;
+				if (this->one_section) {
+					// Shared section(s): the sections that contain sequences of the file
+					footer_values[prefix + "sections"] = sr != nullptr ? 1 : this->file_minimizers.size();
+					this->file_minimizers.clear();
+				} else {
+					if (sr != nullptr) {
+						sr->close();
+						delete sr;
+						sr = nullptr;
+						footer_values[prefix + "sections"] = 1;
+					} else {
+						footer_values[prefix + "sections"] = this->buckets.size();
+						this->write_buckets(outfile);
+					}
+				}
+				vector<TxtChunk>().swap(chunks);
+			}
+		}
+	}
+
+	if (this->one_section) {
+		if (sr != nullptr) {
+			sr->close();
+			delete sr;
+		} else
+			this->write_buckets(outfile);
+	}
+	delete[] sub_seq;
+
+	// Footer with the per file values
+	vector<uint8_t> footer = serialize_footer(footer_values, 0);
+	outfile.write(footer.data(), footer.size());
+}
+
+
+void Instr::write_sequence(Section_Raw * sr, uint8_t * seq, const uint64_t seq_size, uint8_t * data, uint8_t * sub_seq) {
+	uint64_t nb_kmers = seq_size - this->k + 1;
+	// Full sequence copy
+	if (nb_kmers <= this->max_kmerseq) {
+		if (sr != nullptr)
+			sr->write_compacted_sequence(seq, seq_size, data);
+		else
+			this->bucketize(seq, seq_size, data);
+		return;
+	}
+
+	// Sequence saved slice per slice
+	uint64_t first_nucl = 0;
+	while (nb_kmers > 0) {
+		uint64_t nb_kmer_copied = min(nb_kmers, (uint64_t)this->max_kmerseq);
+		uint64_t copy_size = nb_kmer_copied + (k - 1);
+
+		uint64_t last_nucl = first_nucl + (copy_size - 1);
+		subsequence(seq, seq_size, sub_seq, first_nucl, last_nucl);
+		first_nucl = last_nucl + 1 - (k - 1);
+
+		// Write the sequence
+		if (sr != nullptr)
+			sr->write_compacted_sequence(sub_seq, copy_size, data);
+		else
+			this->bucketize(sub_seq, copy_size, data);
+		data += nb_kmer_copied * this->data_size;
+
+		// reduce the number of remaining kmers
+		nb_kmers -= nb_kmer_copied;
+	}
+}
+
+
+void Instr::bucketize(const uint8_t * seq, const uint64_t seq_size, const uint8_t * data) {
+	for (const skmer & sk : this->searcher->get_skmers(seq, seq_size)) {
+		uint32_t skmer_size = sk.stop_position - sk.start_position + 1;
+		uint32_t nb_kmers = skmer_size - this->k + 1;
+		uint64_t skmer_bytes = (skmer_size + 3) / 4;
+
+		// Append the record at the end of the bucket
+		vector<uint8_t> & bucket = this->buckets[sk.minimizer];
+		if (this->one_section)
+			this->file_minimizers.insert(sk.minimizer);
+		uint64_t record = bucket.size();
+		bucket.resize(record + 8 + skmer_bytes + 1 + nb_kmers * this->data_size);
+		uint8_t * skmer_seq = bucket.data() + record + 8;
+		uint8_t * skmer_data = skmer_seq + skmer_bytes;
+		subsequence(seq, seq_size, skmer_seq, sk.start_position, sk.stop_position);
+		// subsequence writes 1 extra Byte, overwritten by the data
+		memcpy(skmer_data, data + sk.start_position * this->data_size, nb_kmers * this->data_size);
+		bucket.resize(record + 8 + skmer_bytes + nb_kmers * this->data_size);
+
+		uint32_t mini_pos;
+		if (sk.minimizer_position >= 0)
+			mini_pos = sk.minimizer_position - sk.start_position;
+		// Minimizer on the reverse strand
+		else {
+			this->rc->rev_comp(skmer_seq, skmer_size);
+			mini_pos = sk.stop_position + sk.minimizer_position - this->m + 2;
+			this->rc->rev_data(skmer_data, this->data_size, nb_kmers);
+		}
+
+		memcpy(bucket.data() + record, &skmer_size, 4);
+		memcpy(bucket.data() + record + 4, &mini_pos, 4);
+	}
+}
+
+
+void Instr::write_buckets(Kff_file & outfile) {
+	vector<uint64_t> minimizers;
+	for (auto & bucket : this->buckets)
+		minimizers.push_back(bucket.first);
+	sort(minimizers.begin(), minimizers.end());
+
+	vector<uint8_t> minimizer_seq((this->m + 3) / 4);
+	for (uint64_t minimizer : minimizers) {
+		vector<uint8_t> & bucket = this->buckets[minimizer];
+
+		Section_Minimizer sm(&outfile);
+		uint_to_seq(minimizer, minimizer_seq.data(), this->m);
+		sm.write_minimizer(minimizer_seq.data());
+
+		uint64_t record = 0;
+		while (record < bucket.size()) {
+			uint32_t skmer_size, mini_pos;
+			memcpy(&skmer_size, bucket.data() + record, 4);
+			memcpy(&mini_pos, bucket.data() + record + 4, 4);
+			uint8_t * skmer_seq = bucket.data() + record + 8;
+			uint64_t skmer_bytes = (skmer_size + 3) / 4;
+
+			sm.write_compacted_sequence(skmer_seq, skmer_size, mini_pos, skmer_seq + skmer_bytes);
+			record += 8 + skmer_bytes + (skmer_size - this->k + 1) * this->data_size;
+		}
+		sm.close();
+
+		// Free the memory of the written bucket
+		vector<uint8_t>().swap(bucket);
+	}
+	this->buckets.clear();
 }
 
 
@@ -1,6 +1,8 @@
 #include <string>
 #include <iostream>
 #include <vector>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "CLI11.hpp"
 #include "kfftools.hpp"
@@ -9,9 +11,13 @@
 #ifndef INSTR_H
 #define INSTR_H
 
+class MinimizerSearcher;
+class RevComp;
+
 class Instr: public KffTool {
 private:
-	std::string input_filename;
+	std::vector<std::string> input_filenames;
+	std::string list_filename;
 	std::string output_filename;
 
 	uint data_size;
@@ -20,9 +26,41 @@ private:
 
 	std::string delimiter;
   std::string data_delimiter;
+	uint threads;
+	bool one_section;
+
+	// Minimizer sections output
+	uint m;
+	bool singleside;
+	MinimizerSearcher * searcher;
+	RevComp * rc;
+	// Superkmers per minimizer. Records: nb nucleotides (4 Bytes), minimizer position (4 Bytes),
+	// binarized superkmer and data.
+	std::unordered_map<uint64_t, std::vector<uint8_t> > buckets;
+	// Minimizers of the current file when all the files share the same buckets (one_section)
+	std::unordered_set<uint64_t> file_minimizers;
+
+	/** Read a single input file. The text files are parsed by chunks of lines in parallel.
+	 **/
+	void monofile(Kff_file & outfile, const std::string & filename, const uint8_t encoding[4]);
+	/** Read multiple input files, parsed in parallel (1 file per thread) and written in the input
+	 * order. Each file is written in its own section(s), or all together if one_section is set.
+	 * The number of sequences, kmers and sections of each file are written in the footer.
+	 **/
+	void multifile(Kff_file & outfile, const std::vector<std::string> & filenames, const uint8_t encoding[4]);
 
-	void monofile();
-	void multifile();
+	/** Write a sequence in the raw section, split into multiple blocks if it contains more than
+	 * max_kmerseq kmers. In minimizer mode (sr is nullptr), the blocks are bucketized instead.
+	 * @param sub_seq Buffer of at least (max_kmerseq + k + 3) / 4 + 1 Bytes for the split blocks.
+	 **/
+	void write_sequence(Section_Raw * sr, uint8_t * seq, const uint64_t seq_size, uint8_t * data, uint8_t * sub_seq);
+	/** Split a sequence into superkmers and add them to the bucket of their minimizer.
+	 * The superkmers with a minimizer on the reverse strand are reverse complemented.
+	 **/
+	void bucketize(const uint8_t * seq, const uint64_t seq_size, const uint8_t * data);
+	/** Write one minimizer section per bucket (increasing minimizer order).
+	 **/
+	void write_buckets(Kff_file & outfile);
 
 public:
 	Instr();
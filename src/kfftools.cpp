@@ -7,12 +7,15 @@
 
 #include "bucket.hpp"
 #include "compact.hpp"
+#include "count.hpp"
 #include "datarm.hpp"
 #include "disjoin.hpp"
 #include "index.hpp"
 #include "instr.hpp"
 #include "merge.hpp"
 #include "outstr.hpp"
+#include "pipeline.hpp"
+#include "query.hpp"
 #include "shuffle.hpp"
 #include "sort.hpp"
 #include "split.hpp"
@@ -23,6 +26,29 @@
 using namespace std;
 
 
+vector<KffTool *> create_tools() {
+	vector<KffTool *> tools;
+	tools.push_back(new Bucket());
+	tools.push_back(new Compact());
+	tools.push_back(new Count());
+	tools.push_back(new DataRm());
+	tools.push_back(new Disjoin());
+	tools.push_back(new Index());
+	tools.push_back(new Instr());
+	tools.push_back(new Merge());
+	tools.push_back(new Outstr());
+	tools.push_back(new Pipeline());
+	tools.push_back(new Query());
+	tools.push_back(new Shuffle()); 
+	tools.push_back(new Sort()); 
+	tools.push_back(new Split());
+	tools.push_back(new Translate());
+	tools.push_back(new Validate());
+
+	return tools;
+}
+
+
 KffTool * parse_args(int argc, char** argv, vector<KffTool *> tools) {
 	// Main command
 	CLI::App app{"kff-tools is a software for kff file manipulations. For more details on kff format, please refer to https://github.com/Kmer-File-Format/kff-reference"};
@@ -76,20 +102,7 @@ int main(int argc, char** argv) {
 	
 
 	// --- Prepare tools ---
-	vector<KffTool *> tools;
-	tools.push_back(new Bucket());
-	tools.push_back(new Compact());
-	tools.push_back(new DataRm());
-	tools.push_back(new Disjoin());
-	tools.push_back(new Index());
-	tools.push_back(new Instr());
-	tools.push_back(new Merge());
-	tools.push_back(new Outstr());
-	tools.push_back(new Shuffle()); 
-	tools.push_back(new Sort()); 
-	tools.push_back(new Split());
-	tools.push_back(new Translate());
-	tools.push_back(new Validate());
+	vector<KffTool *> tools = create_tools();
 
 	// Get the one selected
 	KffTool * tool = parse_args(argc, argv, tools);
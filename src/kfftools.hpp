@@ -1,3 +1,5 @@
+#include <vector>
+
 #include "CLI11.hpp"
 #include "kff_io.hpp"
 
@@ -15,4 +17,15 @@ public:
 };
 
 
+/** Create one object per kff-tools subcommand.
+ **/
+std::vector<KffTool *> create_tools();
+
+/** Parse a kff-tools command line (argv[0] is the program name) and select the subcommand.
+ * Exit on a parsing error.
+ * @return The tool to execute or nullptr if only the help was requested.
+ **/
+KffTool * parse_args(int argc, char** argv, std::vector<KffTool *> tools);
+
+
 #endif
@@ -0,0 +1,69 @@
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "mapreader.hpp"
+
+
+using namespace std;
+
+
+MappedKffReader::MappedKffReader(const string & filename) {
+	this->owned_mapping = new MappedFile(filename);
+	this->bytes = this->owned_mapping->data;
+	this->size = this->owned_mapping->size;
+	this->init();
+}
+
+MappedKffReader::MappedKffReader(const MappedFile & mapping) {
+	this->owned_mapping = nullptr;
+	this->bytes = mapping.data;
+	this->size = mapping.size;
+	this->init();
+}
+
+MappedKffReader::~MappedKffReader() {
+	delete this->owned_mapping;
+}
+
+
+void MappedKffReader::init() {
+	if (this->bytes == nullptr)
+		return;
+
+	// Header + final signature
+	if (this->size < 15) {
+		this->bytes = nullptr;
+		return;
+	}
+	this->end_position = this->size - 3;
+
+	// All the file is readable without any copy
+	this->window = this->bytes;
+	this->window_position = 0;
+	this->window_size = this->size;
+
+	this->read_header();
+}
+
+
+void MappedKffReader::refill(const long position, const uint64_t nb_bytes) const {
+	// The window already contains all the file
+	throw "Read out of the file";
+}
+
+
+void MappedKffReader::jump_to_block(const long position, const uint64_t remaining_blocks) {
+	this->position = position;
+	this->remaining_blocks = remaining_blocks;
+}
+
+
+void MappedKffReader::will_need(const long position, const long size) const {
+	if (this->bytes == nullptr)
+		return;
+
+	// madvise needs a page aligned address
+	long page_size = sysconf(_SC_PAGESIZE);
+	long aligned = position - position % page_size;
+	madvise((void *)(this->bytes + aligned), size + position - aligned, MADV_WILLNEED);
+}
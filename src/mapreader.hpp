@@ -0,0 +1,53 @@
+#include <cstdint>
+#include <string>
+#include <map>
+#include <unordered_map>
+
+#include "fileio.hpp"
+#include "sectionreader.hpp"
+
+
+#ifndef MAPREADER_H
+#define MAPREADER_H
+
+
+/** Kff file reader over a memory mapping of the file. The window of the reader is the whole
+ * mapping: the sections and blocks are parsed without any read syscall and the block pointers are
+ * directly pointing inside of the mapping (valid as long as the reader exists).
+ * This reader is only able to read files fully present on disk (ie not a file still in writing
+ * mode of a Kff_file object).
+ **/
+class MappedKffReader final : public KffSectionReader {
+private:
+  MappedFile * owned_mapping;
+  const uint8_t * bytes;
+  size_t size;
+
+  void init();
+  void refill(const long position, const uint64_t nb_bytes) const override;
+
+public:
+  /** Map the file and read its header. is_open() is false if the file can't be mapped.
+   **/
+  MappedKffReader(const std::string & filename);
+  /** Reader on an already mapped file (ie shared by multiple readers in different threads).
+   **/
+  MappedKffReader(const MappedFile & mapping);
+  ~MappedKffReader();
+
+  bool is_open() const override { return this->bytes != nullptr; }
+  const uint8_t * data() const { return this->bytes; }
+
+  /** Move the cursor to a block of the current section (ie a block position found by another
+   * reader over the same file).
+   * @param position Position of the block in the file.
+   * @param remaining_blocks Number of blocks from this one to the end of the section.
+   **/
+  void jump_to_block(const long position, const uint64_t remaining_blocks);
+
+  /** Hint the kernel that a range of the file will be read soon.
+   **/
+  void will_need(const long position, const long size) const;
+};
+
+#endif
@@ -1,7 +1,19 @@
 #include <vector>
 #include <string>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+#include <tuple>
+#include <fcntl.h>
+#include <unistd.h>
+#include "omp.h"
 
 #include "merge.hpp"
+#include "fileio.hpp"
+#include "encoding.hpp"
+#include "sequences.hpp"
+#include "checksum.hpp"
 
 
 using namespace std;
@@ -9,6 +21,12 @@ using namespace std;
 
 Merge::Merge() {
 	output_filename = "";
+	union_mode = false;
+	reducer = "sum";
+	m = 10;
+	nb_partitions = 64;
+	threads = 1;
+	checksum = false;
 }
 
 void Merge::cli_prepare(CLI::App * app) {
@@ -24,37 +42,28 @@ void Merge::cli_prepare(CLI::App * app) {
 
 	CLI::Option * out_option = subapp->add_option("-o, --outfile", output_filename, "Kff file where all the input will be merged");
 	out_option->required();
-}
-
-void Merge::merge(const vector<string> inputs, string output) {
-	vector<Kff_file *> files;
-	files.reserve(inputs.size());
-	for(auto & input : inputs) {
-    files.push_back(new Kff_file(input, "r"));  
-	}
 
-	this->merge(files, output);
-
-    for (Kff_file* file : files)
-    {
-        delete file;
-    }
-	files.clear();
+	subapp->add_flag("-u, --union", union_mode, "Merge the files at the kmer level. Each kmer is present only once in the output and the data of its occurrences are combined using the reducer.");
+	CLI::Option * reducer_opt = subapp->add_option("-r, --reducer", reducer, "Data combination used in union mode: sum (saturated to the max data value), max, min or first (default sum).");
+	reducer_opt->check(CLI::IsMember({"sum", "max", "min", "first"}));
+	subapp->add_option("-m, --minimizer-size", m, "Minimizer size used to bucket the kmers in union mode (default 10, max 31).");
+	subapp->add_option("--partitions", nb_partitions, "Number of temporary partitions used in union mode. Only one partition is loaded in memory at a time (default 64).");
+	subapp->add_option("-t, --threads", threads, "Number of threads used to copy the sections (default 1). With more than 1 thread, the output layout is computed first and the sections are copied in parallel.");
+	subapp->add_flag("--checksum", checksum, "Store a CRC32C checksum of each section in the footer of the output. The checksums are verified by validate.");
 }
 
 void Merge::merge(const vector<Kff_file *> & files, string output) {
 	// Useful variables
-	const long buffer_size = 1048576; // 1 MB
-	uint8_t buffer[1048576];
+	SectionCopier copier;
 	uint8_t global_encoding[4];
 
 	// Read the encoding of the first file and push it as outcoding
 	for (uint i=0 ; i<4 ; i++)
 		global_encoding[i] = files[0]->encoding[i];
 	
-	// Write header of the output
+	// Write header of the output (the index and the footer are written at the end)
 	Kff_file outfile(output, "w");
-	outfile.set_indexation(true);
+	outfile.set_indexation(false);
 	outfile.write_encoding(
 		global_encoding[0],
 		global_encoding[1],
@@ -65,9 +74,8 @@ void Merge::merge(const vector<Kff_file *> & files, string output) {
 	std::string meta = "Merged file";
 	outfile.write_metadata(meta.length(), (uint8_t *)meta.c_str());
 
-	// remember index previous position for chaining
-	long last_index = 0;
-	// Footers
+	// Output sections to index and summed footer values
+	vector<pair<char, long> > indexed_sections;
 	map<string, uint64_t> footer_values;
 
 	// Append each file one by one
@@ -102,12 +110,11 @@ void Merge::merge(const vector<Kff_file *> & files, string output) {
 						// Is it a footer ?
 						if (sgv.vars.find("footer_size") != sgv.vars.end()) {
 							for (auto& tuple : sgv.vars)
-								if (tuple.first != "footer_size" and tuple.first != "first_index") {
-									if (footer_values.find(tuple.first) == footer_values.end())
-										footer_values[tuple.first] = tuple.second;
-									else
-										// Sum up the common footer values
-										footer_values[tuple.first] += tuple.second;
+								// The section checksums are recomputed for the merged file
+								if (tuple.first != "footer_size" and tuple.first != "first_index"
+								    and tuple.first.compare(0, checksum_prefix.size(), checksum_prefix) != 0) {
+									// Sum up the common footer values
+									footer_values[tuple.first] += tuple.second;
 								}
 							break;
 						}
@@ -133,6 +140,7 @@ void Merge::merge(const vector<Kff_file *> & files, string output) {
 					// cout << "V needed ?"
 					// Rewrite
 					if (v_section_needed) {
+						indexed_sections.emplace_back('v', outfile.tellp());
 						Section_GV sgv(&outfile);
 						for (auto & p : variables) {
 							sgv.write_var(p.first, p.second);
@@ -153,20 +161,13 @@ void Merge::merge(const vector<Kff_file *> & files, string output) {
 				infile->jump(-size);
 
 				// Register the section in the index of the output file
-				outfile.register_position(section_type);
+				indexed_sections.emplace_back(section_type, outfile.tellp());
 
 				// Read from input and write into output
-				while (size > 0) {
-					size_t size_to_copy = size > buffer_size ? buffer_size : size;
-
-					infile->read(buffer, size_to_copy);
-					outfile.write(buffer, size_to_copy);
-
-					size -= size_to_copy;
-				}
+				copier.copy(infile, &outfile, size);
 				break;
+				// Input indexes are replaced by the consolidated index
 				case 'i': {
-					// read section and compute its size
 					Section_Index si(infile);
 					si.close();
 				} break;
@@ -181,26 +182,432 @@ void Merge::merge(const vector<Kff_file *> & files, string output) {
 		}
 
 		infile->close();
+		copier.release(infile->filename);
 	}
 
-	// Write footer
-	if (last_index != 0) {
-		Section_GV sgv(&outfile);
-		long size = 9;
+	// Index of all the output sections (offsets re-based on the output layout)
+	long first_index = 0;
+	if (indexed_sections.size() > 0) {
+		first_index = outfile.tellp();
+		vector<uint8_t> index = serialize_index(indexed_sections, first_index);
+		outfile.write(index.data(), index.size());
+	}
+
+	// Footer
+	if (first_index != 0 or footer_values.size() > 0) {
+		vector<uint8_t> footer = serialize_footer(footer_values, first_index);
+		outfile.write(footer.data(), footer.size());
+	}
+
+	outfile.close();
+}
+
+void Merge::reduce(uint8_t * current, const uint8_t * incoming, const uint data_size) const {
+	if (this->reducer == "first" or data_size == 0)
+		return;
+
+	uint64_t current_val = data_to_uint(current, data_size);
+	uint64_t incoming_val = data_to_uint(incoming, data_size);
+
+	if (this->reducer == "sum") {
+		uint64_t max_val = data_max_value(data_size);
+		// Saturated sum
+		if (incoming_val > max_val - current_val)
+			current_val = max_val;
+		else
+			current_val += incoming_val;
+	}
+	else if (this->reducer == "max")
+		current_val = max(current_val, incoming_val);
+	else if (this->reducer == "min")
+		current_val = min(current_val, incoming_val);
+
+	uint_to_data(current_val, current, data_size);
+}
+
+
+void Merge::union_merge(const vector<string> & inputs, string output) {
+	// --- Verify the inputs compatibility ---
+	uint8_t encoding[4];
+	bool canonical = true;
+	for (uint file_idx=0 ; file_idx<inputs.size() ; file_idx++) {
+		Kff_file infile(inputs[file_idx], "r");
+		for (uint i=0 ; i<4 ; i++) {
+			if (file_idx == 0)
+				encoding[i] = infile.encoding[i];
+			else if (infile.encoding[i] != encoding[i]) {
+				cerr << "Wrong encoding for file " << infile.filename << endl;
+				cerr << "Its nucleotide encoding is different from previous kff files." << endl;
+				cerr << "Please first use 'kff-tools translate' to have the same encoding" << endl;
+				exit(1);
+			}
+		}
+		canonical = canonical and infile.canonicity;
+		infile.close();
+	}
+
+	if (this->m == 0 or this->m > 31) {
+		cerr << "The minimizer size must be between 1 and 31" << endl;
+		exit(1);
+	}
+	if (this->nb_partitions == 0)
+		this->nb_partitions = 1;
+
+	// --- Distribute the kmers into minimizer partitions ---
+	vector<string> partition_names;
+	vector<ofstream *> partitions;
+	for (uint p=0 ; p<this->nb_partitions ; p++) {
+		partition_names.push_back(output + ".union_" + to_string(p) + ".tmp");
+		partitions.push_back(new ofstream(partition_names.back(), ios::binary | ios::trunc));
+	}
+
+	RevComp rc(encoding);
+	MinimizerSearcher * searcher = nullptr;
+	uint64_t k = 0;
+	uint64_t data_size = 0;
+	uint64_t kmer_bytes = 0;
+	uint8_t * key = new uint8_t[1];
+	uint8_t * rc_key = new uint8_t[1];
+
+	for (const string & input : inputs) {
+		Kff_reader reader(input);
+		uint8_t * nucleotides = nullptr;
+		uint8_t * data = nullptr;
+
+		while (reader.next_kmer(nucleotides, data)) {
+			// First kmer: init the buffers
+			if (k == 0) {
+				k = reader.k;
+				data_size = reader.data_size;
+				if (k <= this->m) {
+					cerr << "The minimizer size must be smaller than k (k=" << k << ")" << endl;
+					exit(1);
+				}
+				if (data_size > 8 and this->reducer != "first") {
+					cerr << "Data larger than 8 Bytes can only be merged with the 'first' reducer" << endl;
+					exit(1);
+				}
+				kmer_bytes = (k + 3) / 4;
+				delete[] key;
+				key = new uint8_t[kmer_bytes];
+				delete[] rc_key;
+				rc_key = new uint8_t[kmer_bytes];
+				searcher = new MinimizerSearcher(k, this->m, encoding, k, true);
+			} else if (reader.k != k or reader.data_size != data_size) {
+				cerr << "All the kmers must share the same k and data_size to be merged in union mode." << endl;
+				cerr << "Found k=" << reader.k << " data_size=" << reader.data_size << " in " << input;
+				cerr << " (expected k=" << k << " data_size=" << data_size << ")" << endl;
+				exit(1);
+			}
+
+			// Clean the padding nucleotides
+			memcpy(key, nucleotides, kmer_bytes);
+			key[0] &= (1u << (2 * (((k - 1) % 4) + 1))) - 1;
+			// Canonical files: a kmer and its reverse complement are the same
+			if (canonical) {
+				memcpy(rc_key, key, kmer_bytes);
+				rc.rev_comp(rc_key, k);
+				if (memcmp(rc_key, key, kmer_bytes) < 0)
+					memcpy(key, rc_key, kmer_bytes);
+			}
 
-		for (const auto & tuple : footer_values) {
-			sgv.write_var(tuple.first, tuple.second);
-			size += tuple.first.length() + 1 + 8;
+			// Save the kmer in the partition of its minimizer
+			uint64_t minimizer = searcher->get_skmers(key, k)[0].minimizer;
+			uint64_t partition = ((minimizer * 0x9E3779B97F4A7C15) >> 32) % this->nb_partitions;
+			partitions[partition]->write((char *)key, kmer_bytes);
+			partitions[partition]->write((char *)data, data_size);
 		}
-		sgv.write_var("first_index", last_index);
-		sgv.write_var("footer_size", size + 2 * (12 + 8));
+	}
+
+	for (ofstream * os : partitions) {
+		os->close();
+		delete os;
+	}
+
+	// --- Prepare the output file ---
+	Kff_file outfile(output, "w");
+	outfile.write_encoding(encoding);
+	outfile.set_uniqueness(true);
+	outfile.set_canonicity(canonical);
+	std::string meta = "Union merged file";
+	outfile.write_metadata(meta.length(), (uint8_t *)meta.c_str());
+
+	if (k > 0) {
+		Section_GV sgv(&outfile);
+		sgv.write_var("k", k);
+		sgv.write_var("m", this->m);
+		sgv.write_var("max", 1);
+		sgv.write_var("data_size", data_size);
 		sgv.close();
+	}
+
+	// --- Deduplicate the partitions one by one ---
+	uint64_t record_size = kmer_bytes + data_size;
+	uint8_t * minimizer_seq = new uint8_t[(this->m + 3) / 4 + 1];
+	for (uint p=0 ; p<this->nb_partitions ; p++) {
+		// Load the partition
+		ifstream is(partition_names[p], ios::binary | ios::ate);
+		uint64_t file_size = is.tellg();
+		is.seekg(0);
+		vector<uint8_t> records(file_size);
+		is.read((char *)records.data(), file_size);
+		is.close();
+		remove(partition_names[p].c_str());
+
+		if (record_size == 0 or file_size == 0)
+			continue;
+
+		// Combine the kmer occurrences. The first occurrence is kept in place.
+		unordered_map<string, uint8_t *> kmer_map;
+		vector<uint8_t *> uniques;
+		for (uint64_t pos=0 ; pos<file_size ; pos+=record_size) {
+			uint8_t * record = records.data() + pos;
+			string str_key((char *)record, kmer_bytes);
+
+			auto it = kmer_map.find(str_key);
+			if (it == kmer_map.end()) {
+				kmer_map[str_key] = record;
+				uniques.push_back(record);
+			} else
+				this->reduce(it->second + kmer_bytes, record + kmer_bytes, data_size);
+		}
+		kmer_map.clear();
+
+		// Group the kmers per minimizer (minimizer, minimizer position, record)
+		vector<tuple<uint64_t, uint64_t, uint8_t *> > sorted_kmers;
+		sorted_kmers.reserve(uniques.size());
+		for (uint8_t * record : uniques) {
+			skmer sk = searcher->get_skmers(record, k)[0];
+			sorted_kmers.emplace_back(sk.minimizer, sk.minimizer_position, record);
+		}
+		std::sort(sorted_kmers.begin(), sorted_kmers.end(),
+			[kmer_bytes](const tuple<uint64_t, uint64_t, uint8_t *> & a, const tuple<uint64_t, uint64_t, uint8_t *> & b) {
+				if (get<0>(a) != get<0>(b))
+					return get<0>(a) < get<0>(b);
+				return memcmp(get<2>(a), get<2>(b), kmer_bytes) < 0;
+			});
+
+		// Write one minimizer section per minimizer
+		uint64_t idx = 0;
+		while (idx < sorted_kmers.size()) {
+			uint64_t minimizer = get<0>(sorted_kmers[idx]);
+			Section_Minimizer sm(&outfile);
+
+			bool first = true;
+			for ( ; idx<sorted_kmers.size() and get<0>(sorted_kmers[idx]) == minimizer ; idx++) {
+				uint64_t mini_pos = get<1>(sorted_kmers[idx]);
+				uint8_t * record = get<2>(sorted_kmers[idx]);
+				if (first) {
+					subsequence(record, k, minimizer_seq, mini_pos, mini_pos + this->m - 1);
+					sm.write_minimizer(minimizer_seq);
+					first = false;
+				}
+				sm.write_compacted_sequence(record, k, mini_pos, record + kmer_bytes);
+			}
 
+			sm.close();
+		}
 	}
 
+	delete searcher;
+	delete[] key;
+	delete[] rc_key;
+	delete[] minimizer_seq;
 	outfile.close();
 }
 
+
+/** A section copied from an input file to its final position in the merged file.
+ **/
+struct SectionTransfer {
+	uint file_idx;
+	long in_position;
+	long out_position;
+	long size;
+};
+
+
+void Merge::parallel_merge(const vector<string> & inputs, string output) {
+	// --- Planning: compute the output layout from the section headers ---
+	// Bytes written by the main thread (header, variables, signature) and their positions
+	vector<pair<long, vector<uint8_t> > > inline_parts;
+	// Sections copied in parallel
+	vector<SectionTransfer> transfers;
+	long out_position = 0;
+	// Output sections to index and summed footer values
+	vector<pair<char, long> > indexed_sections;
+	map<string, uint64_t> footer_values;
+
+	uint8_t global_encoding[4];
+	// Variables of the output file at the current position
+	unordered_map<string, uint64_t> out_vars;
+
+	for (uint file_idx=0 ; file_idx<inputs.size() ; file_idx++) {
+		Kff_file infile(inputs[file_idx], "r");
+
+		if (file_idx == 0) {
+			for (uint i=0 ; i<4 ; i++)
+				global_encoding[i] = infile.encoding[i];
+
+			// Header of the output
+			std::string meta = "Merged file";
+			inline_parts.emplace_back(out_position, serialize_header(
+				infile.major_version, infile.minor_version, global_encoding,
+				false, false, (uint8_t *)meta.c_str(), meta.length()
+			));
+			out_position += inline_parts.back().second.size();
+		}
+
+		// Encoding verification
+		for (uint i=0 ; i<4 ; i++) {
+			if (infile.encoding[i] != global_encoding[i]) {
+				cerr << "Wrong encoding for file " << infile.filename << endl;
+				cerr << "Its nucleotide encoding is different from previous kff files." << endl;
+				cerr << "Please first use 'kff-tools translate' to have the same encoding" << endl;
+				exit(1);
+			}
+		}
+
+		char section_type = infile.read_section_type();
+		while(infile.tellp() != infile.end_position) {
+			switch (section_type) {
+				// Same variable deduplication than the sequential merge
+				case 'v':
+				{
+					map<string, uint64_t> variables;
+
+					while (section_type == 'v') {
+						Section_GV sgv(&infile);
+
+						// Footers are not copied but their values are summed up
+						if (sgv.vars.find("footer_size") != sgv.vars.end()) {
+							for (auto & tuple : sgv.vars)
+								if (tuple.first != "footer_size" and tuple.first != "first_index"
+								    and tuple.first.compare(0, checksum_prefix.size(), checksum_prefix) != 0)
+									footer_values[tuple.first] += tuple.second;
+							break;
+						}
+
+						for (auto & p : sgv.vars)
+							variables[p.first] = p.second;
+						sgv.close();
+
+						section_type = infile.read_section_type();
+					}
+
+					bool v_section_needed = false;
+					for (auto & p : variables) {
+						if (out_vars.find(p.first) == out_vars.end() or out_vars[p.first] != p.second) {
+							v_section_needed = true;
+							break;
+						}
+					}
+
+					if (v_section_needed) {
+						for (auto & p : variables)
+							out_vars[p.first] = p.second;
+						indexed_sections.emplace_back('v', out_position);
+						inline_parts.emplace_back(out_position, serialize_gv(variables));
+						out_position += inline_parts.back().second.size();
+					}
+				}
+				break;
+
+				// Only the position of the sequence sections is needed
+				case 'r':
+				case 'm':
+				{
+					long begin_byte = infile.tellp();
+					if (not infile.jump_next_section()) {
+						cerr << "Error inside of the input file " << infile.filename << endl;
+						cerr << "Impossible to jump over the section " << section_type << endl;
+						exit(1);
+					}
+					long size = infile.tellp() - begin_byte;
+
+					transfers.push_back({file_idx, begin_byte, out_position, size});
+					indexed_sections.emplace_back(section_type, out_position);
+					out_position += size;
+				}
+				break;
+
+				// Input indexes are replaced by the consolidated index
+				case 'i': {
+					Section_Index si(&infile);
+					si.close();
+				} break;
+
+				default:
+					cerr << "Unknown section type " << section_type << " in file " << infile.filename << endl;
+					exit(2);
+			}
+
+			section_type = infile.read_section_type();
+		}
+
+		infile.close();
+	}
+
+	// Index of all the output sections (offsets re-based on the output layout)
+	long first_index = 0;
+	if (indexed_sections.size() > 0) {
+		first_index = out_position;
+		inline_parts.emplace_back(out_position, serialize_index(indexed_sections, first_index));
+		out_position += inline_parts.back().second.size();
+	}
+
+	// Footer
+	if (first_index != 0 or footer_values.size() > 0) {
+		inline_parts.emplace_back(out_position, serialize_footer(footer_values, first_index));
+		out_position += inline_parts.back().second.size();
+	}
+
+	// End of file signature
+	inline_parts.emplace_back(out_position, vector<uint8_t>{'K', 'F', 'F'});
+	out_position += 3;
+
+	// --- Copy: write everything at its precomputed position ---
+	int out_fd = ::open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out_fd < 0) {
+		cerr << "Impossible to open " << output << " for writing" << endl;
+		exit(1);
+	}
+	if (ftruncate(out_fd, out_position) != 0) {
+		cerr << "Impossible to allocate " << out_position << " bytes for " << output << endl;
+		exit(1);
+	}
+
+	for (auto & part : inline_parts)
+		write_range(out_fd, part.second.data(), part.second.size(), part.first);
+
+	#pragma omp parallel num_threads(this->threads)
+	{
+		// Each thread uses its own input descriptors
+		vector<int> in_fds(inputs.size(), -1);
+
+		#pragma omp for schedule(dynamic)
+		for (size_t t_idx=0 ; t_idx<transfers.size() ; t_idx++) {
+			const SectionTransfer & st = transfers[t_idx];
+			if (in_fds[st.file_idx] < 0) {
+				in_fds[st.file_idx] = ::open(inputs[st.file_idx].c_str(), O_RDONLY);
+				if (in_fds[st.file_idx] < 0) {
+					cerr << "Impossible to open " << inputs[st.file_idx] << endl;
+					exit(1);
+				}
+			}
+
+			copy_range(in_fds[st.file_idx], st.in_position, out_fd, st.out_position, st.size);
+		}
+
+		for (int fd : in_fds)
+			if (fd >= 0)
+				::close(fd);
+	}
+
+	::close(out_fd);
+}
+
+
 void Merge::exec() {
 	if (this->input_filenames.size() == 0) {
 		if (this->input_filelist.length() == 0) {
@@ -215,5 +622,11 @@ void Merge::exec() {
 		}
 	}
 
-	this->merge(input_filenames, output_filename);
+	if (this->union_mode)
+		this->union_merge(input_filenames, output_filename);
+	else
+		this->parallel_merge(input_filenames, output_filename);
+
+	if (this->checksum)
+		add_section_checksums(output_filename, this->threads);
 }
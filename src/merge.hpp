@@ -15,11 +15,52 @@ private:
 	std::string input_filelist;
 	std::string output_filename;
 
+	// kmer level union
+	bool union_mode;
+	std::string reducer;
+	uint m;
+	uint nb_partitions;
+
+	uint threads;
+	bool checksum;
+
+	/** Combine the data of a kmer already present (current) with the data of a new occurrence.
+	 **/
+	void reduce(uint8_t * current, const uint8_t * incoming, const uint data_size) const;
+
 public:
 	Merge();
 	void cli_prepare(CLI::App * subapp);
-	void merge(const std::vector<std::string> inputs, std::string output);
+	/** Merge opened files (ie files only present in memory) section after section.
+	 * Same output layout than parallel_merge: the output ends with an index of all its sections
+	 * and a footer where the input footer values are summed up. The input indexes are discarded.
+	 *
+	 * @param inputs Kff files opened in read mode. The input order is preserved.
+	 * @param output Name of the merged file.
+	 **/
 	void merge(const std::vector<Kff_file *> & inputs, std::string output);
+	/** Merge the input files at the kmer level. Each kmer present in multiple files is written
+	 * only once and the data of its occurrences are combined with the reducer (sum, max, min or
+	 * first). The kmers are first distributed into temporary partitions regarding their
+	 * minimizer, then each partition is deduplicated in memory and written as minimizer sections.
+	 * If all the input files are canonical, a kmer and its reverse complement are considered as
+	 * the same kmer.
+	 *
+	 * @param inputs Kff files to merge. They must share the same encoding, k and data_size.
+	 * @param output Name of the merged file (uniqueness=1).
+	 **/
+	void union_merge(const std::vector<std::string> & inputs, std::string output);
+	/** Merge the files, copying the sections in parallel.
+	 * A first pass reads only the section headers of the inputs to compute the position of each
+	 * section in the output. Then the sections are copied concurrently at their final position
+	 * (positional writes) by multiple threads.
+	 * The output ends with an index of all its sections and a footer where the input footer values
+	 * are summed up. The input indexes are discarded.
+	 *
+	 * @param inputs Kff files to merge. The input order is preserved.
+	 * @param output Name of the merged file.
+	 **/
+	void parallel_merge(const std::vector<std::string> & inputs, std::string output);
 	void exec();
 };
 
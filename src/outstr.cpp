@@ -1,9 +1,15 @@
 #include <vector>
 #include <string>
 #include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <unordered_map>
+#include "omp.h"
 
 #include "outstr.hpp"
 #include "encoding.hpp"
+#include "sequences.hpp"
+#include "mapreader.hpp"
 
 
 using namespace std;
@@ -11,6 +17,11 @@ using namespace std;
 
 Outstr::Outstr() {
 	input_filename = "";
+	output_filename = "";
+	format = "txt";
+	revcomp = false;
+	threads = 1;
+	unordered = false;
 }
 
 void Outstr::cli_prepare(CLI::App * app) {
@@ -19,6 +30,11 @@ void Outstr::cli_prepare(CLI::App * app) {
 	input_option->required();
 	input_option->check(CLI::ExistingFile);
 	subapp->add_flag("-c, --reverse-complement", revcomp, "Print the minimal value between a kmer and its reverse complement");
+	subapp->add_option("-o, --outfile", output_filename, "Output file (default stdout). Required for the bin format.");
+	CLI::Option * format_option = subapp->add_option("-f, --format", format, "Output format (default txt). txt: kmer and data separated by a space. tsv: kmer and data separated by a tab with a header line. fasta: one record per block with the complete superkmer (kmers not disjoined). bin: memory mappable columns of little endian kmers (uint64 for k <= 32, uint128 for k <= 64) and data.");
+	format_option->check(CLI::IsMember({"txt", "tsv", "fasta", "bin"}));
+	subapp->add_option("-t, --threads", threads, "Number of threads formatting the kmers. The file is split into chunks of blocks formatted in parallel and printed in the file order (default 1).");
+	subapp->add_flag("-u, --unordered", unordered, "With multiple threads, print each chunk as soon as it is formatted instead of in the file order.");
 }
 
 
@@ -26,7 +42,7 @@ string format_data(uint8_t * data, size_t data_size) {
 	if (data_size == 0)
 		return "";
 	else if (data_size < 8) {
-		uint val = data[0];
+		uint64_t val = data[0];
 		for (uint i=1 ; i<data_size ; i++) {
 			val <<= 8;
 			val += data[i];
@@ -42,12 +58,31 @@ string format_data(uint8_t * data, size_t data_size) {
 }
 
 
+void write_data(OutputBuffer & out, const uint8_t * data, size_t data_size) {
+	if (data_size == 0)
+		return;
+	else if (data_size < 8) {
+		uint64_t val = data[0];
+		for (uint i=1 ; i<data_size ; i++) {
+			val <<= 8;
+			val += data[i];
+		}
+		out.write_uint(val);
+	} else {
+		for (uint i=0 ; i<data_size ; i++) {
+			out.put('[');
+			out.write_uint(data[i]);
+			out.put(']');
+		}
+	}
+}
+
 
 bool inf_eq(uint8_t * seq1, uint8_t * seq2, uint64_t size) {
 	uint64_t nb_bytes = (size + 3) / 4;
 
-	// Test first byte
-	uint16_t mask = (1 << ((size % 4) * 2)) - 1;
+	// Test first byte (without the padding bits)
+	uint8_t mask = size % 4 == 0 ? 0xFF : (1 << ((size % 4) * 2)) - 1;
 	uint8_t byte_seq1 = seq1[0] & mask;
 	uint8_t byte_seq2 = seq2[0] & mask;
 	if (byte_seq1 != byte_seq2)
@@ -63,43 +98,496 @@ bool inf_eq(uint8_t * seq1, uint8_t * seq2, uint64_t size) {
 }
 
 
-void Outstr::exec() {
-	// Read the encoding and prepare the translator
-	Kff_reader reader = Kff_reader(input_filename);
-	Stringifyer strif(reader.get_encoding());
-	
-	// Prepare revcomp
-	RevComp rc(reader.get_encoding());
-	uint8_t * rc_copy = new uint8_t[1];
-	uint64_t k = 0;
+enum OutputFormat {TXT, TSV, FASTA, BIN};
+
+static OutputFormat format_from_name(const string & name) {
+	if (name == "tsv")
+		return TSV;
+	else if (name == "fasta")
+		return FASTA;
+	else if (name == "bin")
+		return BIN;
+	return TXT;
+}
+
+
+/** Formats the kmers of the blocks read from a mapped file. The buffers are resized when k or max
+ * change. Each thread must use its own printer.
+ **/
+class BlockPrinter {
+private:
+	Stringifyer strif;
+	RevComp rc;
+	bool revcomp;
+	OutputFormat format;
+
+	uint64_t k;
+	uint64_t max;
+	uint8_t * seq_buffer;
+	uint8_t * kmer;
+	uint8_t * rc_copy;
+	char * nucleotides;
+
+	/** Binary format: kmers as little endian integers (rolling 128 bits values over the sequence)
+	 * and data converted to little endian.
+	 **/
+	void print_binary(const uint8_t * seq, const uint64_t seq_size, const uint64_t nb_kmers,
+	                  const uint8_t * data, const uint64_t data_size, OutputBuffer & out, OutputBuffer & data_out) {
+		uint kmer_bytes = k <= 32 ? 8 : 16;
+		uint64_t mask_low = k >= 32 ? ~(uint64_t)0 : ((uint64_t)1 << (2 * k)) - 1;
+		uint64_t mask_high = k <= 32 ? 0 : (k >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << (2 * k - 64)) - 1);
+		uint rc_shift = 2 * (k - 1);
+
+		uint64_t low = 0, high = 0, rc_low = 0, rc_high = 0;
+		uint64_t offset = (4 - seq_size % 4) % 4;
+		for (uint64_t idx=0 ; idx<seq_size ; idx++) {
+			uint64_t pos = offset + idx;
+			uint64_t nucl = (seq[pos / 4] >> (2 * (3 - pos % 4))) & 0b11;
+
+			high = ((high << 2) | (low >> 62)) & mask_high;
+			low = ((low << 2) | nucl) & mask_low;
+			if (revcomp) {
+				uint64_t comp = rc.reverse[nucl];
+				rc_low = (rc_low >> 2) | (rc_high << 62);
+				rc_high >>= 2;
+				if (rc_shift >= 64)
+					rc_high |= comp << (rc_shift - 64);
+				else
+					rc_low |= comp << rc_shift;
+			}
+			if (idx + 1 < k)
+				continue;
+
+			// Canonical value: the smallest one
+			uint64_t value_low = low, value_high = high;
+			if (revcomp and (rc_high < high or (rc_high == high and rc_low < low))) {
+				value_low = rc_low;
+				value_high = rc_high;
+			}
+
+			char * bytes = out.reserve(kmer_bytes);
+			for (uint b=0 ; b<8 ; b++)
+				bytes[b] = (char)(value_low >> (8 * b));
+			for (uint b=8 ; b<kmer_bytes ; b++)
+				bytes[b] = (char)(value_high >> (8 * (b - 8)));
+			out.commit(kmer_bytes);
+		}
+
+		// Data values are big endian in kff
+		if (data_size > 0) {
+			char * bytes = data_out.reserve(nb_kmers * data_size);
+			for (uint64_t kmer_idx=0 ; kmer_idx<nb_kmers ; kmer_idx++)
+				for (uint64_t b=0 ; b<data_size ; b++)
+					bytes[kmer_idx * data_size + b] = data[kmer_idx * data_size + data_size - 1 - b];
+			data_out.commit(nb_kmers * data_size);
+		}
+	}
+
+public:
+	BlockPrinter(uint8_t encoding[4], bool revcomp, OutputFormat format) : strif(encoding), rc(encoding) {
+		this->revcomp = revcomp;
+		this->format = format;
+		this->k = 0;
+		this->max = 0;
+		this->seq_buffer = new uint8_t[1];
+		this->kmer = new uint8_t[1];
+		this->rc_copy = new uint8_t[1];
+		this->nucleotides = new char[1];
+	}
+
+	~BlockPrinter() {
+		delete[] this->seq_buffer;
+		delete[] this->kmer;
+		delete[] this->rc_copy;
+		delete[] this->nucleotides;
+	}
+
+	/** Print the kmers of a block of the current reader section.
+	 * @param out Output of the formatted kmers
+	 * @param data_out Output of the data column (binary format only)
+	 **/
+	void print(const KffSectionReader & reader, const KffBlock & block, OutputBuffer & out, OutputBuffer & data_out) {
+		if (reader.k != k or reader.max > max) {
+			k = reader.k;
+			max = reader.max > max ? reader.max : max;
+			delete[] seq_buffer;
+			seq_buffer = new uint8_t[(k + max - 1) / 4 + 1];
+			delete[] kmer;
+			kmer = new uint8_t[(k + 3) / 4 + 1];
+			delete[] rc_copy;
+			rc_copy = new uint8_t[(k + 3) / 4];
+			delete[] nucleotides;
+			nucleotides = new char[k + max - 1];
+		}
 
-	// Prepare sequence and data buffers
-	uint8_t * nucleotides = nullptr;
-	uint8_t * data = nullptr;
+		const uint8_t * seq = block.seq;
+		uint64_t seq_size = block.seq_size;
+		if (reader.section_type == 'm') {
+			reader.sequence_with_minimizer(block, seq_buffer);
+			seq = seq_buffer;
+			seq_size += reader.m;
+		}
 
-	while (reader.next_kmer(nucleotides, data)) {
+		if (format == BIN) {
+			this->print_binary(seq, seq_size, block.nb_kmers, block.data, reader.data_size, out, data_out);
+			return;
+		}
 
+		if (format == FASTA) {
+			// Header: number of kmers and their data
+			out.write(">kmers=", 7);
+			out.write_uint(block.nb_kmers);
+			if (reader.data_size > 0) {
+				out.write(" data=", 6);
+				for (uint64_t kmer_idx=0 ; kmer_idx<block.nb_kmers ; kmer_idx++) {
+					if (kmer_idx > 0)
+						out.put(',');
+					write_data(out, block.data + kmer_idx * reader.data_size, reader.data_size);
+				}
+			}
+			out.put('\n');
+			strif.translate(seq, seq_size, out.reserve(seq_size));
+			out.commit(seq_size);
+			out.put('\n');
+			return;
+		}
+
+		// Text formats: one line per kmer
+		char separator = format == TSV ? '\t' : ' ';
 		if (not revcomp) {
-			cout << strif.translate(nucleotides, reader.k) << " ";
-			cout << format_data(data, reader.data_size) << '\n';
+			// One translation for all the kmers of the block
+			strif.translate(seq, seq_size, nucleotides);
+			for (uint64_t kmer_idx=0 ; kmer_idx<block.nb_kmers ; kmer_idx++) {
+				out.write(nucleotides + kmer_idx, k);
+				out.put(separator);
+				write_data(out, block.data + kmer_idx * reader.data_size, reader.data_size);
+				out.put('\n');
+			}
+		} else {
+			for (uint64_t kmer_idx=0 ; kmer_idx<block.nb_kmers ; kmer_idx++) {
+				subsequence(seq, seq_size, kmer, kmer_idx, kmer_idx + k - 1);
+				// Clean the padding bits
+				kmer[0] &= k % 4 == 0 ? 0xFF : (1 << (2 * (k % 4))) - 1;
+				memcpy(rc_copy, kmer, (k+3)/4);
+				rc.rev_comp(rc_copy, k);
+
+				strif.translate(inf_eq(kmer, rc_copy, k) ? kmer : rc_copy, k, out.reserve(k));
+				out.commit(k);
+				out.put(separator);
+				write_data(out, block.data + kmer_idx * reader.data_size, reader.data_size);
+				out.put('\n');
+			}
+		}
+	}
+};
+
+
+static int open_output(const string & filename) {
+	int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		cerr << "Impossible to open " << filename << " in write mode." << endl;
+		exit(1);
+	}
+	return fd;
+}
+
+
+BinaryExportHeader Outstr::binary_header(const MappedFile & mapping) {
+	BinaryExportHeader header;
+	memcpy(header.magic, "KFFKMERS", 8);
+	header.version = 1;
+	header.k = 0;
+	header.data_size = 0;
+	header.nb_kmers = 0;
+	header.canonical = this->revcomp ? 1 : 0;
+
+	MappedKffReader counter(mapping);
+	header.encoding = (counter.encoding[0] << 6) | (counter.encoding[1] << 4) | (counter.encoding[2] << 2) | counter.encoding[3];
+	bool first_section = true;
+	char section_type = counter.read_section_type();
+	while (section_type != 0) {
+		if (section_type == 'v')
+			counter.read_gv();
+		else if (section_type == 'i') {
+			int64_t next_index;
+			counter.read_index(next_index);
 		} else {
-			// Change the size of rev comp datastruct if k changes
-			if (reader.k != k) {
-				k = reader.k;
-				delete[] rc_copy;
-				rc_copy = new uint8_t[(k+3) / 4];
+			counter.open_block_section();
+			if (first_section) {
+				header.k = counter.k;
+				header.data_size = counter.data_size;
+				first_section = false;
+			} else if (counter.k != header.k or counter.data_size != header.data_size) {
+				cerr << "The bin format needs the same k and data_size for all the sections." << endl;
+				exit(1);
 			}
 
-			// Get the reverse complement
-			memcpy(rc_copy, nucleotides, (k+3)/4);
-			rc.rev_comp(rc_copy, k);
+			KffBlock block;
+			while (counter.next_block(block))
+				header.nb_kmers += block.nb_kmers;
+		}
+		section_type = counter.read_section_type();
+	}
 
-			if (inf_eq(nucleotides, rc_copy, k)) {
-				cout << strif.translate(nucleotides, k) << " ";
-				cout << format_data(data, reader.data_size) << '\n';
+	if (header.k > 64) {
+		cerr << "The bin format is limited to k <= 64." << endl;
+		exit(1);
+	}
+	header.kmer_bytes = header.k <= 32 ? 8 : 16;
+	return header;
+}
+
+
+void Outstr::exec() {
+	if (format == "bin" and output_filename == "") {
+		cerr << "An output file (-o) is needed for the bin format." << endl;
+		exit(1);
+	}
+	if (format == "fasta" and revcomp) {
+		cerr << "The fasta format prints superkmers and can't be used with -c." << endl;
+		exit(1);
+	}
+
+	int fd = output_filename == "" ? STDOUT_FILENO : open_output(output_filename);
+	int data_fd = -1;
+	{
+		// All the lines are formatted in a large buffer written with few syscalls
+		OutputBuffer out(fd);
+		MappedFile mapping(input_filename);
+
+		if (format == "tsv")
+			out.write("kmer\tdata\n", 10);
+
+		// Binary format: header, then 2 columns written in parallel through 2 file descriptors
+		if (format == "bin") {
+			if (not mapping.is_open()) {
+				cerr << "The bin format needs an input file that can be mapped in memory." << endl;
+				exit(1);
+			}
+			BinaryExportHeader header;
+			try {
+				header = this->binary_header(mapping);
+			} catch (const char * msg) {
+				cerr << msg << endl;
+				exit(1);
+			}
+
+			vector<uint8_t> header_bytes(header.magic, header.magic + 8);
+			uint64_t values[] = {header.version, header.k, header.kmer_bytes, header.data_size, header.nb_kmers, header.encoding, header.canonical};
+			for (uint64_t value : values)
+				for (uint b=0 ; b<8 ; b++)
+					header_bytes.push_back((uint8_t)(value >> (8 * b)));
+			out.write((char *)header_bytes.data(), header_bytes.size());
+
+			data_fd = ::open(output_filename.c_str(), O_WRONLY);
+			if (data_fd < 0 or lseek(data_fd, header_bytes.size() + header.nb_kmers * header.kmer_bytes, SEEK_SET) < 0) {
+				cerr << "Impossible to open " << output_filename << " in write mode." << endl;
+				exit(1);
+			}
+		}
+		OutputBuffer data_out(data_fd, data_fd < 0 ? 1 : 1 << 22);
+
+		// Files that can't be mapped are read through the kff API
+		if (not mapping.is_open() and this->threads > 1) {
+			cerr << "Warning: " << input_filename << " can't be mapped in memory. The kmers are printed with only one thread." << endl;
+			this->threads = 1;
+		}
+
+		try {
+			KffSectionReader * reader;
+			if (mapping.is_open())
+				reader = new MappedKffReader(mapping);
+			else
+				reader = new StreamKffReader(input_filename);
+
+			if (not reader->is_open()) {
+				cerr << input_filename << " is too small to be a kff file" << endl;
+				exit(1);
+			}
+			if (this->threads > 1)
+				this->parallel_exec(mapping, *reader, out, data_out);
+			else
+				this->sequential_exec(*reader, out, data_out);
+			delete reader;
+		} catch (const char * msg) {
+			out.flush();
+			cerr << msg << endl;
+			exit(1);
+		}
+	}
+
+	if (fd != STDOUT_FILENO)
+		::close(fd);
+	if (data_fd >= 0)
+		::close(data_fd);
+}
+
+
+void Outstr::sequential_exec(KffSectionReader & reader, OutputBuffer & out, OutputBuffer & data_out) {
+	BlockPrinter printer(reader.encoding, revcomp, format_from_name(format));
+
+	char section_type = reader.read_section_type();
+	while (section_type != 0) {
+		if (section_type == 'v')
+			reader.read_gv();
+		else if (section_type == 'i') {
+			int64_t next_index;
+			reader.read_index(next_index);
+		} else if (section_type == 'r' or section_type == 'm') {
+			reader.open_block_section();
+
+			KffBlock block;
+			while (reader.next_block(block))
+				printer.print(reader, block, out, data_out);
+		} else {
+			cerr << "Unknown section type " << section_type << " in the file " << input_filename << endl;
+			exit(1);
+		}
+
+		section_type = reader.read_section_type();
+	}
+}
+
+
+/** Part of the file printed by one thread. A chunk starts at a section beginning or at a block
+ * in the middle of a section and ends at a section or block boundary.
+ **/
+struct OutstrChunk {
+	// Beginning of the first section (or of the section containing the first block)
+	long section;
+	// Position of the first block. Equal to section if the chunk starts at a section beginning.
+	long first_block;
+	// Number of blocks from the first one to the end of its section
+	uint64_t remaining_blocks;
+	// Variables defined before the chunk
+	uint vars_idx;
+	long end;
+};
+
+
+void Outstr::parallel_exec(const MappedFile & mapping, KffSectionReader & reader, OutputBuffer & out, OutputBuffer & data_out) {
+	// Chunks are planned by windows to bound the memory used by the planning
+	const uint64_t chunk_kmers = 1 << 18;
+	const uint64_t window_size = 64 * this->threads;
+
+	MappedKffReader planner(mapping);
+	planner.global_vars = reader.global_vars;
+	planner.jump_to(reader.position);
+	bool end_of_file = false;
+
+	while (not end_of_file) {
+		// --- Split the next part of the file into chunks of similar number of kmers ---
+		vector<unordered_map<string, uint64_t> > var_states;
+		var_states.push_back(planner.global_vars);
+		vector<OutstrChunk> chunks;
+
+		// Open a chunk at the planner position (that can be in the middle of a section)
+		auto open_chunk = [&]() {
+			if (planner.blocks_left() > 0)
+				return OutstrChunk{planner.section_beginning, planner.position, planner.blocks_left(), (uint)var_states.size() - 1, 0};
+			return OutstrChunk{planner.position, planner.position, 0, (uint)var_states.size() - 1, 0};
+		};
+		OutstrChunk current = open_chunk();
+		uint64_t nb_kmers = 0;
+
+		while (chunks.size() < window_size) {
+			if (planner.blocks_left() > 0) {
+				KffBlock block;
+				planner.next_block(block);
+				nb_kmers += block.nb_kmers;
+				if (nb_kmers >= chunk_kmers) {
+					current.end = planner.position;
+					chunks.push_back(current);
+					current = open_chunk();
+					nb_kmers = 0;
+				}
+				continue;
+			}
+
+			char section_type = planner.read_section_type();
+			if (section_type == 0) {
+				end_of_file = true;
+				break;
+			} else if (section_type == 'v') {
+				planner.read_gv();
+				var_states.push_back(planner.global_vars);
+			} else if (section_type == 'i') {
+				int64_t next_index;
+				planner.read_index(next_index);
+			} else if (section_type == 'r' or section_type == 'm')
+				planner.open_block_section();
+			else {
+				cerr << "Unknown section type " << section_type << " in the file " << input_filename << endl;
+				exit(1);
+			}
+		}
+		if (planner.position > current.first_block) {
+			current.end = planner.position;
+			chunks.push_back(current);
+		}
+
+		// --- Format the chunks in parallel ---
+		auto print_chunk = [&](const OutstrChunk & chunk, BlockPrinter & printer, OutputBuffer & chunk_out, OutputBuffer & chunk_data) {
+			MappedKffReader chunk_reader(mapping);
+			chunk_reader.global_vars = var_states[chunk.vars_idx];
+			chunk_reader.jump_to(chunk.section);
+			if (chunk.first_block != chunk.section) {
+				chunk_reader.open_block_section();
+				chunk_reader.jump_to_block(chunk.first_block, chunk.remaining_blocks);
+			}
+
+			KffBlock block;
+			while (chunk_reader.position < chunk.end) {
+				if (chunk_reader.next_block(block)) {
+					printer.print(chunk_reader, block, chunk_out, chunk_data);
+					continue;
+				}
+
+				char section_type = chunk_reader.read_section_type();
+				if (section_type == 'v')
+					chunk_reader.read_gv();
+				else if (section_type == 'i') {
+					int64_t next_index;
+					chunk_reader.read_index(next_index);
+				} else
+					chunk_reader.open_block_section();
+			}
+		};
+
+		#pragma omp parallel num_threads(this->threads)
+		{
+			BlockPrinter printer(reader.encoding, revcomp, format_from_name(format));
+			OutputBuffer chunk_out(-1);
+			OutputBuffer chunk_data(-1, 1);
+
+			if (not this->unordered) {
+				#pragma omp for ordered schedule(dynamic)
+				for (uint64_t c=0 ; c<chunks.size() ; c++) {
+					chunk_out.clear();
+					chunk_data.clear();
+					print_chunk(chunks[c], printer, chunk_out, chunk_data);
+
+					// Outputs written in the file order
+					#pragma omp ordered
+					{
+						out.write(chunk_out.data(), chunk_out.size());
+						data_out.write(chunk_data.data(), chunk_data.size());
+					}
+				}
 			} else {
-				cout << strif.translate(rc_copy, k) << " ";
-				cout << format_data(data, reader.data_size) << '\n';
+				#pragma omp for schedule(dynamic)
+				for (uint64_t c=0 ; c<chunks.size() ; c++) {
+					chunk_out.clear();
+					chunk_data.clear();
+					print_chunk(chunks[c], printer, chunk_out, chunk_data);
+
+					// Outputs written as soon as they are ready
+					#pragma omp critical
+					{
+						out.write(chunk_out.data(), chunk_out.size());
+						data_out.write(chunk_data.data(), chunk_data.size());
+					}
+				}
 			}
 		}
 	}
@@ -4,15 +4,59 @@
 
 #include "CLI11.hpp"
 #include "kfftools.hpp"
+#include "mapreader.hpp"
+#include "fileio.hpp"
 
 
 #ifndef OUTSTR_H
 #define OUTSTR_H
 
+/** Format the data of a kmer the way outstr prints it: an integer for less than 8 Bytes, a list of
+ * Byte values otherwise.
+ **/
+std::string format_data(uint8_t * data, size_t data_size);
+/** Same as format_data, written directly in an output buffer.
+ **/
+void write_data(OutputBuffer & out, const uint8_t * data, size_t data_size);
+
+/** Header of the binary export format (64 Bytes, all the values are little endian uint64).
+ * It is followed by the kmer column (nb_kmers values of kmer_bytes Bytes) and the data column
+ * (nb_kmers values of data_size Bytes).
+ **/
+struct BinaryExportHeader {
+	char magic[8];
+	uint64_t version;
+	uint64_t k;
+	uint64_t kmer_bytes;
+	uint64_t data_size;
+	uint64_t nb_kmers;
+	// Encoding of the kmers (same byte as in the kff header)
+	uint64_t encoding;
+	// 1 if the kmers are canonical (-c)
+	uint64_t canonical;
+};
+
 class Outstr: public KffTool {
 private:
 	std::string input_filename;
+	std::string output_filename;
+	std::string format;
 	bool revcomp;
+	uint threads;
+	bool unordered;
+
+	/** Print the kmers of the file section after section (mapped or read through the kff API).
+	 **/
+	void sequential_exec(KffSectionReader & reader, OutputBuffer & out, OutputBuffer & data_out);
+	/** Print the kmers of a mapped file with multiple threads. The file is split into chunks of
+	 * blocks. Each thread formats a chunk in its own buffer and the buffers are written in the file
+	 * order (or as soon as they are ready in unordered mode).
+	 **/
+	void parallel_exec(const MappedFile & mapping, KffSectionReader & reader, OutputBuffer & out, OutputBuffer & data_out);
+	/** Count the kmers of the file to prepare the header of the binary format. Exit if the file
+	 * can't be exported with fixed width columns (multiple k, k > 64 or multiple data sizes).
+	 **/
+	BinaryExportHeader binary_header(const MappedFile & mapping);
 
 public:
 	Outstr();
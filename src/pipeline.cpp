@@ -0,0 +1,151 @@
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "pipeline.hpp"
+
+
+using namespace std;
+
+
+// Private directory of the intermediate files. Removed at exit, even when a stage exits on error.
+static string pipeline_workdir = "";
+
+static void remove_workdir() {
+	if (pipeline_workdir == "")
+		return;
+
+	// Remove the remaining files (ie temporary partitions of an interrupted stage)
+	DIR * dir = opendir(pipeline_workdir.c_str());
+	if (dir != nullptr) {
+		struct dirent * entry;
+		while ((entry = readdir(dir)) != nullptr) {
+			string name = entry->d_name;
+			if (name != "." and name != "..")
+				remove((pipeline_workdir + "/" + name).c_str());
+		}
+		closedir(dir);
+	}
+	rmdir(pipeline_workdir.c_str());
+
+	pipeline_workdir = "";
+}
+
+
+Pipeline::Pipeline() {
+	input_filename = "";
+	output_filename = "";
+	tmp_dir = "";
+}
+
+void Pipeline::cli_prepare(CLI::App * app) {
+	this->subapp = app->add_subcommand("pipeline", "Chain kff-tools commands in one process. Each stage is a quoted command line without its -i and -o options: the input of a stage is the output of the previous one. The stages are executed one after the other and each intermediate kff file is fully written before the next stage starts.");
+	CLI::Option * stages_option = subapp->add_option("stages", stages, "Stage command lines (ie \"instr -k 21 -m 1\" \"bucket -m 9\" compact sort).");
+	stages_option->required();
+	CLI::Option * input_option = subapp->add_option("-i, --infile", input_filename, "Input of the first stage (given to its -i option). Optional if the first stage has its own input.");
+	input_option->check(CLI::ExistingFile);
+	subapp->add_option("-o, --outfile", output_filename, "Output of the last stage (given to its -o option). Optional if the last stage does not write a file (ie validate or outstr on stdout).");
+	subapp->add_option("--tmp-dir", tmp_dir, "Directory for the intermediate files. An intermediate file can be as large as the final output (default: directory of the output file, or ./ without output).");
+}
+
+
+void Pipeline::run_stage(const vector<string> & args) {
+	vector<string> argv_strings;
+	argv_strings.push_back("kff-tools");
+	argv_strings.insert(argv_strings.end(), args.begin(), args.end());
+	vector<char *> argv;
+	for (string & arg : argv_strings)
+		argv.push_back(&arg[0]);
+
+	// Fresh tool objects so no option value is shared between stages
+	vector<KffTool *> tools = create_tools();
+	KffTool * tool = parse_args(argv.size(), argv.data(), tools);
+	// A stage that only prints its help would silently skip the next stages
+	if (tool == nullptr) {
+		cerr << "The stage \"" << args[0] << "\" did not select a command to execute (help only)" << endl;
+		exit(1);
+	}
+	tool->exec();
+
+	for (KffTool * tool : tools)
+		delete tool;
+}
+
+
+void Pipeline::exec() {
+	// Split the stage command lines into arguments
+	vector<vector<string> > stage_args;
+	for (const string & stage : this->stages) {
+		istringstream stream(stage);
+		vector<string> args;
+		string arg;
+		while (stream >> arg)
+			args.push_back(arg);
+
+		if (args.size() == 0) {
+			cerr << "Empty pipeline stage" << endl;
+			exit(1);
+		}
+		if (args[0] == "pipeline") {
+			cerr << "A pipeline can't be a stage of another pipeline" << endl;
+			exit(1);
+		}
+		stage_args.push_back(args);
+	}
+
+	// Private directory for the intermediate files, next to the output by default
+	if (this->tmp_dir == "") {
+		size_t last_slash = this->output_filename.rfind('/');
+		if (last_slash == string::npos)
+			this->tmp_dir = ".";
+		else
+			this->tmp_dir = last_slash == 0 ? "/" : this->output_filename.substr(0, last_slash);
+	}
+	if (stage_args.size() > 1) {
+		string workdir = this->tmp_dir + "/kff_pipeline_" + to_string(getpid());
+		if (mkdir(workdir.c_str(), 0700) != 0) {
+			cerr << "Impossible to create the directory " << workdir << ": " << strerror(errno) << endl;
+			exit(1);
+		}
+		pipeline_workdir = workdir;
+		atexit(remove_workdir);
+	}
+
+	string previous = this->input_filename;
+	for (uint s=0 ; s<stage_args.size() ; s++) {
+		vector<string> & args = stage_args[s];
+		bool last = s == stage_args.size() - 1;
+
+		// Connect the stage to its neighbours
+		if (previous != "") {
+			args.push_back("-i");
+			args.push_back(previous);
+		}
+		string current = last ? this->output_filename : pipeline_workdir + "/stage_" + to_string(s) + ".kff";
+		if (current != "") {
+			args.push_back("-o");
+			args.push_back(current);
+		}
+
+		this->run_stage(args);
+
+		// The intermediate input is not needed anymore
+		if (s > 0)
+			remove(previous.c_str());
+		struct stat produced;
+		if (not last and stat(current.c_str(), &produced) != 0) {
+			cerr << "The stage \"" << this->stages[s] << "\" did not produce a kff file. Only the last stage can be a tool without kff output." << endl;
+			exit(1);
+		}
+
+		previous = current;
+	}
+
+	remove_workdir();
+}
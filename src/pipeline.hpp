@@ -0,0 +1,35 @@
+#include <string>
+#include <iostream>
+#include <vector>
+
+#include "CLI11.hpp"
+#include "kfftools.hpp"
+
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+class Pipeline: public KffTool {
+private:
+	std::string input_filename;
+	std::string output_filename;
+	std::string tmp_dir;
+	std::vector<std::string> stages;
+
+	/** Parse the command line of a stage and execute the selected tool.
+	 * @param args Stage arguments (the tool name first, without the program name).
+	 **/
+	void run_stage(const std::vector<std::string> & args);
+
+public:
+	Pipeline();
+	void cli_prepare(CLI::App * subapp);
+	/** Execute the stages one after the other inside of the current process. The output of a stage
+	 * is the input of the next one. There is no streaming between the stages: each intermediate
+	 * file is fully written in a private directory of the temporary directory (the output directory
+	 * by default) and removed as soon as the next stage is over.
+	 **/
+	void exec();
+};
+
+#endif
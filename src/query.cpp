@@ -0,0 +1,399 @@
+#include <vector>
+#include <string>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <sys/stat.h>
+
+#include "query.hpp"
+#include "outstr.hpp"
+#include "sequences.hpp"
+#include "encoding.hpp"
+
+
+using namespace std;
+
+
+Query::Query() {
+	input_filename = "";
+	queries_filename = "";
+	table_filename = "";
+	single_side = false;
+	batch_size = 1000000;
+	cache_size = 256;
+
+	k = 0;
+	m = 0;
+	data_size = 0;
+	max = 0;
+}
+
+void Query::cli_prepare(CLI::App * app) {
+	this->subapp = app->add_subcommand("query", "Search kmers in a kff file and print their data. Only the minimizer sections of the file are searched (see bucket and compact). For each query, the line \"KMER 1 DATA\" is printed if the kmer is present, \"KMER 0\" otherwise. The minimizers are searched the same way than bucket: if the minimizer is on the reverse strand, the kmer is searched reverse complemented.");
+	CLI::Option * input_option = subapp->add_option("-i, --infile", input_filename, "The kff file to query.");
+	input_option->required();
+	input_option->check(CLI::ExistingFile);
+	subapp->add_option("-q, --queries", queries_filename, "Text file containing one kmer per line (default stdin).");
+	subapp->add_option("-t, --table", table_filename, "Minimizer table file. Loaded if it exists and matches the input file, otherwise created from the input file and saved for the next queries.");
+	subapp->add_flag("-s, --single-side", single_side, "Look for the minimizer only on the forward strand (same as bucket -s).");
+	subapp->add_option("-b, --batch-size", batch_size, "Number of queries answered together. The queries of a batch are grouped by section and each needed section is read once (default 1000000).");
+	subapp->add_option("--cache-size", cache_size, "Max memory used to keep decoded sections between batches, in MB (default 256).");
+}
+
+
+void Query::build_table() {
+	Kff_file infile(input_filename, "r");
+	uint8_t * metadata = new uint8_t[infile.metadata_size];
+	infile.read_metadata(metadata);
+	delete[] metadata;
+
+	bool raw_sections = false;
+	char section_type = infile.read_section_type();
+	while (infile.tellp() != infile.end_position) {
+		if (section_type == 'v') {
+			Section_GV sgv(&infile);
+			sgv.close();
+		} else if (section_type == 'i') {
+			Section_Index si(&infile);
+			si.close();
+		} else if (section_type == 'r') {
+			raw_sections = true;
+			infile.jump_next_section();
+		} else if (section_type == 'm') {
+			// All the minimizer sections must share the same k, m and data_size
+			uint64_t section_k = infile.global_vars["k"];
+			uint64_t section_m = infile.global_vars["m"];
+			uint64_t section_ds = infile.global_vars["data_size"];
+			if (this->k == 0) {
+				this->k = section_k;
+				this->m = section_m;
+				this->data_size = section_ds;
+			} else if (this->k != section_k or this->m != section_m or this->data_size != section_ds) {
+				cerr << "The minimizer sections of " << input_filename << " do not share the same k, m and data_size values." << endl;
+				cerr << "Such files can't be queried." << endl;
+				exit(1);
+			}
+			uint64_t section_max = infile.global_vars["max"];
+			if (section_max > this->max)
+				this->max = section_max;
+
+			// Read the minimizer
+			long position = infile.tellp();
+			uint64_t mini_bytes = (this->m + 3) / 4;
+			uint8_t * minimizer = new uint8_t[mini_bytes];
+			infile.jump_to(position + 1);
+			infile.read(minimizer, mini_bytes);
+			infile.jump_to(position);
+			this->table[seq_to_uint(minimizer, this->m)].push_back({position, section_max});
+			delete[] minimizer;
+
+			if (not infile.jump_next_section()) {
+				cerr << "Error inside of the input file." << endl;
+				cerr << "Impossible to jump over the section " << section_type << endl;
+				exit(1);
+			}
+		} else {
+			cerr << "Unknown section type " << section_type << " in the file " << input_filename << endl;
+			exit(1);
+		}
+
+		section_type = infile.read_section_type();
+	}
+
+	if (raw_sections)
+		cerr << "Warning: " << input_filename << " contains raw sections. Their kmers are not searched." << endl;
+}
+
+
+// Table file: signature, input file size, k, m, data_size, max, number of minimizers, then for each
+// minimizer its value, its number of sections and the (position, max) of each section.
+static const uint64_t table_signature = 0x4b46465154424c31; // "KFFQTBL1"
+
+static uint64_t file_size(const string & filename) {
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0)
+		return 0;
+	return st.st_size;
+}
+
+
+bool Query::load_table() {
+	ifstream fs(table_filename, ios::binary);
+	if (not fs.is_open())
+		return false;
+
+	uint64_t header[7];
+	fs.read((char *)header, sizeof(header));
+	if (not fs or header[0] != table_signature or header[1] != file_size(input_filename)) {
+		cerr << "Warning: " << table_filename << " does not match " << input_filename << ". The table is recomputed." << endl;
+		return false;
+	}
+
+	this->k = header[2];
+	this->m = header[3];
+	this->data_size = header[4];
+	this->max = header[5];
+	this->table.reserve(header[6]);
+	for (uint64_t i=0 ; i<header[6] ; i++) {
+		uint64_t minimizer, nb_sections;
+		fs.read((char *)&minimizer, sizeof(minimizer));
+		fs.read((char *)&nb_sections, sizeof(nb_sections));
+		vector<QuerySection> & sections = this->table[minimizer];
+		sections.resize(nb_sections);
+		fs.read((char *)sections.data(), nb_sections * sizeof(QuerySection));
+	}
+
+	if (not fs) {
+		cerr << "Warning: " << table_filename << " is truncated. The table is recomputed." << endl;
+		this->table.clear();
+		return false;
+	}
+	return true;
+}
+
+
+void Query::save_table() {
+	ofstream fs(table_filename, ios::binary);
+	if (not fs.is_open()) {
+		cerr << "Impossible to write the table file " << table_filename << endl;
+		exit(1);
+	}
+
+	uint64_t header[7] = {table_signature, file_size(input_filename), k, m, data_size, max, table.size()};
+	fs.write((char *)header, sizeof(header));
+	for (auto & p : this->table) {
+		uint64_t nb_sections = p.second.size();
+		fs.write((char *)&p.first, sizeof(p.first));
+		fs.write((char *)&nb_sections, sizeof(nb_sections));
+		fs.write((char *)p.second.data(), nb_sections * sizeof(QuerySection));
+	}
+}
+
+
+SectionCache::SectionCache(const size_t max_memory) {
+	this->max_memory = max_memory;
+	this->memory = 0;
+}
+
+SectionCache::~SectionCache() {
+	for (auto & p : this->sections)
+		delete p.second.first;
+}
+
+
+DecodedSection * SectionCache::get(const long position) {
+	auto it = this->sections.find(position);
+	if (it == this->sections.end())
+		return nullptr;
+
+	// Move to the front of the lru list
+	this->lru.splice(this->lru.begin(), this->lru, it->second.second);
+	return it->second.first;
+}
+
+
+void SectionCache::add(const long position, DecodedSection * section) {
+	this->lru.push_front(position);
+	this->sections[position] = make_pair(section, this->lru.begin());
+	this->memory += section->memory;
+
+	// Remove the least recently used sections
+	while (this->memory > this->max_memory and this->lru.size() > 1) {
+		long removed = this->lru.back();
+		this->lru.pop_back();
+
+		DecodedSection * ds = this->sections[removed].first;
+		this->memory -= ds->memory;
+		delete ds;
+		this->sections.erase(removed);
+	}
+}
+
+
+DecodedSection * Query::decode_section(Kff_file & infile, const QuerySection & section) {
+	infile.global_vars["max"] = section.max;
+	infile.jump_to(section.position);
+	Section_Minimizer sm(&infile);
+
+	uint64_t kmer_bytes = (k + 3) / 4;
+	uint8_t first_mask = k % 4 == 0 ? 0xFF : (1 << (2 * (k % 4))) - 1;
+	uint8_t * seq = new uint8_t[(k + section.max - 1) / 4 + 1];
+	uint8_t * data = new uint8_t[section.max * data_size + 1];
+	uint8_t * kmer = new uint8_t[kmer_bytes + 1];
+
+	DecodedSection * ds = new DecodedSection();
+	for (uint64_t b=0 ; b<sm.nb_blocks ; b++) {
+		uint64_t mini_pos;
+		uint64_t nb_kmers = sm.read_compacted_sequence_without_mini(seq, data, mini_pos);
+		sm.add_minimizer(nb_kmers, seq, mini_pos);
+
+		uint64_t seq_size = k + nb_kmers - 1;
+		for (uint64_t kmer_idx=0 ; kmer_idx<nb_kmers ; kmer_idx++) {
+			subsequence(seq, seq_size, kmer, kmer_idx, kmer_idx + k - 1);
+			kmer[0] &= first_mask;
+			// The first occurence is kept
+			if (ds->kmers.emplace(string((char *)kmer, kmer_bytes), ds->kmers.size()).second)
+				ds->data.insert(ds->data.end(), data + kmer_idx * data_size, data + (kmer_idx + 1) * data_size);
+		}
+	}
+	// Approximation of the hash table memory (key, value and node)
+	ds->memory = ds->data.size() + ds->kmers.size() * (kmer_bytes + 64);
+
+	delete[] seq;
+	delete[] data;
+	delete[] kmer;
+
+	return ds;
+}
+
+
+/** A query waiting for the read of a section
+ **/
+struct SectionVisit {
+	long position;
+	uint64_t max;
+	uint64_t query_idx;
+};
+
+
+void Query::answer_batch(Kff_file & infile, SectionCache & cache, const vector<string> & queries) {
+	Binarizer bin(infile.encoding);
+	RevComp rc(infile.encoding);
+	MinimizerSearcher searcher(k, m, infile.encoding, k, single_side);
+
+	uint64_t kmer_bytes = (k + 3) / 4;
+	uint8_t first_mask = k % 4 == 0 ? 0xFF : (1 << (2 * (k % 4))) - 1;
+	uint8_t * kmer = new uint8_t[kmer_bytes];
+
+	// --- Orient the queries and list the sections to read ---
+	vector<string> keys(queries.size());
+	vector<SectionVisit> visits;
+	for (uint64_t q=0 ; q<queries.size() ; q++) {
+		const string & query = queries[q];
+		if (this->k == 0 or query.size() != k or query.find_first_not_of("ACGTacgt") != string::npos) {
+			cerr << "Warning: " << query << " is not a valid " << k << "-mer" << endl;
+			continue;
+		}
+
+		// Orient the kmer the same way than bucket
+		bin.translate(query, k, kmer);
+		vector<skmer> skmers = searcher.get_skmers(kmer, k);
+		int64_t mini_pos = skmers[0].minimizer_position;
+		if (mini_pos < 0) {
+			rc.rev_comp(kmer, k);
+			mini_pos = k - m + mini_pos + 1;
+		}
+		kmer[0] &= first_mask;
+		keys[q] = string((char *)kmer, kmer_bytes);
+
+		uint64_t minimizer = subseq_to_uint(kmer, k, mini_pos, mini_pos + m - 1);
+		auto it = this->table.find(minimizer);
+		if (it != this->table.end())
+			for (const QuerySection & qs : it->second)
+				visits.push_back({qs.position, qs.max, q});
+	}
+
+	// --- Visit each needed section once, in the file order ---
+	sort(visits.begin(), visits.end(), [](const SectionVisit & a, const SectionVisit & b) {
+		return a.position < b.position or (a.position == b.position and a.query_idx < b.query_idx);
+	});
+
+	// Index of the answer data for each query (-1 if absent)
+	vector<int64_t> answers(queries.size(), -1);
+	vector<uint8_t> answer_data;
+	uint64_t visit_idx = 0;
+	while (visit_idx < visits.size()) {
+		uint64_t group_end = visit_idx;
+		bool needed = false;
+		while (group_end < visits.size() and visits[group_end].position == visits[visit_idx].position) {
+			needed = needed or answers[visits[group_end].query_idx] == -1;
+			group_end += 1;
+		}
+
+		// Only read sections that can answer remaining queries
+		if (needed) {
+			DecodedSection * ds = cache.get(visits[visit_idx].position);
+			if (ds == nullptr) {
+				ds = this->decode_section(infile, {visits[visit_idx].position, visits[visit_idx].max});
+				cache.add(visits[visit_idx].position, ds);
+			}
+
+			for (uint64_t v=visit_idx ; v<group_end ; v++) {
+				uint64_t q = visits[v].query_idx;
+				if (answers[q] != -1)
+					continue;
+
+				auto it = ds->kmers.find(keys[q]);
+				if (it != ds->kmers.end()) {
+					answers[q] = answer_data.size();
+					answer_data.insert(answer_data.end(), ds->data.begin() + it->second * data_size, ds->data.begin() + (it->second + 1) * data_size);
+				}
+			}
+		}
+
+		visit_idx = group_end;
+	}
+
+	// --- Print the answers in the query order ---
+	for (uint64_t q=0 ; q<queries.size() ; q++) {
+		if (answers[q] == -1)
+			cout << queries[q] << " 0" << '\n';
+		else if (data_size == 0)
+			cout << queries[q] << " 1" << '\n';
+		else
+			cout << queries[q] << " 1 " << format_data(answer_data.data() + answers[q], data_size) << '\n';
+	}
+
+	delete[] kmer;
+}
+
+
+void Query::exec() {
+	// Minimizer -> sections table
+	if (table_filename == "" or not this->load_table()) {
+		this->build_table();
+		if (table_filename != "")
+			this->save_table();
+	}
+
+	// Query stream
+	istream * queries = &cin;
+	ifstream queries_file;
+	if (queries_filename != "" and queries_filename != "-") {
+		queries_file.open(queries_filename);
+		if (not queries_file.is_open()) {
+			cerr << "Impossible to open the query file " << queries_filename << endl;
+			exit(1);
+		}
+		queries = &queries_file;
+	}
+
+	Kff_file infile(input_filename, "r");
+	// Needed to open the sections without reading the variable sections
+	infile.global_vars["k"] = k;
+	infile.global_vars["m"] = m;
+	infile.global_vars["data_size"] = data_size;
+
+	SectionCache cache(cache_size * 1048576);
+	if (batch_size == 0)
+		batch_size = 1;
+
+	vector<string> batch;
+	string line;
+	while (getline(*queries, line)) {
+		// Remove the line endings and spaces
+		size_t end = line.find_last_not_of(" \t\r");
+		if (end == string::npos)
+			continue;
+		line.erase(end + 1);
+
+		batch.push_back(line);
+		if (batch.size() == batch_size) {
+			this->answer_batch(infile, cache, batch);
+			batch.clear();
+		}
+	}
+
+	if (batch.size() > 0)
+		this->answer_batch(infile, cache, batch);
+}
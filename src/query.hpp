@@ -0,0 +1,94 @@
+#include <string>
+#include <iostream>
+#include <vector>
+#include <list>
+#include <unordered_map>
+
+#include "CLI11.hpp"
+#include "kfftools.hpp"
+
+
+#ifndef QUERY_H
+#define QUERY_H
+
+/** Position of a minimizer section in the queried file and the max value needed to decode it.
+ **/
+struct QuerySection {
+	long position;
+	uint64_t max;
+};
+
+/** Kmers of a minimizer section loaded in memory.
+ **/
+struct DecodedSection {
+	// Binarized kmer (padding bits set to 0) -> index of the kmer data
+	std::unordered_map<std::string, uint64_t> kmers;
+	std::vector<uint8_t> data;
+	size_t memory;
+};
+
+/** Size bounded LRU cache of decoded sections, indexed by section position.
+ **/
+class SectionCache {
+private:
+	size_t max_memory;
+	size_t memory;
+	// Most recently used first
+	std::list<long> lru;
+	std::unordered_map<long, std::pair<DecodedSection *, std::list<long>::iterator> > sections;
+
+public:
+	SectionCache(const size_t max_memory);
+	~SectionCache();
+
+	/** Get a section from the cache and mark it as the most recently used.
+	 * @return The decoded section or nullptr if the section is not in the cache.
+	 **/
+	DecodedSection * get(const long position);
+	/** Add a section to the cache (the cache takes the ownership). The least recently used sections
+	 * are removed until the memory limit is respected. The last section added is always kept.
+	 **/
+	void add(const long position, DecodedSection * section);
+};
+
+class Query: public KffTool {
+private:
+	std::string input_filename;
+	std::string queries_filename;
+	std::string table_filename;
+	bool single_side;
+	uint64_t batch_size;
+	uint64_t cache_size;
+
+	// Values shared by all the minimizer sections of the file
+	uint64_t k;
+	uint64_t m;
+	uint64_t data_size;
+	uint64_t max;
+	// minimizer -> sections
+	std::unordered_map<uint64_t, std::vector<QuerySection> > table;
+
+	/** Scan the input file and register the position of each minimizer section.
+	 **/
+	void build_table();
+	/** Load the table from table_filename.
+	 * @return false if the file does not exist or does not match the input file.
+	 **/
+	bool load_table();
+	void save_table();
+
+	/** Read all the kmers of a minimizer section.
+	 **/
+	DecodedSection * decode_section(Kff_file & infile, const QuerySection & section);
+	/** Answer a batch of queries. The queries are grouped by section and the sections are visited in
+	 * the file order. The answers are printed in the query order.
+	 **/
+	void answer_batch(Kff_file & infile, SectionCache & cache, const std::vector<std::string> & queries);
+
+public:
+	Query();
+	void cli_prepare(CLI::App * subapp);
+	void exec();
+};
+
+#endif
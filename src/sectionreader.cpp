@@ -0,0 +1,328 @@
+#include <cstring>
+#include <algorithm>
+
+#include "sectionreader.hpp"
+#include "mapreader.hpp"
+
+
+using namespace std;
+
+
+/** Number of bytes needed to store values in [0, max_value[ (ceil(log2(max_value)) bits).
+ **/
+static uint nb_bytes_for(const uint64_t max_value) {
+	uint nb_bits = max_value <= 1 ? 0 : 64 - __builtin_clzll(max_value - 1);
+	return (nb_bits + 7) / 8;
+}
+
+/** Nucleotide at index idx of a sequence of seq_size nucleotides (padding at the beginning).
+ **/
+static inline uint8_t get_nucleotide(const uint8_t * seq, const uint64_t seq_size, const uint64_t idx) {
+	uint64_t pos = (4 - seq_size % 4) % 4 + idx;
+	return (seq[pos / 4] >> (2 * (3 - pos % 4))) & 0b11;
+}
+
+
+KffSectionReader::KffSectionReader() {
+	this->nb_kmers_bytes = 0;
+	this->mini_pos_bytes = 0;
+	this->remaining_blocks = 0;
+	this->window = nullptr;
+	this->window_position = 0;
+	this->window_size = 0;
+
+	this->major_version = this->minor_version = 0;
+	memset(this->encoding, 0, 4);
+	this->uniqueness = this->canonicity = false;
+	this->metadata_size = 0;
+	this->metadata = nullptr;
+
+	this->position = 0;
+	this->end_position = 0;
+	this->section_type = 0;
+	this->section_beginning = 0;
+	this->k = this->m = this->max = this->data_size = this->nb_blocks = 0;
+	this->minimizer = nullptr;
+}
+
+
+void KffSectionReader::read_header() {
+	const uint8_t * signature = this->take(3);
+	if (memcmp(signature, "KFF", 3) != 0)
+		throw "Missing KFF signature at the beginning of the file";
+	this->major_version = *this->take(1);
+	this->minor_version = *this->take(1);
+	uint8_t code = *this->take(1);
+	for (uint i=0 ; i<4 ; i++)
+		this->encoding[i] = (code >> (2 * (3 - i))) & 0b11;
+	this->uniqueness = *this->take(1) != 0;
+	this->canonicity = *this->take(1) != 0;
+	this->metadata_size = this->read_value(4);
+	this->metadata = this->take(this->metadata_size);
+}
+
+
+void KffSectionReader::require(const uint64_t nb_bytes) const {
+	if (this->position + nb_bytes > (uint64_t)this->end_position)
+		throw "End of the file reached inside of a section";
+
+	if (this->position < this->window_position or this->position + nb_bytes > this->window_position + this->window_size)
+		this->refill(this->position, nb_bytes);
+}
+
+const uint8_t * KffSectionReader::take(const uint64_t nb_bytes) {
+	this->require(nb_bytes);
+
+	const uint8_t * current = this->window + (this->position - this->window_position);
+	this->position += nb_bytes;
+	return current;
+}
+
+uint64_t KffSectionReader::read_value(const uint nb_bytes) {
+	const uint8_t * value_bytes = this->take(nb_bytes);
+	uint64_t value = 0;
+	for (uint b=0 ; b<nb_bytes ; b++)
+		value = (value << 8) | value_bytes[b];
+	return value;
+}
+
+
+void KffSectionReader::jump_to(const long position) {
+	this->position = position;
+	this->remaining_blocks = 0;
+}
+
+char KffSectionReader::read_section_type() const {
+	if (this->position >= this->end_position)
+		return 0;
+	return *this->read_bytes(this->position, 1);
+}
+
+const uint8_t * KffSectionReader::read_bytes(const long position, const uint64_t size) const {
+	if (position < this->window_position or position + size > this->window_position + this->window_size)
+		this->refill(position, size);
+	return this->window + (position - this->window_position);
+}
+
+
+map<string, uint64_t> KffSectionReader::read_gv() {
+	this->take(1);
+	uint64_t nb_vars = this->read_value(8);
+
+	map<string, uint64_t> vars;
+	for (uint64_t i=0 ; i<nb_vars ; i++) {
+		// The name ends with its first 0 byte
+		uint64_t name_size = 0;
+		this->require(1);
+		while (this->window[this->position - this->window_position + name_size] != 0) {
+			name_size += 1;
+			this->require(name_size + 1);
+		}
+		const char * name = (const char *)this->take(name_size + 1);
+		vars[string(name, name_size)] = this->read_value(8);
+	}
+
+	// The footer values are not variables for the next sections
+	if (vars.find("footer_size") == vars.end())
+		for (const auto & p : vars)
+			this->global_vars[p.first] = p.second;
+
+	return vars;
+}
+
+
+long KffSectionReader::footer_position() const {
+	// The footer_size variable is the last one of the file
+	long name_position = this->end_position - 20;
+	if (name_position <= 0)
+		return 0;
+	const uint8_t * footer_size_var = this->read_bytes(name_position, 20);
+	if (memcmp(footer_size_var, "footer_size", 12) != 0)
+		return 0;
+
+	long footer_size = 0;
+	for (uint b=0 ; b<8 ; b++)
+		footer_size = (footer_size << 8) | footer_size_var[12 + b];
+	long footer_position = this->end_position - footer_size;
+	if (footer_position <= 0 or *this->read_bytes(footer_position, 1) != 'v')
+		return 0;
+	return footer_position;
+}
+
+
+map<int64_t, char> KffSectionReader::read_index(int64_t & next_index) {
+	this->take(1);
+	uint64_t nb_sections = this->read_value(8);
+
+	map<int64_t, char> index;
+	for (uint64_t i=0 ; i<nb_sections ; i++) {
+		char type = *this->take(1);
+		index[(int64_t)this->read_value(8)] = type;
+	}
+	next_index = (int64_t)this->read_value(8);
+
+	return index;
+}
+
+
+uint64_t KffSectionReader::open_block_section() {
+	this->section_beginning = this->position;
+	this->section_type = *this->take(1);
+
+	this->k = this->global_vars["k"];
+	this->max = this->global_vars["max"];
+	this->data_size = this->global_vars["data_size"];
+	this->nb_kmers_bytes = nb_bytes_for(this->max);
+
+	if (this->section_type == 'm') {
+		this->m = this->global_vars["m"];
+		this->mini_pos_bytes = nb_bytes_for(this->k - this->m + this->max);
+		// Minimizer and number of blocks in the same window
+		this->require((this->m + 3) / 4 + 8);
+		this->minimizer = this->take((this->m + 3) / 4);
+	} else if (this->section_type == 'r') {
+		this->minimizer = nullptr;
+	} else
+		throw "Not a block section";
+
+	this->nb_blocks = this->read_value(8);
+	this->remaining_blocks = this->nb_blocks;
+	return this->nb_blocks;
+}
+
+
+uint64_t KffSectionReader::read_block_header(KffBlock & block) {
+	this->remaining_blocks -= 1;
+
+	// A 0 byte counter means that all the blocks contain 1 kmer
+	block.nb_kmers = this->nb_kmers_bytes == 0 ? 1 : this->read_value(this->nb_kmers_bytes);
+	if (this->section_type == 'm') {
+		block.mini_pos = this->read_value(this->mini_pos_bytes);
+		block.seq_size = this->k - this->m + block.nb_kmers - 1;
+	} else {
+		block.mini_pos = 0;
+		block.seq_size = this->k + block.nb_kmers - 1;
+	}
+
+	return (block.seq_size + 3) / 4 + block.nb_kmers * this->data_size;
+}
+
+
+bool KffSectionReader::next_block(KffBlock & block) {
+	if (this->remaining_blocks == 0)
+		return false;
+
+	// Sequence and data in the same window
+	this->require(this->read_block_header(block));
+	block.seq = this->take((block.seq_size + 3) / 4);
+	block.data = this->take(block.nb_kmers * this->data_size);
+
+	return true;
+}
+
+
+void KffSectionReader::skip_blocks() {
+	KffBlock block;
+	while (this->remaining_blocks > 0) {
+		// Only the block headers are read
+		uint64_t payload_size = this->read_block_header(block);
+		if (this->position + payload_size > (uint64_t)this->end_position)
+			throw "End of the file reached inside of a section";
+		this->position += payload_size;
+	}
+}
+
+
+void KffSectionReader::sequence_with_minimizer(const KffBlock & block, uint8_t * seq) const {
+	uint64_t full_size = block.seq_size + this->m;
+	memset(seq, 0, (full_size + 3) / 4);
+
+	uint64_t offset = (4 - full_size % 4) % 4;
+	for (uint64_t idx=0 ; idx<full_size ; idx++) {
+		uint8_t nucl;
+		if (idx < block.mini_pos)
+			nucl = get_nucleotide(block.seq, block.seq_size, idx);
+		else if (idx < block.mini_pos + this->m)
+			nucl = get_nucleotide(this->minimizer, this->m, idx - block.mini_pos);
+		else
+			nucl = get_nucleotide(block.seq, block.seq_size, idx - this->m);
+
+		uint64_t pos = offset + idx;
+		seq[pos / 4] |= nucl << (2 * (3 - pos % 4));
+	}
+}
+
+
+
+StreamKffReader::StreamKffReader(const string & filename, const uint64_t chunk_size) {
+	this->file = new Kff_file(filename, "r");
+	this->owned_file = true;
+	this->chunk_size = chunk_size;
+	this->init();
+}
+
+StreamKffReader::StreamKffReader(Kff_file * file, const uint64_t chunk_size) {
+	this->file = file;
+	this->owned_file = false;
+	this->chunk_size = chunk_size;
+	this->init();
+}
+
+StreamKffReader::~StreamKffReader() {
+	if (this->owned_file) {
+		this->file->close();
+		delete this->file;
+	}
+}
+
+
+void StreamKffReader::init() {
+	// Header + final signature
+	if (this->file->end_position + 3 < 15)
+		return;
+	this->end_position = this->file->end_position;
+
+	this->read_header();
+	// The window moves: the metadata are kept in the reader
+	this->metadata_copy.assign(this->metadata, this->metadata + this->metadata_size);
+	this->metadata = this->metadata_copy.data();
+}
+
+
+void StreamKffReader::refill(const long position, const uint64_t nb_bytes) const {
+	// The file ends with the 3 bytes of the final signature
+	long file_size = this->end_position + 3;
+	if (position < 0 or position + (long)nb_bytes > file_size)
+		throw "Read out of the file";
+
+	uint64_t size = std::min((uint64_t)(file_size - position), std::max(nb_bytes, this->chunk_size));
+	if (this->chunk.size() < size)
+		this->chunk.resize(size);
+	this->file->jump_to(position);
+	this->file->read(this->chunk.data(), size);
+
+	this->window = this->chunk.data();
+	this->window_position = position;
+	this->window_size = size;
+}
+
+
+uint64_t StreamKffReader::open_block_section() {
+	uint64_t nb_blocks = KffSectionReader::open_block_section();
+	if (this->minimizer != nullptr) {
+		this->minimizer_copy.assign(this->minimizer, this->minimizer + (this->m + 3) / 4);
+		this->minimizer = this->minimizer_copy.data();
+	}
+	return nb_blocks;
+}
+
+
+
+KffSectionReader * open_kff_reader(const string & filename) {
+	MappedKffReader * mapped = new MappedKffReader(filename);
+	if (mapped->is_open())
+		return mapped;
+	delete mapped;
+
+	return new StreamKffReader(filename);
+}
@@ -0,0 +1,200 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+
+#include "kff_io.hpp"
+
+
+#ifndef SECTIONREADER_H
+#define SECTIONREADER_H
+
+
+/** A block of kmers read from a kff file. The pointers are directly pointing inside of the bytes
+ * of the reader (no copy). With a MappedKffReader, they stay valid as long as the reader exists.
+ * With a StreamKffReader, they are only valid until the next read of the reader.
+ **/
+struct KffBlock {
+  uint64_t nb_kmers;
+  // Position of the minimizer in the superkmer (minimizer sections only)
+  uint64_t mini_pos;
+  // Binarized sequence. For minimizer sections, the minimizer is not included.
+  const uint8_t * seq;
+  // Size of seq in nucleotides
+  uint64_t seq_size;
+  const uint8_t * data;
+};
+
+
+/** Sequential reader of the sections and blocks of a kff file. The sections and blocks are parsed
+ * with pointer arithmetic over a window of the file bytes. The derived classes only provide the
+ * bytes of the window: the whole file for a memory mapping (MappedKffReader), a buffer refilled
+ * through the kff API otherwise (StreamKffReader). The tools read their input through this class
+ * and get the same values whatever the way the file is accessed.
+ * Errors in the file structure are reported by throwing a const char * (same as the kff API).
+ **/
+class KffSectionReader {
+private:
+  // Current block section values
+  uint nb_kmers_bytes;
+  uint mini_pos_bytes;
+
+  /** Read the counters of the next block (sequence and data pointers not set).
+   * @return Number of bytes of the sequence and data that follow.
+   **/
+  uint64_t read_block_header(KffBlock & block);
+
+protected:
+  uint64_t remaining_blocks;
+
+  // Bytes of the file available without any read: [window_position, window_position + window_size[
+  // The window is a cache over the file, it can be moved by the const methods.
+  mutable const uint8_t * window;
+  mutable long window_position;
+  mutable uint64_t window_size;
+
+  /** Move the window to make the file bytes [position, position + nb_bytes[ available.
+   * Throw if the bytes are outside of the file.
+   **/
+  virtual void refill(const long position, const uint64_t nb_bytes) const = 0;
+  /** Make the next nb_bytes bytes of the sections available in the window (without moving the
+   * cursor).
+   **/
+  void require(const uint64_t nb_bytes) const;
+  /** Get a pointer on the next nb_bytes bytes and move the cursor after them.
+   **/
+  const uint8_t * take(const uint64_t nb_bytes);
+  /** Read a big endian integer of nb_bytes bytes.
+   **/
+  uint64_t read_value(const uint nb_bytes);
+  /** Read the header of the file. Must be called by the constructors of the derived classes once
+   * the end position is known.
+   **/
+  void read_header();
+
+public:
+  // Header
+  uint8_t major_version;
+  uint8_t minor_version;
+  uint8_t encoding[4];
+  bool uniqueness;
+  bool canonicity;
+  uint32_t metadata_size;
+  const uint8_t * metadata;
+
+  // Cursor position and position of the final KFF signature
+  long position;
+  long end_position;
+  // Variables defined by the previous variable sections (footer excluded)
+  std::unordered_map<std::string, uint64_t> global_vars;
+
+  // Values of the current block section
+  char section_type;
+  long section_beginning;
+  uint64_t k;
+  uint64_t m;
+  uint64_t max;
+  uint64_t data_size;
+  uint64_t nb_blocks;
+  const uint8_t * minimizer;
+
+  KffSectionReader();
+  KffSectionReader(const KffSectionReader &) = delete;
+  KffSectionReader & operator=(const KffSectionReader &) = delete;
+  virtual ~KffSectionReader() {};
+
+  virtual bool is_open() const = 0;
+
+  /** Move the cursor to a section beginning. The global variables must be set by the caller if
+   * the previous variable sections are not read.
+   **/
+  void jump_to(const long position);
+  /** Peek the type of the next section. Return 0 at the end of the sections.
+   **/
+  char read_section_type() const;
+  /** Get the file bytes [position, position + size[ without moving the cursor. The bytes can be
+   * read anywhere in the file (ie the final signature).
+   * @return A pointer on the bytes, valid until the next read (same as the block pointers).
+   **/
+  const uint8_t * read_bytes(const long position, const uint64_t size) const;
+
+  /** Read a variable section. The global variables are updated except for the footer.
+   * @return All the variables of the section.
+   **/
+  std::map<std::string, uint64_t> read_gv();
+  /** Locate the footer from the footer_size variable written at the end of the file.
+   * @return The footer position or 0 if the file has no footer.
+   **/
+  long footer_position() const;
+  /** Read an index section.
+   * @param next_index Filled with the next index offset (relative to the end of the section).
+   * @return The indexed sections as offset relative to the end of the section -> type.
+   **/
+  std::map<int64_t, char> read_index(int64_t & next_index);
+
+  /** Read the header of a raw or minimizer section. The blocks are then read with next_block.
+   * @return The number of blocks in the section.
+   **/
+  virtual uint64_t open_block_section();
+  /** Read the next block of the current section.
+   * @return false if all the blocks of the section have been read.
+   **/
+  bool next_block(KffBlock & block);
+  /** Move the cursor after the remaining blocks of the current section.
+   **/
+  void skip_blocks();
+  /** Number of blocks of the current section not read yet.
+   **/
+  uint64_t blocks_left() const { return this->remaining_blocks; }
+
+  /** Write the complete sequence of a minimizer section block (minimizer included).
+   * @param block A block of the current minimizer section.
+   * @param seq Pre-allocated array of at least (k + nb_kmers + 2) / 4 + 1 bytes.
+   **/
+  void sequence_with_minimizer(const KffBlock & block, uint8_t * seq) const;
+};
+
+
+/** Kff file reader over the kff API, for the files that can't be memory mapped. The file bytes
+ * are read by chunks into a buffer that is the window of the reader.
+ **/
+class StreamKffReader final : public KffSectionReader {
+private:
+  Kff_file * file;
+  bool owned_file;
+  uint64_t chunk_size;
+
+  mutable std::vector<uint8_t> chunk;
+  std::vector<uint8_t> metadata_copy;
+  std::vector<uint8_t> minimizer_copy;
+
+  void init();
+  void refill(const long position, const uint64_t nb_bytes) const override;
+
+public:
+  /** Open the file with the kff API.
+   * @param chunk_size Number of bytes read at once.
+   **/
+  StreamKffReader(const std::string & filename, const uint64_t chunk_size=1 << 20);
+  /** Reader over a kff file already opened in read mode (ie a file only present in memory).
+   **/
+  StreamKffReader(Kff_file * file, const uint64_t chunk_size=1 << 20);
+  ~StreamKffReader();
+
+  bool is_open() const override { return this->end_position > 0; }
+
+  /** Same as KffSectionReader::open_block_section. The minimizer is copied out of the window to
+   * stay valid during the whole section.
+   **/
+  uint64_t open_block_section() override;
+};
+
+
+/** Open a kff file for reading. The file is memory mapped when possible (MappedKffReader),
+ * otherwise it is read through the kff API (StreamKffReader).
+ * @return A reader to delete by the caller.
+ **/
+KffSectionReader * open_kff_reader(const std::string & filename);
+
+#endif
@@ -78,6 +78,43 @@ void subsequence(const uint8_t * sequence, const uint seq_size, uint8_t * extrac
 }
 
 
+/** Read 8 bytes as a big endian word. The bytes outside of [0, nb_bytes[ are read as 0.
+ **/
+static inline uint64_t load_word(const uint8_t * bytes, const int64_t nb_bytes, const int64_t first_byte) {
+	if (first_byte >= 0 and first_byte + 8 <= nb_bytes) {
+		uint64_t word;
+		memcpy(&word, bytes + first_byte, 8);
+		return __builtin_bswap64(word);
+	}
+
+	uint64_t word = 0;
+	for (int64_t b=first_byte ; b<first_byte+8 ; b++)
+		word = (word << 8) | (b >= 0 and b < nb_bytes ? bytes[b] : 0);
+	return word;
+}
+
+
+void extract_subsequence(const uint8_t * sequence, const uint64_t seq_size, uint8_t * extracted, const uint64_t begin_nucl, const uint64_t nb_nucl) {
+	int64_t seq_bytes = (seq_size + 3) / 4;
+	uint64_t extracted_bytes = (nb_nucl + 3) / 4;
+	int64_t extracted_offset = (4 - nb_nucl % 4) % 4;
+	// Bit of the sequence aligned with the first bit of the extracted bytes (can be negative)
+	int64_t bit = 2 * ((int64_t)((4 - seq_size % 4) % 4 + begin_nucl) - extracted_offset);
+
+	for (uint64_t out=0 ; out<extracted_bytes ; out+=7, bit+=56) {
+		int64_t byte = bit >= 0 ? bit / 8 : (bit - 7) / 8;
+		// At least 57 meaningful bits after the shift
+		uint64_t word = load_word(sequence, seq_bytes, byte) << (bit - 8 * byte);
+		uint64_t nb_bytes = min((uint64_t)7, extracted_bytes - out);
+		for (uint64_t b=0 ; b<nb_bytes ; b++)
+			extracted[out + b] = word >> (56 - 8 * b);
+	}
+
+	// Clean the padding
+	extracted[0] &= 0xFF >> (2 * extracted_offset);
+}
+
+
 int sequence_compare(const uint8_t * seq1, const uint seq1_size,
 											const uint seq1_start, const uint seq1_stop,
 											const uint8_t * seq2, const uint seq2_size,
@@ -138,7 +175,7 @@ void MinimizerSearcher::compute_candidates(const uint8_t * seq, const uint seq_s
 	}
 	
 	// Compute minimizer candidates
-	uint64_t m_mask = (1 << (this->m*2)) - 1;
+	uint64_t m_mask = (1ULL << (this->m*2)) - 1;
 	for (uint i=this->m-1, kmer_idx=0 ; i<seq_size ; i++, kmer_idx++) {
 		uint idx = offset + i;
 		uint byte_idx = idx/4;
@@ -272,7 +309,7 @@ vector<skmer> MinimizerSearcher::get_skmers_fast(const uint8_t * seq, const uint
 	// Usefull variables
 	uint idx_offset = (4 - (seq_size % 4)) % 4;
 	uint8_t current_byte = seq[0];
-	uint64_t mini_mask = (1 << (this->m * 2)) - 1;
+	uint64_t mini_mask = (1ULL << (this->m * 2)) - 1;
 
 	// --- Preprocess the m-1 size first minimizer prefix ---
 	uint64_t current_candidate = 0;
@@ -507,11 +544,43 @@ uint64_t subseq_to_uint(const uint8_t * seq, uint seq_size, uint start_nucl, uin
 }
 
 
-void uint_to_seq(uint seq, uint8_t * bin_seq, uint size) {
+void uint_to_seq(uint64_t seq, uint8_t * bin_seq, uint size) {
 	uint seq_bytes = (size + 3) / 4;
 
 	for (int idx=seq_bytes-1 ; idx>=0 ; idx--) {
 		bin_seq[idx] = seq & 0b11111111;
 		seq >>= 8;
 	}
-}
\ No newline at end of file
+}
+
+
+uint64_t data_to_uint(const uint8_t * data, const uint data_size) {
+	uint first_byte = data_size > 8 ? data_size - 8 : 0;
+
+	uint64_t val = 0;
+	for (uint idx=first_byte ; idx<data_size ; idx++) {
+		val <<= 8;
+		val += data[idx];
+	}
+
+	return val;
+}
+
+
+uint64_t data_max_value(const uint data_size) {
+	if (data_size >= 8)
+		return 0xFFFFFFFFFFFFFFFF;
+	return (1ul << (8 * data_size)) - 1;
+}
+
+
+void uint_to_data(uint64_t value, uint8_t * data, const uint data_size) {
+	uint64_t max_val = data_max_value(data_size);
+	if (value > max_val)
+		value = max_val;
+
+	for (int idx=data_size-1 ; idx>=0 ; idx--) {
+		data[idx] = value & 0xFF;
+		value >>= 8;
+	}
+}
@@ -68,6 +68,17 @@ public:
   */
 void subsequence(const uint8_t * sequence, const uint seq_size, uint8_t * extracted, const uint begin_nucl, const uint end_nucl);
 
+/** Extract a subsequence of sequence with 64 bits word operations (7 output bytes per word, no
+  * shift of the whole sequence). Nothing is read outside of the sequence bytes.
+  * @param sequence Original sequence
+  * @param seq_size Size in nucleotides of the sequence
+  * @param extracted A memory space of (nb_nucl + 3) / 4 bytes where the subsequence is written
+  * (padding at the beginning).
+  * @param begin_nucl first nucleotide to extract
+  * @param nb_nucl Number of nucleotides to extract
+  */
+void extract_subsequence(const uint8_t * sequence, const uint64_t seq_size, uint8_t * extracted, const uint64_t begin_nucl, const uint64_t nb_nucl);
+
 
 /** Compare two subsequences. -1 if the first one is smaller in alpha order +1 is the second one
   * 0 if equals
@@ -105,7 +116,7 @@ uint64_t subseq_to_uint(const uint8_t * seq, uint seq_size, uint start_nucl, uin
   * @param bin_seq A Byte array to store the sequence. Must be allocated.
   * @param size Number of nucleotides in the sequence.
   */
-void uint_to_seq(uint seq, uint8_t * bin_seq, uint size);
+void uint_to_seq(uint64_t seq, uint8_t * bin_seq, uint size);
 
 
 // ----- Minimizer search related functions -----
@@ -191,6 +202,32 @@ public:
 
 
 
+// ----- Data related functions -----
+
+/** Read a kmer data as an integer. The data bytes are big endian (same as the data printed by
+  * outstr). Only the 8 last bytes are used for data larger than 8 bytes.
+  *
+  * @param data Data array of the kmer
+  * @param data_size Number of bytes in the data array
+  *
+  * @return The integer value
+  */
+uint64_t data_to_uint(const uint8_t * data, const uint data_size);
+
+/** Write an integer as a big endian data array. Values that do not fit in data_size bytes are
+  * saturated to the max value.
+  *
+  * @param value Value to write
+  * @param data Pre-allocated array of data_size bytes
+  * @param data_size Number of bytes in the data array
+  */
+void uint_to_data(uint64_t value, uint8_t * data, const uint data_size);
+
+/** Max value that can be stored in a data_size bytes data array (saturated to 64 bits).
+  */
+uint64_t data_max_value(const uint data_size);
+
+
 // ----- Usefull binary functions -----
 void leftshift8(uint8_t * bitarray, size_t length, size_t bitshift);
 void rightshift8(uint8_t * bitarray, size_t length, size_t bitshift);
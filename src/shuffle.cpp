@@ -2,6 +2,8 @@
 #include <string>
 
 #include "shuffle.hpp"
+#include "fileio.hpp"
+#include "checksum.hpp"
 
 
 using namespace std;
@@ -24,8 +26,7 @@ void Shuffle::cli_prepare(CLI::App * app) {
 // the code of this function is largely inspired by merge.cpp
 void Shuffle::shuffle(string input, string output) {
 	// Useful variables
-	const long buffer_size = 1048576; // 1 MB
-	uint8_t buffer[1048576];
+	SectionCopier copier;
 	uint8_t global_encoding[4];
 
 	// Read the encoding of the input file and push it as output encoding 
@@ -72,7 +73,9 @@ void Shuffle::shuffle(string input, string output) {
 					// Discard footers
 					if (in_sgv.vars.find("footer_size") != in_sgv.vars.end()) {
 						for (auto& tuple : in_sgv.vars) {
-							if (tuple.first != "footer_size" and tuple.first != "first_index") {
+							// The section checksums are not valid anymore in the rewritten file
+							if (tuple.first != "footer_size" and tuple.first != "first_index"
+							    and tuple.first.compare(0, checksum_prefix.size(), checksum_prefix) != 0) {
 								if (footer_values.find(tuple.first) == footer_values.end())
 									footer_values[tuple.first] = tuple.second;
 								else
@@ -201,14 +204,7 @@ void Shuffle::shuffle(string input, string output) {
 				size = file_size;
 				// Copy section (except the chaining part)
 				// Read from input and write into output
-				while (size > 0) {
-					size_t size_to_copy = size > buffer_size ? buffer_size : size;
-
-					infile.read(buffer, size_to_copy);
-					outfile.write(buffer, size_to_copy);
-
-					size -= size_to_copy;
-				}
+				copier.copy(&infile, &outfile, size);
 				// Jump over the last value of infile
 				infile.jump(8);
 				// Chain the section and save its position
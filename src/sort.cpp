@@ -3,6 +3,9 @@
 #include <algorithm>
 
 #include "sort.hpp"
+#include "fileio.hpp"
+#include "checksum.hpp"
+#include "sectionreader.hpp"
 
 
 using namespace std;
@@ -25,15 +28,17 @@ void Sort::cli_prepare(CLI::App * app) {
 // the code of this function is largely inspired by merge.cpp
 void Sort::sort(string input, string output) {
 	// Useful variables
-	const long buffer_size = 1048576; // 1 MB
-	uint8_t buffer[1048576];
 	uint8_t global_encoding[4];
 
 	// Read the encoding of the input file and push it as output encoding 
-	Kff_file infile_enc(input, "r");
+	KffSectionReader * reader = open_kff_reader(input);
+	KffSectionReader & infile = *reader;
+	if (not infile.is_open()) {
+		cerr << input << " is too small to be a kff file" << endl;
+		exit(1);
+	}
 	for (uint i=0 ; i<4 ; i++)
-		global_encoding[i] = infile_enc.encoding[i];
-    infile_enc.close();
+		global_encoding[i] = infile.encoding[i];
 
 	// Write header of the output
 	Kff_file outfile(output, "w");
@@ -54,26 +59,26 @@ void Sort::sort(string input, string output) {
 	// Footers
 	map<string, uint64_t> footer_values;
 
-	    Kff_file infile(input, "r");
-
-		// NB: Automatic jump over metadata due to API
+	try {
+		// NB: The reader is already after the metadata
 		// Read section by section
-		char section_type = infile.read_section_type();
-		while(infile.tellp() != infile.end_position) {
+		while(infile.position < infile.end_position) {
+			char section_type = infile.read_section_type();
 			vector<string> to_copy;
-			long size;
 
 			switch (section_type) {
 				// Write the variables that change from previous sections (possibly sections from other input files)
 				case 'v':
 				{
 					// Read the values
-					Section_GV in_sgv(&infile);
+					map<string, uint64_t> vars = infile.read_gv();
 
 					// Discard footers
-					if (in_sgv.vars.find("footer_size") != in_sgv.vars.end()) {
-						for (auto& tuple : in_sgv.vars) {
-							if (tuple.first != "footer_size" and tuple.first != "first_index") {
+					if (vars.find("footer_size") != vars.end()) {
+						for (auto& tuple : vars) {
+							// The section checksums are not valid anymore in the rewritten file
+							if (tuple.first != "footer_size" and tuple.first != "first_index"
+							    and tuple.first.compare(0, checksum_prefix.size(), checksum_prefix) != 0) {
 								if (footer_values.find(tuple.first) == footer_values.end())
 									footer_values[tuple.first] = tuple.second;
 								else
@@ -85,7 +90,7 @@ void Sort::sort(string input, string output) {
 					}
 
 					// Verify the presence and value of each variable in output
-					for (auto& tuple : in_sgv.vars) {
+					for (auto& tuple : vars) {
 						if (outfile.global_vars.find(tuple.first) == outfile.global_vars.end()
 								or outfile.global_vars[tuple.first] != tuple.second)
 							to_copy.push_back(tuple.first);
@@ -110,27 +115,25 @@ void Sort::sort(string input, string output) {
                     uint max = infile.global_vars["max"];
                     uint data_size = infile.global_vars["data_size"];
                     uint max_nucl = k + max - 1;
-                    uint8_t * seq_bytes = new uint8_t[max_nucl / 4 + 1];
-                    uint8_t * data_bytes = new uint8_t[data_size * max];
                     cerr << "new 'r' section found" << endl;
                     cerr << "Max sequence size: " << max_nucl << " data size: " << data_size<< endl;
 
                     vector<pair<vector<uint8_t>,vector<uint8_t>>> everything;
 
                     // Open sections
-                    Section_Raw in_section(&infile);
+                    infile.open_block_section();
                     Section_Raw out_section(&outfile);
 
                     // Read whole block and store everything inside a vector
-                    for (uint i=0 ; i<in_section.nb_blocks ; i++) {
-                        // Read the block.
-                        string seq;
-                        int nb_kmers = in_section.read_compacted_sequence(seq_bytes, data_bytes);
-                        int seq_len = k + nb_kmers - 1;
+                    KffBlock block;
+                    while (infile.next_block(block)) {
+                        // Copy the block out of the reader
+                        int nb_kmers = block.nb_kmers;
+                        int seq_len = block.seq_size;
                         //cerr << "Read seq of length: " << seq_len << " data size: " << data_size*nb_kmers << endl;
-                        vector<uint8_t> seq_vec(&seq_bytes[0],&seq_bytes[seq_len/4+1]);
+                        vector<uint8_t> seq_vec(block.seq, block.seq + (seq_len + 3) / 4);
                         if (data_size > 0) {
-	                        vector<uint8_t> data_vec(&data_bytes[0],&data_bytes[data_size*nb_kmers]);
+	                        vector<uint8_t> data_vec(block.data, block.data + data_size * nb_kmers);
 	                        everything.push_back(make_pair(seq_vec,data_vec));
 	                    } else if (nb_kmers < 256) {
 	                    	vector<uint8_t> data_vec(1, (uint8_t)nb_kmers);
@@ -160,12 +163,8 @@ void Sort::sort(string input, string output) {
                                 k + nb_kmers - 1,
                                 elt.second.data());
                     }
-                    in_section.close();
                     out_section.close();
 
-                    delete[] seq_bytes;
-                    delete[] data_bytes;
-
                     break;
                 }
 
@@ -208,26 +207,16 @@ void Sort::sort(string input, string output) {
                 // nb: is probably overkill code here, taken from disjoin.cpp, could be simplified as we're processing just 1 file
                 case 'i': {
 				// read section and compute its size
-				Section_Index si(&infile);
-				si.close();
-				long file_size = infile.tellp() - si.beginning - 8l;
-				infile.jump(-file_size - 8);
+				long beginning = infile.position;
+				int64_t next_index;
+				infile.read_index(next_index);
+				long file_size = infile.position - beginning - 8l;
 
 				// Save the position in the file for later chaining
 				long i_position = outfile.tellp();
-				size = file_size;
 				// Copy section (except the chaining part)
 				// Read from input and write into output
-				while (size > 0) {
-					size_t size_to_copy = size > buffer_size ? buffer_size : size;
-
-					infile.read(buffer, size_to_copy);
-					outfile.write(buffer, size_to_copy);
-
-					size -= size_to_copy;
-				}
-				// Jump over the last value of infile
-				infile.jump(8);
+				outfile.write(infile.read_bytes(beginning, file_size), file_size);
 				// Chain the section and save its position
 				long i_relative = last_index - (i_position + file_size + 8l);
 				for (uint i=0 ; i<8 ; i++) {
@@ -242,12 +231,13 @@ void Sort::sort(string input, string output) {
 					cerr << "Unsupported section type " << section_type << " in file " << input << endl;
 					exit(2);
 			}
-
-			// Prepare next section
-			section_type = infile.read_section_type();
 		}
+	} catch (const char * msg) {
+		cerr << msg << endl;
+		exit(1);
+	}
 
-		infile.close();
+	delete reader;
 
 	// Write footer
 	if (last_index != 0) {
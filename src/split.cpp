@@ -1,4 +1,9 @@
+#include <vector>
+#include <algorithm>
+#include "omp.h"
+
 #include "split.hpp"
+#include "fileio.hpp"
 
 
 using namespace std;
@@ -8,6 +13,10 @@ Split::Split() {
 	// Paths
 	this->input_filename = "";
 	this->output_dirname = "./";
+	// Sharding
+	this->nb_shards = 0;
+	this->shard_by = "size";
+	this->threads = 1;
 }
 
 void Split::cli_prepare(CLI::App * app) {
@@ -17,19 +26,158 @@ void Split::cli_prepare(CLI::App * app) {
 	input_option->required();
 	CLI::Option * out_opt = subapp->add_option("-o, --outdir", output_dirname, "Output directory where to put all the subkff files");
 	out_opt->check(CLI::ExistingDirectory);
+	subapp->add_option("-n, --shards", nb_shards, "Split the file into n shard files of similar size instead of one file per section.");
+	CLI::Option * by_opt = subapp->add_option("--shard-by", shard_by, "How the sections are assigned to the shards: size (balance the cumulative byte sizes) or hash (hash of the section minimizer, stable between files) (default size).");
+	by_opt->check(CLI::IsMember({"size", "hash"}));
+	subapp->add_option("-t, --threads", threads, "Number of shards written in parallel (default 1).");
+}
+
+/** A sequence section of the input file and the variables needed to read it
+ **/
+struct ShardSection {
+	char type;
+	long position;
+	long size;
+	uint vars_idx;
+	uint64_t hash;
+};
+
+
+void Split::shard() {
+	// --- Scan the section boundaries ---
+	Kff_file input_file(input_filename, "r");
+	uint8_t * input_metadata = new uint8_t[input_file.metadata_size];
+	input_file.read_metadata(input_metadata);
+
+	vector<unordered_map<string, uint64_t> > var_states;
+	var_states.push_back(input_file.global_vars);
+	vector<ShardSection> sections;
+
+	uint64_t section_idx = 0;
+	char section_type = input_file.read_section_type();
+	while (input_file.tellp() != input_file.end_position) {
+		if (section_type == 'v') {
+			Section_GV sgv(&input_file);
+			sgv.close();
+			// Footer values are not propagated
+			if (sgv.vars.find("footer_size") == sgv.vars.end())
+				var_states.push_back(input_file.global_vars);
+		} else if (section_type == 'i') {
+			Section_Index si(&input_file);
+			si.close();
+		} else {
+			long begin_byte = input_file.tellp();
+			if (not input_file.jump_next_section()) {
+				cerr << "Error inside of the input file." << endl;
+				cerr << "Impossible to jump over the section " << section_type << endl;
+				exit(1);
+			}
+			long end_byte = input_file.tellp();
+
+			// Hash the minimizer (or the section index for raw sections)
+			uint64_t hash = 0xcbf29ce484222325;
+			if (section_type == 'm') {
+				uint64_t mini_bytes = (input_file.global_vars["m"] + 3) / 4;
+				uint8_t * minimizer = new uint8_t[mini_bytes];
+				input_file.jump_to(begin_byte + 1);
+				input_file.read(minimizer, mini_bytes);
+				input_file.jump_to(end_byte);
+				for (uint64_t b=0 ; b<mini_bytes ; b++)
+					hash = (hash ^ minimizer[b]) * 0x100000001b3;
+				delete[] minimizer;
+			} else
+				hash = (hash ^ section_idx) * 0x100000001b3;
+
+			sections.push_back({section_type, begin_byte, end_byte - begin_byte, (uint)var_states.size() - 1, hash});
+			section_idx += 1;
+		}
+		section_type = input_file.read_section_type();
+	}
+
+	// --- Assign the sections to the shards ---
+	vector<vector<uint64_t> > shards(this->nb_shards);
+	if (this->shard_by == "hash") {
+		for (uint64_t idx=0 ; idx<sections.size() ; idx++)
+			shards[sections[idx].hash % this->nb_shards].push_back(idx);
+	} else {
+		// Largest sections first, each one into the smallest shard
+		vector<uint64_t> order(sections.size());
+		for (uint64_t idx=0 ; idx<order.size() ; idx++)
+			order[idx] = idx;
+		std::sort(order.begin(), order.end(), [&sections](uint64_t a, uint64_t b) {
+			return sections[a].size > sections[b].size;
+		});
+
+		vector<long> shard_sizes(this->nb_shards, 0);
+		for (uint64_t idx : order) {
+			uint smallest = min_element(shard_sizes.begin(), shard_sizes.end()) - shard_sizes.begin();
+			shards[smallest].push_back(idx);
+			shard_sizes[smallest] += sections[idx].size;
+		}
+		// Restore the file order inside of each shard
+		for (auto & shard : shards)
+			std::sort(shard.begin(), shard.end());
+	}
+
+	// --- Write the shards ---
+	#pragma omp parallel for num_threads(this->threads) schedule(dynamic)
+	for (uint shard_idx=0 ; shard_idx<this->nb_shards ; shard_idx++) {
+		// Each thread reads the input with its own file
+		Kff_file infile(input_filename, "r");
+		SectionCopier copier;
+
+		stringstream ss;
+		ss << output_dirname << "shard_" << shard_idx << ".kff";
+		Kff_file output_file(ss.str(), "w");
+		output_file.set_indexation(true);
+		output_file.write_encoding(infile.encoding);
+		output_file.set_uniqueness(infile.uniqueness);
+		output_file.set_canonicity(infile.canonicity);
+		output_file.write_metadata(infile.metadata_size, input_metadata);
+
+		int current_vars = -1;
+		for (uint64_t idx : shards[shard_idx]) {
+			const ShardSection & section = sections[idx];
+
+			// Write the variables if they changed since the previous section of the shard
+			if ((int)section.vars_idx != current_vars) {
+				Section_GV sgv(&output_file);
+				for (const auto & pair : var_states[section.vars_idx])
+					sgv.write_var(pair.first, pair.second);
+				sgv.close();
+				current_vars = section.vars_idx;
+			}
+
+			// Copy the section
+			output_file.register_position(section.type);
+			infile.jump_to(section.position);
+			copier.copy(&infile, &output_file, section.size);
+		}
+
+		output_file.close();
+		infile.close();
+	}
+
+	delete[] input_metadata;
+	input_file.close();
 }
 
+
 void Split::exec() {
 	// IO Prepare
 	if (output_dirname[output_dirname.length()-1] != '/')
 		output_dirname += "/";
 
+	if (this->nb_shards > 0) {
+		this->shard();
+		return;
+	}
+
 	Kff_file input_file(input_filename, "r");
 	uint8_t * input_metadata = new uint8_t[input_file.metadata_size];
 	input_file.read_metadata(input_metadata);
 
-	long buffer_size = 1048576; // 1 MB
-	uint8_t buffer[1048576];
+	SectionCopier copier;
 
 	uint idx = 0;
 	char section_type = input_file.read_section_type();
@@ -77,14 +225,7 @@ void Split::exec() {
 			input_file.jump(-size);
 
 			// Read from input and write into output
-			while (size > 0) {
-				size_t to_copy = size > buffer_size ? buffer_size : size;
-
-				input_file.read(buffer, to_copy);
-				output_file.write(buffer, to_copy);
-
-				size -= to_copy;
-			}
+			copier.copy(&input_file, &output_file, size);
 
 			output_file.close();
 			idx += 1;
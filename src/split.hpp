@@ -14,6 +14,17 @@ private:
 	std::string input_filename;
 	std::string output_dirname;
 
+	uint nb_shards;
+	std::string shard_by;
+	uint threads;
+
+	/** Split the input file into nb_shards files of similar size. Each sequence section is assigned
+	 * to a shard, either balancing the cumulative byte sizes of the shards (largest sections first,
+	 * each one in the smallest shard), or hashing the section minimizer. Inside of a shard, the
+	 * sections keep the input order.
+	 **/
+	void shard();
+
 public:
 	Split();
 	void cli_prepare(CLI::App * subapp);
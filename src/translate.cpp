@@ -1,8 +1,16 @@
 #include <vector>
 #include <string>
+#include <cstring>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "translate.hpp"
 #include "encoding.hpp"
+#include "fileio.hpp"
+#include "mapreader.hpp"
+#include "checksum.hpp"
 
 
 using namespace std;
@@ -12,6 +20,9 @@ Translate::Translate() {
 	input_filename = "";
 	output_filename = "";
 	encoding_str = "";
+	checksum = false;
+	in_place = false;
+	threads = 1;
 }
 
 
@@ -36,12 +47,15 @@ void Translate::cli_prepare(CLI::App * app) {
 	input_option->required();
 	input_option->check(CLI::ExistingFile);
 
-	CLI::Option * out_option = subapp->add_option("-o, --outfile", output_filename, "Translated output file.");
-	out_option->required();
+	subapp->add_option("-o, --outfile", output_filename, "Translated output file. Optional with --in-place.");
 
 	CLI::Option * encoding = subapp->add_option("-e, --encoding", encoding_str, "A 4 letter string representing the encoding. For example AGTC represent the encoding where A=0, C=3, G=1, T=2.");
 	encoding->required();
 	encoding->check(EncodingValidator());
+
+	subapp->add_flag("--checksum", checksum, "Store a CRC32C checksum of each section in the footer of the output. The checksums are verified by validate.");
+	subapp->add_flag("--in-place", in_place, "Translate the bytes directly inside of a memory mapping, without rewriting the file structure. Without -o, the input file itself is modified. With -o, the input is first copied into the output.");
+	subapp->add_option("-t, --threads", threads, "Number of threads translating sections at once with --in-place (default 1).");
 }
 
 void Translate::exec() {
@@ -65,11 +79,38 @@ void Translate::exec() {
 		}
 	}
 
-	const long buffer_size = 1048576; // 1 MB
-	uint8_t buffer[1048576];
+	if (this->in_place) {
+		string filename = this->input_filename;
+		// Copy then translate the copy
+		if (this->output_filename != "" and this->output_filename != this->input_filename) {
+			filename = this->output_filename;
+			int in_fd = ::open(this->input_filename.c_str(), O_RDONLY);
+			int out_fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			struct stat st;
+			if (in_fd < 0 or out_fd < 0 or fstat(in_fd, &st) != 0) {
+				cerr << "Impossible to copy " << this->input_filename << " into " << filename << endl;
+				exit(1);
+			}
+			copy_range(in_fd, 0, out_fd, 0, st.st_size);
+			::close(in_fd);
+			::close(out_fd);
+		}
+
+		this->translate_mapped(filename, dest_encoding);
+		return;
+	}
+	if (this->output_filename == "") {
+		cerr << "An output file is required (-o) when the translation is not in place" << endl;
+		exit(1);
+	}
 
 	// Read the encoding and prepare the translator
-	Kff_file infile(input_filename, "r");
+	KffSectionReader * reader = open_kff_reader(input_filename);
+	KffSectionReader & infile = *reader;
+	if (not infile.is_open()) {
+		cerr << input_filename << " is too small to be a kff file" << endl;
+		exit(1);
+	}
 	Translator translator(infile.encoding, dest_encoding);
 
 	// Write header of the output
@@ -82,124 +123,183 @@ void Translate::exec() {
 		dest_encoding[3]
 	);
 	// Set metadata
-	uint8_t * metadata = new uint8_t[infile.metadata_size];
-	infile.read_metadata(metadata);
-	outfile.write_metadata(infile.metadata_size, metadata);
-	delete[] metadata;
+	outfile.write_metadata(infile.metadata_size, infile.metadata);
 
-	// Prepare sequence and data buffers
+	// Prepare the sequence buffer (the sequences are translated out of the reader)
 	uint8_t * nucleotides = new uint8_t[1];
-	uint8_t * data = new uint8_t[1];
+	vector<uint8_t> minimizer;
 
 	// Read and write section per section
-	char section_type = infile.read_section_type();
-	while (infile.tellp() != infile.end_position) {
-		// Read variables
-		if (section_type == 'v') {
-			// Load variables
-			Section_GV isgv(&infile);
-			Section_GV osgv(&outfile);
-
-			bool nucl_buffer_changed = false;
-			bool data_buffer_changed = false;
-			for (auto var_tuple : isgv.vars) {
-				osgv.write_var(var_tuple.first, var_tuple.second);
-
-				if (var_tuple.first == "k" or var_tuple.first == "max")
-					nucl_buffer_changed = true;
-				if (var_tuple.first == "data_size" or var_tuple.first == "max")
-					data_buffer_changed = true;
+	try {
+		while (infile.position < infile.end_position) {
+			char section_type = infile.read_section_type();
+			// Read variables
+			if (section_type == 'v') {
+				// Load variables
+				map<string, uint64_t> vars = infile.read_gv();
+				Section_GV osgv(&outfile);
+
+				bool nucl_buffer_changed = false;
+				for (auto var_tuple : vars) {
+					// The checksums of the input sections are not valid anymore
+					if (var_tuple.first.compare(0, checksum_prefix.size(), checksum_prefix) == 0)
+						continue;
+					osgv.write_var(var_tuple.first, var_tuple.second);
+
+					if (var_tuple.first == "k" or var_tuple.first == "max")
+						nucl_buffer_changed = true;
+				}
+				osgv.close();
+
+				// Buffer updates
+				if (nucl_buffer_changed) {
+					delete[] nucleotides;
+					uint max_nucl = outfile.global_vars["k"] + outfile.global_vars["max"] - 1;
+					nucleotides = new uint8_t[max_nucl / 4 + 1];
+				}
 			}
-			isgv.close();
-			osgv.close();
-
-			// Buffer updates
-			if (nucl_buffer_changed) {
-				delete[] nucleotides;
-				uint max_nucl = outfile.global_vars["k"] + outfile.global_vars["max"] - 1;
-				nucleotides = new uint8_t[max_nucl / 4 + 1];
+			// Pure copy
+			else if (section_type == 'i') {
+				// Read the section
+				long beginning = infile.position;
+				int64_t next_index;
+				infile.read_index(next_index);
+				// copy
+				long size = infile.position - beginning;
+				outfile.write(infile.read_bytes(beginning, size), size);
 			}
-			if (data_buffer_changed) {
-				delete[] data;
-				uint nb_data = outfile.global_vars["max"];
-				data = new uint8_t[nb_data * outfile.global_vars["data_size"]];
+			// translate a raw block
+			else if (section_type == 'r') {
+				// Open sections
+				infile.open_block_section();
+				Section_Raw out_section(&outfile);
+
+				// Translate block per block
+				KffBlock block;
+				while (infile.next_block(block)) {
+					uint size = (block.seq_size + 3) / 4;
+					memcpy(nucleotides, block.seq, size);
+					translator.translate(nucleotides, size);
+					out_section.write_compacted_sequence(nucleotides, block.seq_size, const_cast<uint8_t *>(block.data));
+				}
+
+				out_section.close();
 			}
-		}
-		// Pure copy
-		else if (section_type == 'i') {
-			// Read the section
-			Section_Index si(&infile);
-			si.close();
-			// Compute size and go back to start
-			long size = infile.tellp() - si.beginning;
-			infile.jump(-size);
-			// copy
-			while (size > 0) {
-				size_t size_to_copy = size > buffer_size ? buffer_size : size;
-
-				infile.read(buffer, size_to_copy);
-				outfile.write(buffer, size_to_copy);
-
-				size -= size_to_copy;
+			// Translate a minimizer block
+			else if (section_type == 'm') {
+				// Open sections
+				infile.open_block_section();
+				Section_Minimizer out_section(&outfile);
+
+				// translate and write the minimizer
+				uint size = (infile.m + 3) / 4;
+				minimizer.assign(infile.minimizer, infile.minimizer + size);
+				translator.translate(minimizer.data(), size);
+				out_section.write_minimizer(minimizer.data());
+
+				// Translate block per block
+				KffBlock block;
+				while (infile.next_block(block)) {
+					// Translate
+					uint byte_size = (block.seq_size + 3) / 4;
+					memcpy(nucleotides, block.seq, byte_size);
+					translator.translate(nucleotides, byte_size);
+					// Write
+					out_section.write_compacted_sequence_without_mini(nucleotides, block.seq_size, block.mini_pos, const_cast<uint8_t *>(block.data));
+				}
+
+				out_section.close();
+			} else {
+				cerr << infile.position << ": Unknown section " << section_type << endl;
+				exit(1);
 			}
 		}
-		// translate a raw block
-		else if (section_type == 'r') {
-			// Open sections
-			Section_Raw in_section(&infile);
-			Section_Raw out_section(&outfile);
-
-			// Translate block per block
-			uint64_t k = outfile.global_vars["k"];
-			for (uint i=0 ; i<in_section.nb_blocks ; i++) {
-				uint nb_kmers = in_section.read_compacted_sequence(nucleotides, data);
-				uint size = k + nb_kmers - 1;
-				size = size % 4 == 0 ? size / 4 : size / 4 + 1;
-				translator.translate(nucleotides, size);
-				out_section.write_compacted_sequence(nucleotides, k + nb_kmers - 1, data);
-			}
+	} catch (const char * msg) {
+		cerr << "Impossible to translate " << input_filename << ": " << msg << endl;
+		exit(1);
+	}
 
-			in_section.close();
-			out_section.close();
+	delete[] nucleotides;
+	delete reader;
+	outfile.close();
+
+	if (this->checksum)
+		add_section_checksums(output_filename);
+}
+
+
+void Translate::translate_mapped(const string & filename, uint8_t dest_encoding[4]) {
+	bool had_checksums = false;
+	{
+		MappedFile mapping(filename, true);
+		MappedKffReader planner(mapping);
+		if (not planner.is_open()) {
+			cerr << "Impossible to map " << filename << " in write mode." << endl;
+			exit(1);
 		}
-		// Translate a minimizer block
-		else if (section_type == 'm') {
-			// Open sections
-			Section_Minimizer in_section(&infile);
-			Section_Minimizer out_section(&outfile);
-
-			// translate and write the minimizer
-			uint k = outfile.global_vars["k"];
-			uint m = outfile.global_vars["m"];
-			uint size = m % 4 == 0 ? m / 4 : m / 4 + 1;
-			translator.translate(in_section.minimizer, size);
-			out_section.write_minimizer(in_section.minimizer);
-
-			// Translate block per block
-			for (uint i=0 ; i<in_section.nb_blocks ; i++) {
-				// Read
-				uint64_t mini_pos;
-				uint nb_kmers = in_section.read_compacted_sequence_without_mini(nucleotides, data, mini_pos);
-				// Translate
-				uint nucl_size = k - m + nb_kmers - 1;
-				uint byte_size = nucl_size % 4 == 0 ? nucl_size / 4 : nucl_size / 4 + 1;
-				translator.translate(nucleotides, byte_size);
-				// Write
-				out_section.write_compacted_sequence_without_mini(nucleotides, nucl_size, mini_pos, data);
-			}
+		Translator translator(planner.encoding, dest_encoding);
 
-			in_section.close();
-			out_section.close();
-		} else {
-			cerr << infile.tellp() << ": Unknown section " << section_type << endl;
+		// The footer is not translated
+		long header_end = planner.position;
+		long footer_position = planner.footer_position();
+		long tail_position = footer_position == 0 ? planner.end_position : footer_position;
+		if (footer_position != 0) {
+			planner.jump_to(footer_position);
+			had_checksums = section_checksums(planner.read_gv()).size() > 0;
+			planner.jump_to(header_end);
+		}
+
+		// Block sections positions and the variables defined before each of them
+		vector<pair<long, uint> > sections;
+		vector<unordered_map<string, uint64_t> > var_states;
+		var_states.push_back(planner.global_vars);
+		try {
+			while (planner.position < tail_position) {
+				char section_type = planner.read_section_type();
+				if (section_type == 'v') {
+					planner.read_gv();
+					var_states.push_back(planner.global_vars);
+				} else if (section_type == 'i') {
+					int64_t next_index;
+					planner.read_index(next_index);
+				} else if (section_type == 'r' or section_type == 'm') {
+					sections.emplace_back(planner.position, var_states.size() - 1);
+					planner.open_block_section();
+					planner.skip_blocks();
+				} else {
+					cerr << planner.position << ": Unknown section " << section_type << endl;
+					exit(1);
+				}
+			}
+		} catch (const char * msg) {
+			cerr << "Impossible to translate " << filename << ": " << msg << endl;
 			exit(1);
 		}
 
-		section_type = infile.read_section_type();
+		// Translation of the sequences and minimizers, section per section
+		#pragma omp parallel for num_threads(this->threads) schedule(dynamic)
+		for (uint64_t s_idx=0 ; s_idx<sections.size() ; s_idx++) {
+			// Each thread has its own cursor over the shared mapping
+			MappedKffReader reader(mapping);
+			reader.global_vars = var_states[sections[s_idx].second];
+			reader.jump_to(sections[s_idx].first);
+			reader.open_block_section();
+
+			if (reader.section_type == 'm')
+				translator.translate(mapping.data + (reader.minimizer - reader.data()), (reader.m + 3) / 4);
+			KffBlock block;
+			while (reader.next_block(block))
+				translator.translate(mapping.data + (block.seq - reader.data()), (block.seq_size + 3) / 4);
+		}
+
+		// Header encoding: 2 bits per nucleotide in the order A, C, G, T
+		uint8_t code = 0;
+		for (uint i=0 ; i<4 ; i++)
+			code = (code << 2) | (dest_encoding[i] & 0b11);
+		mapping.data[5] = code;
 	}
 
-	delete[] nucleotides;
-	delete[] data;
-	infile.close();
-	outfile.close();
+	// The previous checksums are not valid anymore
+	if (this->checksum or had_checksums)
+		add_section_checksums(filename, this->threads);
 }
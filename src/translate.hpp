@@ -14,6 +14,15 @@ private:
 	std::string input_filename;
 	std::string output_filename;
 	std::string encoding_str;
+	bool checksum;
+	bool in_place;
+	uint threads;
+
+	/** Translate a kff file directly inside of a writable memory mapping. The file layout does not
+	 * change: only the sequence and minimizer Bytes are translated (data skipped) and the encoding
+	 * of the header is patched. The sections are translated in parallel.
+	 **/
+	void translate_mapped(const std::string & filename, uint8_t dest_encoding[4]);
 
 public:
 	Translate();
@@ -1,8 +1,18 @@
 #include <vector>
 #include <string>
+#include <set>
+#include <sstream>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <unistd.h>
+#include "omp.h"
 
 #include "validate.hpp"
 #include "encoding.hpp"
+#include "mapreader.hpp"
+#include "sequences.hpp"
+#include "checksum.hpp"
 
 
 using namespace std;
@@ -12,6 +22,11 @@ using namespace std;
 Validate::Validate() {
 	input_filename = "";
 	verbose = false;
+	threads = 1;
+	deep = false;
+	memory = 1024;
+	tmp_dir = "./";
+	verified_checksums = 0;
 }
 
 void Validate::cli_prepare(CLI::App * app) {
@@ -21,244 +36,681 @@ void Validate::cli_prepare(CLI::App * app) {
 	input_option->check(CLI::ExistingFile);
 
 	subapp->add_flag("-v, --verbose", verbose, "Print all the validation process instead of only unexpected values.");
+	subapp->add_flag("-d, --deep", deep, "Also verify the uniqueness and canonicity flags of the header by looking at all the kmers. A kmer must not appear twice in a unique file and a kmer and its reverse complement must not both appear in a canonical file.");
+	subapp->add_option("--memory", memory, "Memory available for the deep validation, in MB. Over this limit, the kmers are partitioned on disk (default 1024).");
+	subapp->add_option("--tmp-dir", tmp_dir, "Directory for the deep validation partitions (default ./).");
+	subapp->add_option("-t, --threads", threads, "Number of threads validating sections at once. The section boundaries are taken from the file index when there is one, otherwise from a fast scan of the block headers (default 1).");
 }
 
-void Validate::exec() {
-	try {
-		Kff_file infile(input_filename, "r");
-		Stringifyer strif(infile.encoding);
+bool Validate::validate_section(KffSectionReader & infile, const Stringifyer & strif, bool & checksum_verified, ostream & out, ostream & err) {
+	checksum_verified = false;
+	char section_type = infile.read_section_type();
+	if (verbose)
+		out << "=== Section " << section_type << " ===" << endl;
 
-		if (verbose) {
-			cout << "=== Header ===" << endl;
-			// Important values
-			cout << "-> KFF file version " << (uint)infile.major_version << "." << (uint)infile.minor_version << endl;
-			cout << "-> Encoding: A=" << (uint)infile.encoding[0] << " C=" << (uint)infile.encoding[1] << " G=" << (uint)infile.encoding[2] << " T=" << (uint)infile.encoding[3] << endl;
-			cout << "-> Uniqueness: " << (uint)infile.uniqueness << endl;
-			cout << "-> Canonicity: " << (uint)infile.canonicity << endl;
+	try {
+		// Global variable section
+		if (section_type == 'v') {
+			long beginning = infile.position;
+			map<string, uint64_t> vars = infile.read_gv();
+
+			if (verbose) {
+				out << "Start Byte " << beginning << endl;
+				out << "-> " << vars.size() << " variables" << endl;
+				for (auto tuple : vars) {
+					out << tuple.first << " = " << tuple.second << endl;
+				}
+			}
+		}
+		// Index section
+		else if (section_type == 'i') {
+			long beginning = infile.position;
+			int64_t next_index;
+			map<int64_t, char> index = infile.read_index(next_index);
+			long end_byte = beginning + 17 + 9 * index.size();
+
+			if (this->verbose) {
+				out << "Start Byte " << beginning << endl;
+				out << "Section\trelative\tabsolute" << endl;
+			}
 
+			for (const auto & pair : index) {
+				if (this->verbose)
+					out << pair.second << "\t" << pair.first << "\t" << (end_byte + pair.first) << endl;
 
-			// Metadata
-			cout << "-> Metadata (" << ((uint)infile.metadata_size) << "B)" << endl;
-			uint8_t * metadata = new uint8_t[infile.metadata_size];
-			infile.read_metadata(metadata);
-			for (uint i=0 ; i<infile.metadata_size ; i++) {
-				cout << (uint)metadata[i] << "\t";
-				if (i % 16 == 15)
-					cout << endl;
+				// Read the byte at the section position
+				long section_pos = end_byte + pair.first;
+				uint8_t type = section_pos >= 0 and section_pos < infile.end_position ? *infile.read_bytes(section_pos, 1) : 0;
+				if (type != pair.second) {
+					err << "Wrong section at position " << section_pos << ". Found a section " << type << endl;
+					return false;
+				}
 			}
-			if (infile.metadata_size % 16 != 0)
-				cout << endl;
-			delete[] metadata;
 
-			cout << endl;
+			if (this->verbose) {
+				out << "Next index position " << next_index << endl;
+			}
+			
+			if (next_index != 0) {
+				// Read the byte at the index position
+				long section_pos = end_byte + next_index;
+				uint8_t type = section_pos >= 0 and section_pos < infile.end_position ? *infile.read_bytes(section_pos, 1) : 0;
+				if (type != 'i') {
+					err << end_byte << " " << next_index << endl;
+					err << "No index found at position " << section_pos << "." << endl;
+					return false;
+				}
+			}
 		}
+		// Raw sequence section
+		else if (section_type == 'r') {
+			infile.open_block_section();
 
-		char section_type = infile.read_section_type();
-		while(infile.tellp() < infile.end_position) {
-			if (verbose)
-				cout << "=== Section " << section_type << " ===" << endl;
+			uint k = infile.k;
+			uint data_size = infile.data_size;
 
-			// Global variable section
-			if (section_type == 'v') {
-				Section_GV sgv(&infile);
+			if (verbose) {
+				out << "Start Byte " << infile.section_beginning << endl;
+				out << "-> Number of blocks: " << infile.nb_blocks << endl;
+			}
+
+			KffBlock block;
+			while (infile.next_block(block)) {
+				uint nb_kmers = block.nb_kmers;
+
+				if (nb_kmers == 0) {
+					err << "Block containing 0 kmer detected." << endl;
+					return false;
+				}
 
 				if (verbose) {
-					cout << "Start Byte " << sgv.beginning << endl;
-					cout << "-> " << sgv.nb_vars << " variables" << endl;
-					for (auto tuple : sgv.vars) {
-						cout << tuple.first << " = " << tuple.second << endl;
+					out << "* Number of kmers: " << nb_kmers << endl;
+					out << strif.translate(block.seq, k + nb_kmers - 1) << endl;
+
+					if (data_size != 0) {
+						out << "data array: ";
+						for (uint i_data=0 ; i_data<nb_kmers ; i_data++) {
+							if (i_data > 0)
+								out << ",\t";
+
+							out << "[";
+							for (uint b_idx=0 ; b_idx<data_size ; b_idx++) {
+								if (b_idx > 0)
+									out << "\t";
+								out << (uint)block.data[data_size*i_data+b_idx];
+							}
+							out << "]";
+						}
+						out << endl;
 					}
 				}
+			}
 
-				sgv.close();
+			if (not this->verify_checksum(infile, checksum_verified, out, err))
+				return false;
+		}
+		// Minimizer sequence section
+		else if (section_type == 'm') {
+			infile.open_block_section();
+
+			uint k = infile.k;
+			uint m = infile.m;
+			uint data_size = infile.data_size;
+
+			if (verbose) {
+				out << "Start Byte " << infile.section_beginning << endl;
+				out << "-> Minimizer: " << strif.translate(infile.minimizer, m) << endl;
+				out << "-> Number of blocks: " << infile.nb_blocks << endl;
+				out << endl;
 			}
-			// Index section
-			else if (section_type == 'i') {
-				Section_Index si(&infile);
-				long end_byte = si.beginning + 17 + 9 * si.index.size();
-
-				if (this->verbose) {
-					cout << "Start Byte " << si.beginning << endl;
-					cout << "Section\trelative\tabsolute" << endl;
-				}
 
-				for (const auto & pair : si.index) {
-					if (this->verbose)
-						cout << pair.second << "\t" << pair.first << "\t" << (end_byte + pair.first) << endl;
-
-					// Jump to the section
-					long section_pos = end_byte + pair.first;
-					long current_pos = infile.tellp();
-					infile.jump_to(section_pos);
-					// Read the byte at this position
-					uint8_t type = 0;
-					infile.read(&type, 1);
-					if (type != pair.second) {
-						cerr << "Wrong section at position " << section_pos << ". Found a section " << type << endl;
-						exit(1);
-					}
-					// Go back to previous position
-					infile.jump_to(current_pos);
+			KffBlock block;
+			while (infile.next_block(block)) {
+				uint64_t mini_pos = block.mini_pos;
+				uint nb_kmers = block.nb_kmers;
+
+				if (nb_kmers == 0) {
+					err << "Block containing 0 kmer detected." << endl;
+					return false;
 				}
 
-				if (this->verbose) {
-					cout << "Next index position " << si.next_index << endl;
+				if (mini_pos > k - m + nb_kmers) {
+					err << "* minimizer position out of sequence. position=" << mini_pos << " , skmer_size=" <<  (k-m+nb_kmers) << endl;
 				}
-				
-				if (si.next_index != 0) {
-					// Jump to the section
-					long section_pos = end_byte + si.next_index;
-					long current_pos = infile.tellp();
-					infile.jump_to(section_pos);
-					// Read the byte at this position
-					uint8_t type = 0;
-					infile.read(&type, 1);
-					if (type != 'i') {
-						cerr << end_byte << " " << si.next_index << endl;
-						cerr << "No index found at position " << section_pos << "." << endl;
-						exit(1);
+
+				if (verbose) {
+					out << "* minimizer position: " << mini_pos << "\tNumber of kmers: " << nb_kmers << endl;
+					string seq = strif.translate(block.seq, k - m + nb_kmers - 1);
+					out << seq.substr(0, mini_pos) << "|" << seq.substr(mini_pos, k - m + nb_kmers - 1 - mini_pos) << endl;
+					if (data_size != 0) {
+						out << "data array: ";
+						for (uint i_data=0 ; i_data<nb_kmers ; i_data++) {
+							out << "[";
+							for (uint b_idx=0 ; b_idx<data_size ; b_idx++) {
+								if (b_idx > 0)
+									out << "\t";
+								out << (uint)block.data[data_size*i_data+b_idx];
+							}
+							out << "],\t";
+						}
+						out << endl;
 					}
-					// Go back to previous position
-					infile.jump_to(current_pos);	
 				}
-
-				si.close();
 			}
-			// Raw sequence section
-			else if (section_type == 'r') {
-				Section_Raw sr(&infile);
 
-				uint k = infile.global_vars["k"];
-				uint max = infile.global_vars["max"];
-				uint data_size = infile.global_vars["data_size"];
+			if (not this->verify_checksum(infile, checksum_verified, out, err))
+				return false;
+		}
+		// Unknown section
+		else {
+			err << "/!\\ Unknown section " << section_type << " (uint value " << (uint)section_type << ")" << endl;
+			return false;
+		}
 
-				if (verbose) {
-					cout << "Start Byte " << sr.beginning << endl;
-					cout << "-> Number of blocks: " << sr.nb_blocks << endl;
-				}
+	} catch (const char* msg) {
+		err << "/!\\ " << msg << endl;
+		return false;
+	}
 
-				uint max_nucl = k + max - 1;
-				uint8_t * seq_bytes = new uint8_t[max_nucl / 4 + 1];
-				uint8_t * data_bytes = new uint8_t[data_size * max];
+	if (verbose)
+		out << endl;
+	return true;
+}
 
-				for (uint64_t i=0 ; i<sr.nb_blocks ; i++) {
-					if (infile.tellp() >= infile.end_position) {
-						cerr << "/!\\ End of the file reached before the end of the section." << endl;
-						exit(1);
-					}
-					uint nb_kmers = sr.read_compacted_sequence(seq_bytes, data_bytes);
 
-					if (nb_kmers == 0) {
-						cerr << "Block containing 0 kmer detected." << endl;
-						exit(1);
-					}
+bool Validate::verify_checksum(const KffSectionReader & infile, bool & verified, ostream & out, ostream & err) {
+	auto it = this->checksums.find(infile.section_beginning);
+	if (it == this->checksums.end())
+		return true;
 
-					if (verbose) {
-						cout << "* Number of kmers: " << nb_kmers << endl;
-						cout << strif.translate(seq_bytes, k + nb_kmers - 1) << endl;
-
-						if (data_size != 0) {
-							cout << "data array: ";
-							for (uint i_data=0 ; i_data<nb_kmers ; i_data++) {
-								if (i_data > 0)
-									cout << ",\t";
-
-								cout << "[";
-								for (uint b_idx=0 ; b_idx<data_size ; b_idx++) {
-									if (b_idx > 0)
-										cout << "\t";
-									cout << (uint)data_bytes[data_size*i_data+b_idx];
-								}
-								cout << "]";
-							}
-							cout << endl;
-						}
-					}
+	// The section is read again by chunks (only the window of the reader is in memory)
+	const long chunk_size = 1 << 20;
+	uint32_t crc = 0;
+	for (long chunk=infile.section_beginning ; chunk<infile.position ; chunk+=chunk_size) {
+		long size = min(chunk_size, infile.position - chunk);
+		crc = crc32c(infile.read_bytes(chunk, size), size, crc);
+	}
+	if (crc != it->second) {
+		err << "/!\\ Checksum mismatch for the section starting at byte " << infile.section_beginning << " (expected " << it->second << ", computed " << crc << ")" << endl;
+		return false;
+	}
+
+	verified = true;
+	if (verbose)
+		out << "-> Checksum verified: " << crc << endl;
+	return true;
+}
+
+
+/** A section to validate, its position and the variables defined before it.
+ **/
+struct ValidationTask {
+	long position;
+	uint vars_idx;
+	// Filled by the validation
+	long end_position;
+	bool valid;
+	bool checksum_verified;
+	string out;
+	string err;
+};
+
+
+set<long> Validate::index_boundaries(const MappedFile & mapping, const KffSectionReader & infile) {
+	set<long> boundaries;
+	MappedKffReader index_reader(mapping);
+
+	long footer_position = infile.footer_position();
+	if (footer_position == 0)
+		return boundaries;
+
+	try {
+		index_reader.jump_to(footer_position);
+		map<string, uint64_t> footer = index_reader.read_gv();
+		if (footer.find("first_index") == footer.end() or footer["first_index"] == 0)
+			return boundaries;
+		boundaries.insert(footer_position);
+
+		// Follow the index chain
+		long index_position = footer["first_index"];
+		while (index_position > 0 and index_position < infile.end_position
+		       and boundaries.find(index_position) == boundaries.end()
+		       and *infile.read_bytes(index_position, 1) == 'i') {
+			boundaries.insert(index_position);
+			index_reader.jump_to(index_position);
+			int64_t next_index;
+			map<int64_t, char> index = index_reader.read_index(next_index);
+			for (const auto & p : index)
+				boundaries.insert(index_reader.position + p.first);
+			index_position = next_index == 0 ? 0 : index_reader.position + next_index;
+		}
+	} catch (const char* msg) {
+		// Unusable index: all the boundaries are found by scanning the blocks
+		boundaries.clear();
+	}
+
+	return boundaries;
+}
+
+
+void Validate::parallel_validation(const MappedFile & mapping, KffSectionReader & infile, const Stringifyer & strif) {
+	set<long> boundaries = this->index_boundaries(mapping, infile);
+
+	// The sections are planned and validated by windows to bound the memory used by the outputs
+	uint window_size = 16 * this->threads;
+	long position = infile.position;
+	unordered_map<string, uint64_t> vars = infile.global_vars;
+	MappedKffReader planner(mapping);
+
+	while (position < infile.end_position) {
+		// --- Split the next part of the file into sections ---
+		planner.global_vars = vars;
+		planner.jump_to(position);
+		vector<unordered_map<string, uint64_t> > var_states;
+		var_states.push_back(vars);
+		vector<ValidationTask> tasks;
+		try {
+			// Every byte before the end is a section to validate (unknown types included)
+			while (tasks.size() < window_size and planner.position < infile.end_position) {
+				char section_type = planner.read_section_type();
+				long section_position = planner.position;
+				tasks.push_back({section_position, (uint)var_states.size() - 1, 0, true, false, "", ""});
+
+				if (section_type == 'v') {
+					planner.read_gv();
+					var_states.push_back(planner.global_vars);
+					continue;
+				} else if (section_type == 'i') {
+					int64_t next_index;
+					planner.read_index(next_index);
+					continue;
+				} else if (section_type != 'r' and section_type != 'm')
+					// Reported by the section validation
+					break;
+
+				// Indexed section: jump to the next known boundary. Otherwise skip the blocks.
+				auto next = boundaries.upper_bound(section_position);
+				if (boundaries.find(section_position) != boundaries.end() and next != boundaries.end())
+					planner.jump_to(*next);
+				else {
+					planner.open_block_section();
+					planner.skip_blocks();
 				}
+			}
+		} catch (const char* msg) {
+			// The last section is truncated. Its validation will report the error.
+		}
+		long planned_end = planner.position;
+
+		// --- Validate the sections ---
+		#pragma omp parallel for num_threads(this->threads) schedule(dynamic)
+		for (uint64_t t=0 ; t<tasks.size() ; t++) {
+			ValidationTask & task = tasks[t];
+			// Each thread has its own cursor over the shared mapping
+			MappedKffReader reader(mapping);
+			reader.global_vars = var_states[task.vars_idx];
+			reader.jump_to(task.position);
+
+			stringstream out, err;
+			task.valid = this->validate_section(reader, strif, task.checksum_verified, out, err);
+			task.end_position = reader.position;
+			task.out = out.str();
+			task.err = err.str();
+		}
+
+		// --- Merge the results in the file order ---
+		position = planned_end;
+		vars = var_states.back();
+		for (uint64_t t=0 ; t<tasks.size() ; t++) {
+			ValidationTask & task = tasks[t];
+			cout << task.out;
+			cerr << task.err;
+			if (not task.valid)
+				exit(1);
+			// Only the committed sections are counted (the end of the window can be validated again)
+			if (task.checksum_verified)
+				this->verified_checksums += 1;
+
+			long next_position = t+1 < tasks.size() ? tasks[t+1].position : planned_end;
+			if (task.end_position == next_position)
+				continue;
+
+			// Sections absent from the index after an indexed section: plan again from its end
+			if (task.end_position < next_position and boundaries.find(task.position) != boundaries.end()) {
+				position = task.end_position;
+				vars = var_states[task.vars_idx];
+				break;
+			}
+
+			cerr << "/!\\ The section starting at byte " << task.position << " ends at byte " << task.end_position << " but the next section starts at byte " << next_position << endl;
+			exit(1);
+		}
+	}
+}
+
+
+/** A kmer breaking the uniqueness or canonicity flag
+ **/
+struct DeepViolation {
+	long offset;
+	long first_offset;
+	bool uniqueness;
+	string kmer;
+};
+
+
+bool Validate::deep_validation(const MappedFile & mapping) {
+	const uint max_reported = 10;
+	MappedKffReader reader(mapping);
+	if (not reader.uniqueness and not reader.canonicity) {
+		cout << "Deep validation: no uniqueness or canonicity flag to verify." << endl;
+		return true;
+	}
 
-				delete[] seq_bytes;
-				delete[] data_bytes;
+	// --- Count the kmers ---
+	uint64_t k = 0;
+	uint64_t nb_kmers = 0;
+	char section_type = reader.read_section_type();
+	while (section_type != 0) {
+		if (section_type == 'v')
+			reader.read_gv();
+		else if (section_type == 'i') {
+			int64_t next_index;
+			reader.read_index(next_index);
+		} else {
+			reader.open_block_section();
+			if (k != 0 and reader.k != k) {
+				cout << "Deep validation skipped: the file contains multiple k values." << endl;
+				return true;
 			}
-			// Minimizer sequence section
-			else if (section_type == 'm') {
-				Section_Minimizer sm(&infile);
+			k = reader.k;
 
-				uint k = infile.global_vars["k"];
-				uint m = infile.global_vars["m"];
-				uint max = infile.global_vars["max"];
-				uint data_size = infile.global_vars["data_size"];
+			KffBlock block;
+			while (reader.next_block(block))
+				nb_kmers += block.nb_kmers;
+		}
+		section_type = reader.read_section_type();
+	}
+	if (nb_kmers == 0) {
+		cout << "Deep validation: no kmer to verify." << endl;
+		return true;
+	}
 
-				if (verbose) {
-					cout << "Start Byte " << sm.beginning << endl;
-					cout << "-> Minimizer: " << strif.translate(sm.minimizer, m) << endl;
-					cout << "-> Number of blocks: " << sm.nb_blocks << endl;
-					cout << endl;
-				}
+	// --- Partition the canonical kmers ---
+	// Record: canonical kmer, orientation (1 forward, 2 reverse), block position
+	uint64_t kmer_bytes = (k + 3) / 4;
+	uint64_t record_size = kmer_bytes + 1 + 8;
+	uint64_t memory_bytes = max(this->memory, (uint64_t)1) * 1048576;
+	// Approximation of the hash table memory per kmer (key, value and node)
+	uint64_t kmer_memory = record_size + kmer_bytes + 64;
+	uint64_t nb_partitions = (nb_kmers * kmer_memory + memory_bytes - 1) / max(memory_bytes, (uint64_t)1);
+	nb_partitions = max(nb_partitions, (uint64_t)1);
+
+	// The buffers of all the partitions share half of the memory (whole records). The partition files
+	// stay open during the distribution and a buffer is appended to its file when full.
+	uint64_t flush_size = max(memory_bytes / 2 / nb_partitions / record_size, (uint64_t)1) * record_size;
+	vector<string> partition_names;
+	vector<ofstream> partition_files;
+	vector<vector<uint8_t> > buffers(nb_partitions);
+	if (nb_partitions > 1)
+		for (uint64_t p=0 ; p<nb_partitions ; p++) {
+			partition_names.push_back(this->tmp_dir + "/kff_deep_" + to_string(getpid()) + "_" + to_string(p) + ".tmp");
+			partition_files.emplace_back(partition_names.back(), ios::binary | ios::trunc);
+			if (not partition_files.back()) {
+				cerr << "/!\\ Impossible to create the deep validation partition " << partition_names.back() << endl;
+				for (uint64_t created=0 ; created<=p ; created++)
+					remove(partition_names[created].c_str());
+				return false;
+			}
+			buffers[p].reserve(flush_size);
+		}
 
-				uint max_nucl = k - m + max - 1;
-				uint8_t * seq_bytes = new uint8_t[max_nucl / 4 + 1];
-				uint8_t * data_bytes = new uint8_t[data_size * max];
+	uint m = k > 10 ? 10 : 0;
+	MinimizerSearcher * searcher = m == 0 ? nullptr : new MinimizerSearcher(k, m, reader.encoding, k, true);
+	RevComp rc(reader.encoding);
+	uint8_t first_mask = k % 4 == 0 ? 0xFF : (1 << (2 * (k % 4))) - 1;
+	uint8_t * seq = new uint8_t[1];
+	uint64_t seq_max = 0;
+	uint8_t * kmer = new uint8_t[kmer_bytes + 1];
+	uint8_t * rc_kmer = new uint8_t[kmer_bytes + 1];
+
+	MappedKffReader kmer_reader(mapping);
+	section_type = kmer_reader.read_section_type();
+	while (section_type != 0) {
+		if (section_type == 'v')
+			kmer_reader.read_gv();
+		else if (section_type == 'i') {
+			int64_t next_index;
+			kmer_reader.read_index(next_index);
+		} else {
+			kmer_reader.open_block_section();
+			if (k + kmer_reader.max > seq_max) {
+				seq_max = k + kmer_reader.max;
+				delete[] seq;
+				seq = new uint8_t[seq_max / 4 + 1];
+			}
 
-				for (uint i=0 ; i<sm.nb_blocks ; i++) {
-					if (infile.tellp() >= infile.end_position) {
-						cerr << "/!\\ End of the file reached before the end of the section." << endl;
-						exit(1);
-					}
-					uint64_t mini_pos;
-					uint nb_kmers = sm.read_compacted_sequence_without_mini(seq_bytes, data_bytes, mini_pos);
+			KffBlock block;
+			long block_position = kmer_reader.position;
+			while (kmer_reader.next_block(block)) {
+				const uint8_t * full_seq = block.seq;
+				uint64_t seq_size = block.seq_size;
+				if (section_type == 'm') {
+					kmer_reader.sequence_with_minimizer(block, seq);
+					full_seq = seq;
+					seq_size += kmer_reader.m;
+				}
 
-					if (nb_kmers == 0) {
-						cerr << "Block containing 0 kmer detected." << endl;
-						exit(1);
+				for (uint64_t kmer_idx=0 ; kmer_idx<block.nb_kmers ; kmer_idx++) {
+					subsequence(full_seq, seq_size, kmer, kmer_idx, kmer_idx + k - 1);
+					kmer[0] &= first_mask;
+					memcpy(rc_kmer, kmer, kmer_bytes);
+					rc.rev_comp(rc_kmer, k);
+
+					// Canonical kmer (palindromes are forward)
+					uint8_t orientation = 1;
+					uint8_t * canonical = kmer;
+					if (memcmp(rc_kmer, kmer, kmer_bytes) < 0) {
+						orientation = 2;
+						canonical = rc_kmer;
 					}
 
-					if (mini_pos > k - m + nb_kmers) {
-						cerr << "* minimizer position out of sequence. position=" << mini_pos << " , skmer_size=" <<  (k-m+nb_kmers) << endl;
+					uint64_t partition = 0;
+					if (nb_partitions > 1) {
+						uint64_t hash;
+						if (searcher != nullptr)
+							hash = searcher->get_skmers(canonical, k)[0].minimizer;
+						else
+							hash = seq_to_uint(canonical, k);
+						partition = ((hash * 0x9E3779B97F4A7C15) >> 32) % nb_partitions;
 					}
 
-					if (verbose) {
-						cout << "* minimizer position: " << mini_pos << "\tNumber of kmers: " << nb_kmers << endl;
-						string seq = strif.translate(seq_bytes, k - m + nb_kmers - 1);
-						cout << seq.substr(0, mini_pos) << "|" << seq.substr(mini_pos, k - m + nb_kmers - 1 - mini_pos) << endl;
-						if (data_size != 0) {
-							cout << "data array: ";
-							for (uint i_data=0 ; i_data<nb_kmers ; i_data++) {
-								cout << "[";
-								for (uint b_idx=0 ; b_idx<data_size ; b_idx++) {
-									if (b_idx > 0)
-										cout << "\t";
-									cout << (uint)data_bytes[data_size*i_data+b_idx];
-								}
-								cout << "],\t";
-							}
-							cout << endl;
-						}
+					vector<uint8_t> & buffer = buffers[partition];
+					buffer.insert(buffer.end(), canonical, canonical + kmer_bytes);
+					buffer.push_back(orientation);
+					for (int b=7 ; b>=0 ; b--)
+						buffer.push_back((uint8_t)(block_position >> (8 * b)));
+
+					if (nb_partitions > 1 and buffer.size() >= flush_size) {
+						partition_files[partition].write((char *)buffer.data(), buffer.size());
+						buffer.clear();
 					}
 				}
+				block_position = kmer_reader.position;
+			}
+		}
+		section_type = kmer_reader.read_section_type();
+	}
 
-				delete[] seq_bytes;
-				delete[] data_bytes;
+	delete searcher;
+	delete[] seq;
+
+	// The partitions are fully on disk before loading them one by one
+	for (uint64_t p=0 ; p<partition_files.size() ; p++) {
+		partition_files[p].write((char *)buffers[p].data(), buffers[p].size());
+		partition_files[p].close();
+		vector<uint8_t>().swap(buffers[p]);
+	}
+
+	// --- Check the partitions one by one ---
+	Stringifyer strif(reader.encoding);
+	vector<DeepViolation> violations;
+	uint64_t nb_violations = 0;
+	for (uint64_t p=0 ; p<nb_partitions ; p++) {
+		vector<uint8_t> records;
+		if (nb_partitions > 1) {
+			ifstream is(partition_names[p], ios::binary | ios::ate);
+			uint64_t file_size = is.tellg();
+			is.seekg(0);
+			records.resize(file_size);
+			is.read((char *)records.data(), file_size);
+			is.close();
+			remove(partition_names[p].c_str());
+		} else
+			records.swap(buffers[p]);
+
+		// canonical kmer -> (seen orientations, first block position)
+		unordered_map<string, pair<uint8_t, long> > kmers;
+		kmers.reserve(records.size() / record_size);
+		for (uint64_t pos=0 ; pos<records.size() ; pos+=record_size) {
+			const uint8_t * record = records.data() + pos;
+			uint8_t orientation = record[kmer_bytes];
+			long block_position = 0;
+			for (uint b=0 ; b<8 ; b++)
+				block_position = (block_position << 8) | record[kmer_bytes + 1 + b];
+
+			auto inserted = kmers.emplace(string((char *)record, kmer_bytes), make_pair(orientation, block_position));
+			if (inserted.second)
+				continue;
+
+			pair<uint8_t, long> & previous = inserted.first->second;
+			bool duplicate = reader.uniqueness and (previous.first & orientation) != 0;
+			bool both_strands = reader.canonicity and (previous.first & ~orientation) != 0;
+			previous.first |= orientation;
+			if (not duplicate and not both_strands)
+				continue;
+
+			// Keep the violations with the smallest positions
+			nb_violations += 1;
+			if (violations.size() == max_reported and violations.back().offset <= block_position)
+				continue;
+			memcpy(kmer, record, kmer_bytes);
+			if (orientation == 2)
+				rc.rev_comp(kmer, k);
+			violations.push_back({block_position, previous.second, duplicate, strif.translate(kmer, k)});
+			sort(violations.begin(), violations.end(), [](const DeepViolation & a, const DeepViolation & b) {
+				return a.offset < b.offset;
+			});
+			if (violations.size() > max_reported)
+				violations.pop_back();
+		}
+	}
+
+	delete[] kmer;
+	delete[] rc_kmer;
+
+	cout << "Deep validation: " << nb_kmers << " kmers verified in " << nb_partitions << " partition(s)" << endl;
+	for (const DeepViolation & v : violations) {
+		if (v.uniqueness)
+			cerr << "/!\\ Uniqueness violation: kmer " << v.kmer << " in the block at byte " << v.offset << " is already present in the block at byte " << v.first_offset << endl;
+		else
+			cerr << "/!\\ Canonicity violation: kmer " << v.kmer << " in the block at byte " << v.offset << " and its reverse complement in the block at byte " << v.first_offset << endl;
+	}
+	if (nb_violations > 0) {
+		cerr << "/!\\ " << nb_violations << " kmers contradict the header flags (uniqueness=" << reader.uniqueness << " canonicity=" << reader.canonicity << ")" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+void Validate::exec() {
+	MappedFile mapping(input_filename);
+	// Files that can't be mapped are read through the kff API
+	if (not mapping.is_open()) {
+		if (this->deep) {
+			cerr << "The deep validation needs an input file that can be mapped in memory." << endl;
+			exit(1);
+		}
+		if (this->threads > 1) {
+			cerr << "Warning: " << input_filename << " can't be mapped in memory. The file is validated with only one thread." << endl;
+			this->threads = 1;
+		}
+	}
+
+	try {
+		KffSectionReader * reader;
+		if (mapping.is_open())
+			reader = new MappedKffReader(mapping);
+		else
+			reader = new StreamKffReader(input_filename);
+		KffSectionReader & infile = *reader;
+
+		if (not infile.is_open()) {
+			cerr << "/!\\ " << input_filename << " is too small to be a kff file" << endl;
+			exit(1);
+		}
+		Stringifyer strif(infile.encoding);
+
+		if (verbose) {
+			cout << "=== Header ===" << endl;
+			// Important values
+			cout << "-> KFF file version " << (uint)infile.major_version << "." << (uint)infile.minor_version << endl;
+			cout << "-> Encoding: A=" << (uint)infile.encoding[0] << " C=" << (uint)infile.encoding[1] << " G=" << (uint)infile.encoding[2] << " T=" << (uint)infile.encoding[3] << endl;
+			cout << "-> Uniqueness: " << (uint)infile.uniqueness << endl;
+			cout << "-> Canonicity: " << (uint)infile.canonicity << endl;
+
+
+			// Metadata
+			cout << "-> Metadata (" << ((uint)infile.metadata_size) << "B)" << endl;
+			for (uint i=0 ; i<infile.metadata_size ; i++) {
+				cout << (uint)infile.metadata[i] << "\t";
+				if (i % 16 == 15)
+					cout << endl;
 			}
-			// Unknown section
-			else {
-				cerr << "/!\\ Unknown section " << section_type << " (uint value " << (uint)section_type << ")" << endl;
-				exit(1);
+			if (infile.metadata_size % 16 != 0)
+				cout << endl;
+
+			cout << endl;
+		}
+
+		// Section checksums from the footer
+		long footer_position = infile.footer_position();
+		if (footer_position != 0) {
+			long first_section = infile.position;
+			infile.jump_to(footer_position);
+			this->checksums = section_checksums(infile.read_gv());
+			infile.jump_to(first_section);
+		}
+
+		if (this->threads > 1)
+			this->parallel_validation(mapping, infile, strif);
+		else {
+			while(infile.position < infile.end_position) {
+				bool checksum_verified;
+				if (not this->validate_section(infile, strif, checksum_verified, cout, cerr))
+					exit(1);
+				if (checksum_verified)
+					this->verified_checksums += 1;
 			}
+		}
 
-			if (verbose)
-				cout << endl;
-			section_type = infile.read_section_type();
+		if (this->verified_checksums != this->checksums.size()) {
+			cerr << "/!\\ " << (this->checksums.size() - this->verified_checksums) << " checksums of the footer do not match the beginning of a block section" << endl;
+			exit(1);
 		}
+		if (this->checksums.size() > 0)
+			cout << this->verified_checksums << " section checksums verified" << endl;
 
-		char kff[3];
-		infile.read((uint8_t *)kff, 3);
+		const uint8_t * kff = infile.read_bytes(infile.end_position, 3);
 		if (kff[0] != 'K' or kff[1] != 'F' or kff[2] !='F')
 			cout << "No KFF signature found at the end of the file. The file must be corrupted." << endl;
+		delete reader;
+
+		if (this->deep and not this->deep_validation(mapping))
+			exit(1);
 
-		if (infile.tellp() < infile.end_position + 3) {
-			cout << "/!\\ Remaining bytes at the end of the file !" << endl;
-		}
-		infile.close();
 		if (verbose)
 			cout << "=== End of the file ===" << endl << endl;
 
@@ -1,9 +1,13 @@
 #include <string>
 #include <iostream>
 #include <vector>
+#include <set>
+#include <unordered_map>
 
 #include "CLI11.hpp"
 #include "kfftools.hpp"
+#include "encoding.hpp"
+#include "mapreader.hpp"
 
 
 #ifndef VALID_H
@@ -13,6 +17,41 @@ class Validate: public KffTool {
 private:
 	std::string input_filename;
 	bool verbose;
+	uint threads;
+	bool deep;
+	uint64_t memory;
+	std::string tmp_dir;
+
+	// Section position -> crc32c checksum (from the footer)
+	std::unordered_map<long, uint32_t> checksums;
+	uint64_t verified_checksums;
+
+	/** Validate the section under the reader cursor and move the cursor after it.
+	 * The checksum of a block section is verified when the footer contains one.
+	 * @param checksum_verified Set to true if the checksum of the section has been verified.
+	 * @param out Stream for the verbose output
+	 * @param err Stream for the errors
+	 * @return false if the file is corrupted.
+	 **/
+	bool validate_section(KffSectionReader & infile, const Stringifyer & strif, bool & checksum_verified, std::ostream & out, std::ostream & err);
+	/** Compare the checksum of the block section just read by the reader with the footer one.
+	 * @param verified Set to true if a checksum is present and equal.
+	 * @return false if the checksum is present and different.
+	 **/
+	bool verify_checksum(const KffSectionReader & infile, bool & verified, std::ostream & out, std::ostream & err);
+	/** Positions of the sections listed by the index of the file (empty if the file is not indexed).
+	 **/
+	std::set<long> index_boundaries(const MappedFile & mapping, const KffSectionReader & infile);
+	/** Validate the sections with multiple threads. The section boundaries are found from the index
+	 * when available or by scanning the blocks headers. The outputs are printed in the file order.
+	 **/
+	void parallel_validation(const MappedFile & mapping, KffSectionReader & infile, const Stringifyer & strif);
+	/** Verify the uniqueness and canonicity flags of the header. The kmers are distributed into
+	 * minimizer partitions (spilled on disk if they do not fit in memory) and each partition is
+	 * checked with a hash table. The partition buffers use at most half of the memory limit. The first violations are printed with their block positions.
+	 * @return false if a flag is violated.
+	 **/
+	bool deep_validation(const MappedFile & mapping);
 
 public:
 	Validate();
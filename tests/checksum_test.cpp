@@ -0,0 +1,53 @@
+// C++11 - use multiple source files.
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+#include "lest.hpp"
+#include "../src/checksum.hpp"
+
+using namespace std;
+
+
+const lest::test module[] = {
+
+    CASE("CRC32C") {
+        cout << "Test crc32c" << endl;
+
+        SETUP( "Reference values" ) {
+            const uint8_t * check = (const uint8_t *)"123456789";
+
+            SECTION( "Check value" )
+            {
+                EXPECT( crc32c(check, 9) == 0xE3069283u );
+                EXPECT( crc32c_software(check, 9) == 0xE3069283u );
+                EXPECT( crc32c(check, 0) == 0u );
+            }
+
+            SECTION( "Chained computation" )
+            {
+                uint32_t crc = crc32c(check, 4);
+                EXPECT( crc32c(check + 4, 5, crc) == 0xE3069283u );
+            }
+
+            SECTION( "Hardware and software implementations are equal" )
+            {
+                vector<uint8_t> bytes(1027);
+                srand(42);
+                for (uint8_t & b : bytes)
+                    b = rand() % 256;
+
+                // Unaligned beginnings and odd sizes
+                for (uint start=0 ; start<9 ; start++)
+                    EXPECT( crc32c(bytes.data() + start, bytes.size() - 2 * start) == crc32c_software(bytes.data() + start, bytes.size() - 2 * start) );
+            }
+        }
+
+        cout << "\tOK" << endl;
+    }
+};
+
+extern lest::tests & specification();
+
+MODULE( specification(), module )
@@ -53,13 +53,13 @@ const lest::test module[] = {
             // Change from writer to reader
             file.close(false);
             file.open("r");
-            sgv = Section_GV(&file);
-            sgv.close();
-            sm = Section_Minimizer(&file);
+            StreamKffReader reader(&file);
+            reader.read_gv();
+            reader.open_block_section();
 
             SECTION( "Matrix creation tests" )
             {
-                vector<vector<uint8_t *> > matrix = comp.prepare_kmer_matrix(sm);
+                vector<vector<uint8_t *> > matrix = comp.prepare_kmer_matrix(reader);
                 cout << "\t\tMatrix construction" << endl;
                 EXPECT( matrix.size() == k - m + 1 );
                 EXPECT( matrix[0].size() == 0u );
@@ -80,7 +80,6 @@ const lest::test module[] = {
                 EXPECT( comp.kmer_buffer[5] == 0 );
             }
 
-            sm.close();
             file.close(false);
             cout << "\t\tOK" << endl;
         }
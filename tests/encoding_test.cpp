@@ -1,6 +1,7 @@
 // C++11 - use multiple source files.
 
 #include <string>
+#include <cstring>
 
 #include "lest.hpp"
 #include "../src/encoding.hpp"
@@ -48,6 +49,22 @@ const lest::test module[] = {
                 EXPECT( (uint)bin[1] == (uint)0b10000111 );
             }
 
+            SECTION( "Fast ACGT translation" )
+            {
+                // Long enough to use the vectorized packing, with lower case letters
+                std::string nucleotides = "GTACG";
+                for (uint i=0 ; i<13 ; i++)
+                    nucleotides += "CATTAGCAtcgtacgA";
+                uint8_t fast[64];
+                uint8_t slow[64];
+
+                for (uint size=1 ; size<=nucleotides.size() ; size++) {
+                    bz.translate(nucleotides, size, slow);
+                    bz.translate_acgt(nucleotides.c_str(), size, fast);
+                    EXPECT( memcmp(fast, slow, (size + 3) / 4) == 0 );
+                }
+            }
+
             cout << "OK" << endl;
         }
     }
@@ -0,0 +1,159 @@
+// C++11 - use multiple source files.
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+
+#include "lest.hpp"
+#include "../src/encoding.hpp"
+#include "../src/fileio.hpp"
+#include "../src/mapreader.hpp"
+#include "../src/sectionreader.hpp"
+
+using namespace std;
+
+
+const lest::test module[] = {
+
+    CASE("Reading a mapped kff file") {
+        cout << "Test MappedKffReader" << endl;
+
+        SETUP( "File with a raw and a minimizer section" ) {
+            uint8_t encoding[] = {0, 1, 3, 2};
+            Binarizer bz(encoding);
+            Stringifyer strif(encoding);
+
+            // Header and variables: k=5, m=3, max=4, data_size=1
+            uint8_t metadata[] = {'a', 'b'};
+            vector<uint8_t> bytes = serialize_header(1, 0, encoding, true, false, metadata, 2);
+            vector<uint8_t> gv = serialize_gv({{"k", 5}, {"m", 3}, {"max", 4}, {"data_size", 1}});
+            bytes.insert(bytes.end(), gv.begin(), gv.end());
+
+            // Raw section: 1 block of 2 kmers
+            uint8_t seq[2];
+            bytes.push_back('r');
+            append_value(bytes, 1);
+            bytes.push_back(2);
+            bz.translate("ACGTTG", 6, seq);
+            bytes.insert(bytes.end(), seq, seq + 2);
+            bytes.push_back(10);
+            bytes.push_back(11);
+
+            // Minimizer section: AGTTGC with the minimizer GTT at position 1
+            bytes.push_back('m');
+            bz.translate("GTT", 3, seq);
+            bytes.push_back(seq[0]);
+            append_value(bytes, 1);
+            bytes.push_back(2);
+            bytes.push_back(1);
+            bz.translate("AGC", 3, seq);
+            bytes.push_back(seq[0]);
+            bytes.push_back(12);
+            bytes.push_back(13);
+
+            vector<uint8_t> footer = serialize_footer({}, 0);
+            bytes.insert(bytes.end(), footer.begin(), footer.end());
+            bytes.push_back('K'); bytes.push_back('F'); bytes.push_back('F');
+
+            string filename = "mapreader_test.kff";
+            FILE * fp = fopen(filename.c_str(), "wb");
+            fwrite(bytes.data(), 1, bytes.size(), fp);
+            fclose(fp);
+
+            MappedKffReader reader(filename);
+
+            SECTION( "Header" )
+            {
+                EXPECT( reader.is_open() );
+                EXPECT( (uint)reader.major_version == 1u );
+                EXPECT( (uint)reader.encoding[2] == 3u );
+                EXPECT( reader.uniqueness );
+                EXPECT( not reader.canonicity );
+                EXPECT( reader.metadata_size == 2u );
+                EXPECT( reader.metadata[1] == 'b' );
+                EXPECT( reader.end_position == (long)bytes.size() - 3 );
+            }
+
+            SECTION( "Sections" )
+            {
+                KffBlock block;
+
+                EXPECT( reader.read_section_type() == 'v' );
+                reader.read_gv();
+                EXPECT( reader.global_vars["k"] == 5u );
+
+                EXPECT( reader.read_section_type() == 'r' );
+                EXPECT( reader.open_block_section() == 1u );
+                EXPECT( reader.next_block(block) );
+                EXPECT( block.nb_kmers == 2u );
+                EXPECT( strif.translate(block.seq, block.seq_size) == "ACGTTG" );
+                EXPECT( (uint)block.data[1] == 11u );
+                EXPECT( not reader.next_block(block) );
+
+                EXPECT( reader.read_section_type() == 'm' );
+                EXPECT( reader.open_block_section() == 1u );
+                EXPECT( strif.translate(reader.minimizer, 3) == "GTT" );
+                EXPECT( reader.next_block(block) );
+                EXPECT( block.mini_pos == 1u );
+                EXPECT( block.seq_size == 3u );
+                uint8_t full[3];
+                reader.sequence_with_minimizer(block, full);
+                EXPECT( strif.translate(full, 6) == "AGTTGC" );
+                EXPECT( (uint)block.data[0] == 12u );
+
+                // Footer is not a global variable
+                EXPECT( reader.read_section_type() == 'v' );
+                map<string, uint64_t> footer_vars = reader.read_gv();
+                EXPECT( footer_vars.find("footer_size") != footer_vars.end() );
+                EXPECT( reader.global_vars.find("footer_size") == reader.global_vars.end() );
+                EXPECT( reader.read_section_type() == 0 );
+            }
+
+            SECTION( "Same values through the kff API" )
+            {
+                // Chunks of 3 bytes: the blocks are split over multiple reads
+                StreamKffReader stream(filename, 3);
+                EXPECT( stream.is_open() );
+                EXPECT( stream.uniqueness );
+                EXPECT( stream.metadata_size == 2u );
+                EXPECT( stream.metadata[1] == 'b' );
+                EXPECT( stream.end_position == reader.end_position );
+                EXPECT( stream.footer_position() == reader.footer_position() );
+
+                KffBlock block, stream_block;
+                while (reader.read_section_type() != 0) {
+                    char section_type = reader.read_section_type();
+                    EXPECT( stream.read_section_type() == section_type );
+
+                    if (section_type == 'v') {
+                        EXPECT( stream.read_gv() == reader.read_gv() );
+                    } else {
+                        EXPECT( stream.open_block_section() == reader.open_block_section() );
+                        if (section_type == 'm') {
+                            EXPECT( strif.translate(stream.minimizer, 3) == "GTT" );
+                        }
+                        while (reader.next_block(block)) {
+                            EXPECT( stream.next_block(stream_block) );
+                            EXPECT( stream_block.nb_kmers == block.nb_kmers );
+                            EXPECT( stream_block.mini_pos == block.mini_pos );
+                            EXPECT( strif.translate(stream_block.seq, stream_block.seq_size) == strif.translate(block.seq, block.seq_size) );
+                            EXPECT( memcmp(stream_block.data, block.data, block.nb_kmers) == 0 );
+                        }
+                        EXPECT( not stream.next_block(stream_block) );
+                    }
+                    EXPECT( stream.position == reader.position );
+                }
+                EXPECT( stream.read_section_type() == 0 );
+            }
+
+            remove(filename.c_str());
+        }
+
+        cout << "\tOK" << endl;
+    }
+};
+
+extern lest::tests & specification();
+
+MODULE( specification(), module )
@@ -1,6 +1,7 @@
 // C++11 - use multiple source files.
 
 #include <string>
+#include <cstring>
 
 #include "lest.hpp"
 #include "../src/encoding.hpp"
@@ -177,6 +178,65 @@ const lest::test module[] = {
             cout << "\t\tOK" << endl;
         }
 
+    },
+
+    CASE("Testing data conversions") {
+        cout << "Test data to uint conversions" << endl;
+
+        SETUP( "2 Bytes data" ) {
+            uint8_t data[2] = {0x01, 0x02};
+
+            SECTION( "Read" )
+            {
+                EXPECT( data_to_uint(data, 2) == 258u );
+                EXPECT( data_to_uint(data, 0) == 0u );
+            }
+
+            SECTION( "Write" )
+            {
+                uint_to_data(1000, data, 2);
+                EXPECT( (uint)data[0] == 0x03u );
+                EXPECT( (uint)data[1] == 0xE8u );
+            }
+
+            SECTION( "Saturation" )
+            {
+                uint_to_data(70000, data, 2);
+                EXPECT( data_to_uint(data, 2) == 65535u );
+                EXPECT( data_max_value(1) == 255u );
+                EXPECT( data_max_value(8) == 0xFFFFFFFFFFFFFFFF );
+            }
+        }
+
+        cout << "\tOK" << endl;
+    },
+
+    CASE("Testing subsequence extraction") {
+        cout << "Test word level subsequence extraction" << endl;
+
+        SETUP( "Random sequences" ) {
+            uint8_t seq[30];
+            for (uint i=0 ; i<30 ; i++)
+                seq[i] = (i * 151 + 17) & 0xFF;
+            uint8_t expected[31];
+            uint8_t extracted[30];
+
+            SECTION( "Same as subsequence" )
+            {
+                bool same = true;
+                for (uint seq_size=1 ; seq_size<=120 ; seq_size++)
+                    for (uint begin=0 ; begin<seq_size ; begin++)
+                        for (uint nb_nucl=1 ; begin+nb_nucl<=seq_size ; nb_nucl++) {
+                            subsequence(seq, seq_size, expected, begin, begin + nb_nucl - 1);
+                            expected[0] &= 0xFF >> (2 * ((4 - nb_nucl % 4) % 4));
+                            extract_subsequence(seq, seq_size, extracted, begin, nb_nucl);
+                            same = same and memcmp(expected, extracted, (nb_nucl + 3) / 4) == 0;
+                        }
+                EXPECT( same );
+            }
+        }
+
+        cout << "\tOK" << endl;
     }
 };
 
@@ -1,5 +1,6 @@
 import unittest
 import os
+import re
 import subprocess
 
 import kmer_generation as kg
@@ -44,6 +45,9 @@ class TestMerge(unittest.TestCase):
         except CalledProcessError:
             self.fail("Error raised on merged file validation test")
 
+        # The footer must point to the consolidated index
+        self.assertIn("first_index", output)
+
         # Analyse the index of the outfile
         self.assertTrue(index_output[3].startswith('v'), f"found: {index_output[3]}")
         self.assertTrue(index_output[4].startswith('r'), f"found: {index_output[4]}")
@@ -54,6 +58,173 @@ class TestMerge(unittest.TestCase):
         os.system(f"rm -r {merged} {txt_file_1} {kff_file_1} {txt_file_2} {kff_file_2}")
 
 
+    def test_union_merge(self):
+        print(f"\n-- TestMerge test_union_merge")
+        print("  init - generate 2 kmer count files sharing kmers")
+        txt_file_1 = "union1_test.txt"
+        kff_file_1 = "union1_test.kff"
+        txt_file_2 = "union2_test.txt"
+        kff_file_2 = "union2_test.kff"
+        kg.generate_random_kmers_file(txt_file_1, 500, 15, max_count=511)
+        # Second file: the kmers from the first file with new counts plus new kmers
+        kg.generate_random_kmers_file(txt_file_2, 500, 15, max_count=511)
+        with open(txt_file_1) as fp:
+            shared = [line.split()[0] for line in fp][:200]
+        with open(txt_file_2, "a") as fp:
+            for kmer in shared:
+                fp.write(f"{kmer} 7\n")
+
+        # Expected sums
+        expected = {}
+        for txt in (txt_file_1, txt_file_2):
+            with open(txt) as fp:
+                for line in fp:
+                    kmer, count = line.split()
+                    expected[kmer] = expected.get(kmer, 0) + int(count)
+
+        print(f"  1/3 Generate kff files from txts.")
+        self.assertEqual(0, os.system(f"./bin/kff-tools instr -i {txt_file_1} -o {kff_file_1} -k 15 -d 2"))
+        self.assertEqual(0, os.system(f"./bin/kff-tools instr -i {txt_file_2} -o {kff_file_2} -k 15 -d 2"))
+
+        print(f"  2/3 Union merge of the files")
+        merged = "union_merged_test.kff"
+        self.assertEqual(0, os.system(f"./bin/kff-tools merge --union -r sum -m 5 -i {kff_file_1} {kff_file_2} -o {merged}"))
+        self.assertEqual(0, os.system(f"./bin/kff-tools validate --deep --infile {merged}"))
+
+        print(f"  3/3 Compare the kmer counts")
+        output = subprocess.check_output(f"./bin/kff-tools outstr -i {merged}", shell=True, text=True)
+        merged_counts = {}
+        for line in output.strip().split("\n"):
+            kmer, count = line.split()
+            self.assertNotIn(kmer, merged_counts)
+            merged_counts[kmer] = int(count)
+        self.assertEqual(expected, merged_counts)
+
+        print("  clean the test area")
+        os.system(f"rm -r {merged} {txt_file_1} {kff_file_1} {txt_file_2} {kff_file_2}")
+
+    def test_parallel_merge(self):
+        print(f"\n-- TestMerge test_parallel_merge")
+        print("  init - generate 3 random kmer files")
+        txts = [f"par{i}_test.txt" for i in range(3)]
+        kffs = [f"par{i}_test.kff" for i in range(3)]
+        kg.generate_sequences_file(txts[0], 1000, 32, size_max=42)
+        kg.generate_random_kmers_file(txts[1], 1000, 17)
+        kg.generate_random_kmers_file(txts[2], 1000, 33, max_count=511)
+
+        print(f"  1/3 Generate kff files from txts.")
+        self.assertEqual(0, os.system(f"./bin/kff-tools instr -i {txts[0]} -o {kffs[0]} -k 32 -m 11"))
+        self.assertEqual(0, os.system(f"./bin/kff-tools instr -i {txts[1]} -o {kffs[1]} -k 17"))
+        self.assertEqual(0, os.system(f"./bin/kff-tools instr -i {txts[2]} -o {kffs[2]} -k 33 -d 2"))
+
+        print(f"  2/3 Sequential and parallel merges")
+        seq_merged = "seq_merged_test.kff"
+        par_merged = "par_merged_test.kff"
+        self.assertEqual(0, os.system(f"./bin/kff-tools merge -i {' '.join(kffs)} -o {seq_merged}"))
+        self.assertEqual(0, os.system(f"./bin/kff-tools merge -t 4 -i {' '.join(kffs)} -o {par_merged}"))
+        self.assertEqual(0, os.system(f"./bin/kff-tools validate --infile {par_merged}"))
+
+        print(f"  3/3 Compare outputs")
+        seq_out = subprocess.check_output(f"./bin/kff-tools outstr -i {seq_merged}", shell=True, text=True)
+        par_out = subprocess.check_output(f"./bin/kff-tools outstr -i {par_merged}", shell=True, text=True)
+        self.assertEqual(seq_out, par_out)
+
+        print("  clean the test area")
+        os.system(f"rm -r {seq_merged} {par_merged} {' '.join(txts)} {' '.join(kffs)}")
+
+
+
+def set_header_flags(kff_file, uniqueness, canonicity):
+    """ Overwrite the uniqueness and canonicity bytes of a kff header """
+    with open(kff_file, "r+b") as fp:
+        fp.seek(6)
+        fp.write(bytes([uniqueness, canonicity]))
+
+
+def reverse_complement(seq):
+    complement = {"A": "T", "C": "G", "G": "C", "T": "A"}
+    return "".join(complement[c] for c in reversed(seq))
+
+
+class TestDeepValidation(unittest.TestCase):
+
+    def test_uniqueness_violation(self):
+        print(f"\n-- TestDeepValidation test_uniqueness_violation")
+        txt_file = "deep_uniq_test.txt"
+        kff_file = "deep_uniq_test.kff"
+        kg.generate_sequences_file(txt_file, 100, 40)
+        # Repeated line: all its kmers are present twice
+        with open(txt_file) as fp:
+            repeated = fp.readline()
+        with open(txt_file, "a") as fp:
+            fp.write(repeated)
+
+        self.assertEqual(0, os.system(f"./bin/kff-tools instr -i {txt_file} -o {kff_file} -k 31"))
+        set_header_flags(kff_file, 1, 0)
+        result = subprocess.run(f"./bin/kff-tools validate --deep --infile {kff_file}", shell=True, capture_output=True, text=True)
+        self.assertNotEqual(0, result.returncode)
+        self.assertRegex(result.stderr, r"Uniqueness violation: kmer [ACGT]{31} in the block at byte [0-9]+ is already present in the block at byte [0-9]+")
+
+        # Same file without the uniqueness flag
+        set_header_flags(kff_file, 0, 0)
+        self.assertEqual(0, os.system(f"./bin/kff-tools validate --deep --infile {kff_file}"))
+
+        print("  clean the test area")
+        os.system(f"rm -r {txt_file} {kff_file}")
+
+    def test_canonicity_violation(self):
+        print(f"\n-- TestDeepValidation test_canonicity_violation")
+        txt_file = "deep_canon_test.txt"
+        kff_file = "deep_canon_test.kff"
+        kg.generate_random_kmers_file(txt_file, 100, 31)
+        # A kmer present in both orientations
+        kmer = next(kg.generate_sequences(1, 31))
+        with open(txt_file, "a") as fp:
+            fp.write(f"{kmer}\n{reverse_complement(kmer)}\n")
+
+        self.assertEqual(0, os.system(f"./bin/kff-tools instr -i {txt_file} -o {kff_file} -k 31"))
+        set_header_flags(kff_file, 0, 1)
+        result = subprocess.run(f"./bin/kff-tools validate --deep --infile {kff_file}", shell=True, capture_output=True, text=True)
+        self.assertNotEqual(0, result.returncode)
+        self.assertRegex(result.stderr, r"Canonicity violation: kmer [ACGT]{31} in the block at byte [0-9]+ and its reverse complement in the block at byte [0-9]+")
+
+        print("  clean the test area")
+        os.system(f"rm -r {txt_file} {kff_file}")
+
+    def test_partitions_on_disk(self):
+        print(f"\n-- TestDeepValidation test_partitions_on_disk")
+        txt_file = "deep_disk_test.txt"
+        kff_file = "deep_disk_test.kff"
+        tmp_dir = "deep_disk_tmp"
+        os.mkdir(tmp_dir)
+        # About 35000 kmers: more than 1 MB of hash table
+        kg.generate_sequences_file(txt_file, 500, 100)
+
+        print("  1/2 Unique kmers")
+        self.assertEqual(0, os.system(f"./bin/kff-tools instr -i {txt_file} -o {kff_file} -k 31"))
+        set_header_flags(kff_file, 1, 0)
+        result = subprocess.run(f"./bin/kff-tools validate --deep --memory 1 --tmp-dir {tmp_dir} --infile {kff_file}", shell=True, capture_output=True, text=True)
+        self.assertEqual(0, result.returncode, result.stderr)
+        nb_partitions = int(re.search(r"verified in ([0-9]+) partition", result.stdout).group(1))
+        self.assertGreater(nb_partitions, 1)
+        # The partitions are removed
+        self.assertEqual([], os.listdir(tmp_dir))
+
+        print("  2/2 Duplicated kmers")
+        with open(txt_file) as fp:
+            repeated = fp.readline()
+        with open(txt_file, "a") as fp:
+            fp.write(repeated)
+        self.assertEqual(0, os.system(f"./bin/kff-tools instr -i {txt_file} -o {kff_file} -k 31"))
+        set_header_flags(kff_file, 1, 0)
+        result = subprocess.run(f"./bin/kff-tools validate --deep --memory 1 --tmp-dir {tmp_dir} --infile {kff_file}", shell=True, capture_output=True, text=True)
+        self.assertNotEqual(0, result.returncode)
+        self.assertRegex(result.stderr, r"Uniqueness violation: kmer [ACGT]{31} in the block at byte [0-9]+")
+        self.assertEqual([], os.listdir(tmp_dir))
+
+        print("  clean the test area")
+        os.system(f"rm -r {txt_file} {kff_file} {tmp_dir}")
+
 
 if __name__ == '__main__':
   unittest.main()
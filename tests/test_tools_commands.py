@@ -1,5 +1,10 @@
 import unittest
 import os
+import re
+import struct
+import subprocess
+import gzip
+import bz2
 
 import kmer_generation as kg
 
@@ -8,6 +13,24 @@ import kmer_generation as kg
 file = "ecoli_count_dsk"
 
 
+def read_footer(filename):
+    """ Read the footer variables of a kff file (global variable section that ends the file) """
+    with open(filename, "rb") as fp:
+        content = fp.read()
+    # footer_size is the last variable, just before the final KFF signature
+    footer_size = struct.unpack(">Q", content[-11:-3])[0]
+    position = len(content) - 3 - footer_size
+    assert content[position:position+1] == b"v"
+    nb_vars = struct.unpack(">Q", content[position+1:position+9])[0]
+    position += 9
+    footer = {}
+    for _ in range(nb_vars):
+        end = content.index(b"\0", position)
+        footer[content[position:end].decode()] = struct.unpack(">Q", content[end+1:end+9])[0]
+        position = end + 9
+    return footer, content
+
+
 class TestInOut(unittest.TestCase):
     def test_raw_sections(self):
         print("\n-- TestInOut test_raw_section")
@@ -22,6 +45,10 @@ class TestInOut(unittest.TestCase):
             kff_file = f"inout_raw_k{k}_test.kff"
             self.assertEqual(0, os.system(f"./bin/kff-tools instr --kmer-size {k} --data-size 2 --infile {txt_file} --outfile {kff_file}"))
             self.assertEqual(0, os.system(f"./bin/kff-tools validate --infile {kff_file}"))
+            # Same file with a parallel parsing
+            kff_parallel = f"inout_raw_k{k}_parallel_test.kff"
+            self.assertEqual(0, os.system(f"./bin/kff-tools instr --kmer-size {k} --data-size 2 --threads 3 --infile {txt_file} --outfile {kff_parallel}"))
+            self.assertEqual(0, os.system(f"cmp {kff_file} {kff_parallel}"))
 
             # Regenerate a textual file from the kff
             print("  2/3 Regenerate a txt file from the kff")
@@ -35,7 +62,7 @@ class TestInOut(unittest.TestCase):
             stream.close()
 
             print("  Clean the directory")
-            self.assertEqual(0, os.system(f"rm {txt_file} {kff_file} {txt_out_file}"))
+            self.assertEqual(0, os.system(f"rm {txt_file} {kff_file} {kff_parallel} {txt_out_file}"))
 
     def test_data_sequences(self):
         print("\n-- TestInOut test_data_sequences")
@@ -73,6 +100,128 @@ class TestInOut(unittest.TestCase):
         print("  Clean the directory")
         self.assertEqual(0, os.system(f"rm {seqfilename} {kff_file} {outfile} {compfilename}"))
 
+    def test_export_formats(self):
+        print("\n-- TestInOut test_export_formats")
+        seqfilename = "export_test.txt"
+        with open(seqfilename, "w") as seqfile:
+            seqfile.write("AGTTCT 12,3\n")
+            seqfile.write("GAGCT 4\n")
+            seqfile.write("TCTTACC 1,2,7\n")
+        expected = [("AGTTC", 12), ("GTTCT", 3), ("GAGCT", 4), ("TCTTA", 1), ("CTTAC", 2), ("TTACC", 7)]
+        kff_file = "export_test.kff"
+        self.assertEqual(0, os.system(f"./bin/kff-tools instr --kmer-size 5 --data-size 1 --infile {seqfilename} --outfile {kff_file}"))
+
+        print("1/3 tsv")
+        stream = os.popen(f"./bin/kff-tools outstr -f tsv --infile {kff_file}")
+        lines = stream.read().strip().split("\n")
+        stream.close()
+        self.assertEqual(lines, ["kmer\tdata"] + [f"{kmer}\t{count}" for kmer, count in expected])
+
+        print("2/3 fasta")
+        stream = os.popen(f"./bin/kff-tools outstr -f fasta --infile {kff_file}")
+        lines = stream.read().strip().split("\n")
+        stream.close()
+        self.assertEqual(lines, [">kmers=2 data=12,3", "AGTTCT", ">kmers=1 data=4", "GAGCT", ">kmers=3 data=1,2,7", "TCTTACC"])
+
+        print("3/3 bin")
+        bin_file = "export_test.bin"
+        self.assertEqual(0, os.system(f"./bin/kff-tools outstr -f bin --infile {kff_file} -o {bin_file}"))
+        with open(bin_file, "rb") as fp:
+            content = fp.read()
+        self.assertEqual(content[:8], b"KFFKMERS")
+        version, k, kmer_bytes, data_size, nb_kmers, encoding, canonical = struct.unpack("<7Q", content[8:64])
+        self.assertEqual((k, kmer_bytes, data_size, nb_kmers), (5, 8, 1, 6))
+        code = {"A": (encoding >> 6) & 3, "C": (encoding >> 4) & 3, "G": (encoding >> 2) & 3, "T": encoding & 3}
+        for idx, (kmer, count) in enumerate(expected):
+            value = 0
+            for nucl in kmer:
+                value = (value << 2) | code[nucl]
+            self.assertEqual(value, struct.unpack("<Q", content[64 + 8 * idx:72 + 8 * idx])[0])
+            self.assertEqual(count, content[64 + 8 * nb_kmers + idx])
+
+        print("  Clean the directory")
+        self.assertEqual(0, os.system(f"rm {seqfilename} {kff_file} {bin_file}"))
+
+    def test_fastx_inputs(self):
+        print("\n-- TestInOut test_fastx_inputs")
+        fasta = "fastx_test.fa"
+        with open(fasta, "w") as fp:
+            fp.write(">seq1 multi-line\nACGTNacgta\nGGTTAC\n>seq2 too short\nNNACGN\n>seq3\nTTTTTT")
+        fastq = "fastx_test.fq"
+        with open(fastq, "w") as fp:
+            fp.write("@read1\nACGTNACGTAGGTTAC\n+\n@@@@@@@@@@@@@@@@\n@read2\nACGN\n+\n@@@@\n@read3\nTTTTTT\n+read3\nIIIIII\n")
+        # Fragments: ACGT (too small), ACGTAGGTTAC, ACG (too small), TTTTTT
+        expected = ["ACGTA", "CGTAG", "GTAGG", "TAGGT", "AGGTT", "GGTTA", "GTTAC", "TTTTT", "TTTTT"]
+
+        # Compressed inputs (2 gzip members)
+        fasta_gz = "fastx_test.fa.gz"
+        with open(fasta, "rb") as fp:
+            content = fp.read()
+        with open(fasta_gz, "wb") as fp:
+            fp.write(gzip.compress(content[:30]) + gzip.compress(content[30:]))
+        fastq_bz2 = "fastx_test.fq.bz2"
+        with open(fastq, "rb") as fp:
+            content = fp.read()
+        with open(fastq_bz2, "wb") as fp:
+            fp.write(bz2.compress(content))
+
+        kff_file = "fastx_test.kff"
+        for infile in [fasta, fastq, fasta_gz, fastq_bz2]:
+            print(f"  {infile}")
+            # -m 3 splits the first fragment in 3 blocks
+            self.assertEqual(0, os.system(f"./bin/kff-tools instr --kmer-size 5 -m 3 --infile {infile} --outfile {kff_file}"))
+            self.assertEqual(0, os.system(f"./bin/kff-tools validate --infile {kff_file}"))
+            stream = os.popen(f"./bin/kff-tools outstr --infile {kff_file}")
+            kmers = [line.split()[0] for line in stream.read().strip().split("\n")]
+            stream.close()
+            self.assertEqual(kmers, expected)
+
+        print("  Clean the directory")
+        self.assertEqual(0, os.system(f"rm {fasta} {fastq} {fasta_gz} {fastq_bz2} {kff_file}"))
+
+    def test_multiple_inputs(self):
+        print("\n-- TestInOut test_multiple_inputs")
+        txts = [f"multi_test_{idx}.txt" for idx in range(4)]
+        for txt in txts:
+            kg.generate_sequences_file(txt, 200, 15, size_max=40)
+        list_file = "multi_test_list.txt"
+        with open(list_file, "w") as fp:
+            fp.write("\n".join(txts[2:]) + "\n")
+        kff_file = "multi_test.kff"
+
+        print("  Expected kmers: files translated one by one")
+        expected = ""
+        for txt in txts:
+            self.assertEqual(0, os.system(f"./bin/kff-tools instr -i {txt} -o {kff_file} -k 15 -m 20"))
+            stream = os.popen(f"./bin/kff-tools outstr -i {kff_file}")
+            expected += stream.read()
+            stream.close()
+
+        for options in ["-t 1", "-t 3", "-t 3 --one-section"]:
+            print(f"  All the files at once {options}")
+            self.assertEqual(0, os.system(f"./bin/kff-tools instr -i {txts[0]} {txts[1]} -l {list_file} -o {kff_file} -k 15 -m 20 {options}"))
+            self.assertEqual(0, os.system(f"./bin/kff-tools validate --infile {kff_file}"))
+            stream = os.popen(f"./bin/kff-tools outstr -i {kff_file}")
+            self.assertEqual(stream.read(), expected)
+            stream.close()
+
+            # Metadata: table of the input files, 1 line "index\tpath" per file
+            footer, content = read_footer(kff_file)
+            metadata_size = struct.unpack(">I", content[8:12])[0]
+            table = "".join(f"{idx}\t{txt}\n" for idx, txt in enumerate(txts))
+            self.assertEqual(table, content[12:12+metadata_size].decode())
+
+            # Footer: values per input file
+            for idx, txt in enumerate(txts):
+                with open(txt) as fp:
+                    sequences = fp.read().split()
+                self.assertEqual(len(sequences), footer[f"file_{idx}_sequences"])
+                self.assertEqual(sum(len(seq) - 15 + 1 for seq in sequences), footer[f"file_{idx}_kmers"])
+                self.assertEqual(1, footer[f"file_{idx}_sections"])
+
+        print("  Clean the directory")
+        self.assertEqual(0, os.system(f"rm {' '.join(txts)} {list_file} {kff_file}"))
+
 
 class TestSplitMerge(unittest.TestCase):
 
@@ -202,6 +351,108 @@ class TestSplitMerge(unittest.TestCase):
         print("  clean the test area")
         os.system(f"rm -r {merged} {split_dir} {txt_file_1} {kff_file_1} {txt_file_2} {kff_file_2} {txt_file_3} {kff_file_3} {filelist}")
 
+    def test_split_shards(self):
+        print(f"\n-- TestMergeSplit test_split_shards")
+        print("  init - generate a random sequence file")
+        txt = "shards_test.txt"
+        kff_raw = "shards_raw_test.kff"
+        kff_bucket = "shards_bucket_test.kff"
+        shard_dir = "shards_test/"
+        kg.generate_sequences_file(txt, 1000, 32, size_max=42)
+
+        print(f"  1/3 Generate a bucketed kff file.")
+        self.assertEqual(0, os.system(f"./bin/kff-tools instr -i {txt} -o {kff_raw} -k 32 -m 11"))
+        self.assertEqual(0, os.system(f"./bin/kff-tools bucket -i {kff_raw} -o {kff_bucket} -m 8"))
+
+        for mode in ("size", "hash"):
+            print(f"  2/3 Split the file into 4 shards ({mode})")
+            self.assertEqual(0, os.system(f"rm -rf {shard_dir} ; mkdir {shard_dir}"))
+            self.assertEqual(0, os.system(f"./bin/kff-tools split -i {kff_bucket} -o {shard_dir} -n 4 --shard-by {mode} -t 2"))
+            for i in range(4):
+                self.assertEqual(0, os.system(f"./bin/kff-tools validate --infile {shard_dir}/shard_{i}.kff"))
+
+            print(f"  3/3 Compare the kmers")
+            self.assertEqual(0, os.system(f"./bin/kff-tools outstr -i {kff_bucket} | sort > {shard_dir}/original.txt"))
+            self.assertEqual(0, os.system(f"cat /dev/null > {shard_dir}/shards.txt"))
+            for i in range(4):
+                self.assertEqual(0, os.system(f"./bin/kff-tools outstr -i {shard_dir}/shard_{i}.kff >> {shard_dir}/shards.txt"))
+            self.assertEqual(0, os.system(f"sort {shard_dir}/shards.txt > {shard_dir}/shards_sorted.txt"))
+            stream = os.popen(f"diff {shard_dir}/original.txt {shard_dir}/shards_sorted.txt")
+            stream_val = stream.read()
+            stream.close()
+            self.assertEqual(stream_val, "")
+
+        print("  clean the test area")
+        os.system(f"rm -r {shard_dir} {txt} {kff_raw} {kff_bucket}")
+
+
+class TestTranslate(unittest.TestCase):
+
+    def test_in_place(self):
+        print(f"\n-- TestTranslate - in place translation")
+        txt = "translate_test.txt"
+        kff_raw = "translate_raw_test.kff"
+        kff_bucket = "translate_bucket_test.kff"
+        kg.generate_sequences_file(txt, 500, 32, size_max=60)
+        self.assertEqual(0, os.system(f"./bin/kff-tools instr -i {txt} -o {kff_raw} -k 32 -m 20"))
+        self.assertEqual(0, os.system(f"./bin/kff-tools bucket -i {kff_raw} -o {kff_bucket} -m 9"))
+
+        for kff_file in [kff_raw, kff_bucket]:
+            print(f"  {kff_file}")
+            self.assertEqual(0, os.system(f"./bin/kff-tools outstr -i {kff_file} > {kff_file}_expected.txt"))
+            # Regular translation vs translation of a copy vs translation of the file itself
+            self.assertEqual(0, os.system(f"./bin/kff-tools translate -i {kff_file} -o {kff_file}_copy.kff -e AGTC"))
+            self.assertEqual(0, os.system(f"./bin/kff-tools translate -i {kff_file} -o {kff_file}_mapped.kff --in-place -e AGTC -t 3"))
+            self.assertEqual(0, os.system(f"./bin/kff-tools translate -i {kff_file} --in-place -e TGCA --checksum"))
+            for translated in [f"{kff_file}_copy.kff", f"{kff_file}_mapped.kff", kff_file]:
+                self.assertEqual(0, os.system(f"./bin/kff-tools validate --infile {translated}"))
+                stream = os.popen(f"./bin/kff-tools outstr -i {translated} | diff - {kff_file}_expected.txt")
+                self.assertEqual(stream.read(), "")
+                stream.close()
+
+        print("  clean the test area")
+        os.system(f"rm -r {txt} {kff_raw}* {kff_bucket}*")
+
+
+class TestDataRm(unittest.TestCase):
+
+    def test_projections(self):
+        print(f"\n-- TestDataRm - data projections")
+        txt = "datarm_test.txt"
+        kff_file = "datarm_test.kff"
+        kff_out = "datarm_out_test.kff"
+        kg.generate_random_kmers_file(txt, 1000, 15, max_count=65535)
+        with open(txt) as fp:
+            expected = [line.split() for line in fp.read().strip().split("\n")]
+        self.assertEqual(0, os.system(f"./bin/kff-tools instr -i {txt} -o {kff_file} -k 15 -d 2 -m 1"))
+
+        projections = [
+            ("", lambda c: None),
+            ("-d 1", lambda c: min(c, 255)),
+            ("-b 1", lambda c: c & 0xFF),
+            ("-b 1,0", lambda c: ((c & 0xFF) << 8) | (c >> 8)),
+            ("--log", lambda c: c.bit_length()),
+            ("-d 4", lambda c: c),
+        ]
+        for options, projection in projections:
+            print(f"  data-rm {options}")
+            self.assertEqual(0, os.system(f"./bin/kff-tools data-rm -i {kff_file} -o {kff_out} {options}"))
+            self.assertEqual(0, os.system(f"./bin/kff-tools validate --infile {kff_out}"))
+            stream = os.popen(f"./bin/kff-tools outstr -i {kff_out}")
+            lines = [line.split() for line in stream.read().strip().split("\n")]
+            stream.close()
+            self.assertEqual(len(lines), len(expected))
+            for line, (kmer, count) in zip(lines, expected):
+                self.assertEqual(line[0], kmer)
+                value = projection(int(count))
+                if value is None:
+                    self.assertEqual(len(line), 1)
+                else:
+                    self.assertEqual(int(line[1]), value)
+
+        print("  clean the test area")
+        os.system(f"rm {txt} {kff_file} {kff_out}")
+
 
 class TestBucketting(unittest.TestCase):
 
@@ -223,6 +474,11 @@ class TestBucketting(unittest.TestCase):
         # print(f"./bin/kff-tools bucket -i {kff_raw} -o {kff_bucket} -m 11")
         self.assertEqual(0, os.system(f"./bin/kff-tools bucket -i {kff_raw} -o {kff_bucket} -m 11"))
         self.assertEqual(0, os.system(f"./bin/kff-tools validate --infile {kff_bucket}"))
+        # The bucketed file ends with an index referenced by the footer
+        footer, content = read_footer(kff_bucket)
+        self.assertIn("first_index", footer)
+        self.assertNotEqual(0, footer["first_index"])
+        self.assertEqual(b"i", content[footer["first_index"]:footer["first_index"]+1])
         
 
         print(f"  3/3 Compare outputs")
@@ -233,6 +489,71 @@ class TestBucketting(unittest.TestCase):
         stream.close()
         self.assertEqual(stream_val, "")
 
+        # Same output order with multiple threads
+        self.assertEqual(0, os.system(f"./bin/kff-tools outstr -c -i {kff_bucket} > {kff_bucket}_seq.txt"))
+        self.assertEqual(0, os.system(f"./bin/kff-tools outstr -c -t 4 -i {kff_bucket} > {kff_bucket}_par.txt"))
+        stream = os.popen(f"diff {kff_bucket}_seq.txt {kff_bucket}_par.txt")
+        stream_val = stream.read()
+        stream.close()
+        self.assertEqual(stream_val, "")
+
+
+        print("  clean the test area")
+        os.system(f"rm -r {txt} {kff_raw}* {kff_bucket}*")
+
+    def test_instr_minimizer_sections(self):
+        print(f"\n-- TestBucketting - minimizer sections from instr")
+        txt = f"txt_test.txt"
+        kff_raw = f"kff_raw_test.kff"
+        kff_mini = f"kff_mini_test.kff"
+        kg.generate_sequences_file(txt, 1000, 32, size_max=42)
+
+        print(f"  1/2 Generate the raw and minimizer kff files")
+        self.assertEqual(0, os.system(f"./bin/kff-tools instr -i {txt} -o {kff_raw} -k 32 -m 11"))
+        self.assertEqual(0, os.system(f"./bin/kff-tools outstr -c -i {kff_raw} | sort > {kff_raw}_sorted.txt"))
+        for options in ["", "--single-side"]:
+            self.assertEqual(0, os.system(f"./bin/kff-tools instr -i {txt} -o {kff_mini} -k 32 -m 11 --minimizer-size 11 {options}"))
+            self.assertEqual(0, os.system(f"./bin/kff-tools validate --infile {kff_mini}"))
+
+            print(f"  2/2 Compare outputs {options}")
+            self.assertEqual(0, os.system(f"./bin/kff-tools outstr -c -i {kff_mini} | sort > {kff_mini}_sorted.txt"))
+            stream = os.popen(f"diff {kff_raw}_sorted.txt {kff_mini}_sorted.txt")
+            stream_val = stream.read()
+            stream.close()
+            self.assertEqual(stream_val, "")
+
+        print("  clean the test area")
+        os.system(f"rm -r {txt} {kff_raw}* {kff_mini}*")
+
+
+class TestQuery(unittest.TestCase):
+
+    def test_bucket_query(self):
+        print(f"\n-- TestQuery - query a bucketed file")
+        print("  init - generate a random sequence file")
+        txt = "query_test.txt"
+        kff_raw = "query_raw_test.kff"
+        kff_bucket = "query_bucket_test.kff"
+        kg.generate_sequences_file(txt, 1000, 32, size_max=42, max_count=255)
+
+        print(f"  1/3 Generate the bucketed file")
+        self.assertEqual(0, os.system(f"./bin/kff-tools instr -i {txt} -o {kff_raw} -k 32 -m 11 -d 1"))
+        self.assertEqual(0, os.system(f"./bin/kff-tools bucket -i {kff_raw} -o {kff_bucket} -m 11"))
+
+        print(f"  2/3 Query all the kmers of the raw file")
+        self.assertEqual(0, os.system(f"./bin/kff-tools outstr -i {kff_raw} > {kff_raw}.txt"))
+        self.assertEqual(0, os.system(f"cut -d ' ' -f 1 {kff_raw}.txt > {kff_raw}_queries.txt"))
+        self.assertEqual(0, os.system(f"./bin/kff-tools query -i {kff_bucket} -q {kff_raw}_queries.txt -t {kff_bucket}.table > {kff_bucket}_answers.txt"))
+
+        print(f"  3/3 Compare the answers with the kmers (second time from the saved table, small batches)")
+        self.assertEqual(0, os.system(f"sed 's/ / 1 /' {kff_raw}.txt > {kff_raw}_expected.txt"))
+        stream = os.popen(f"diff {kff_raw}_expected.txt {kff_bucket}_answers.txt")
+        self.assertEqual(stream.read(), "")
+        stream.close()
+        self.assertEqual(0, os.system(f"./bin/kff-tools query -i {kff_bucket} -t {kff_bucket}.table -b 100 --cache-size 1 < {kff_raw}_queries.txt > {kff_bucket}_answers.txt"))
+        stream = os.popen(f"diff {kff_raw}_expected.txt {kff_bucket}_answers.txt")
+        self.assertEqual(stream.read(), "")
+        stream.close()
 
         print("  clean the test area")
         os.system(f"rm -r {txt} {kff_raw}* {kff_bucket}*")
@@ -248,7 +569,7 @@ class TestIndex(unittest.TestCase):
             kg.generate_random_kmers_file(txt_file, 1000, k, max_count=0, overlapping=True)
 
             # Generate a kff file from a textual kmer count
-            print("  1/3 Generate a kff file from a textual kmer count")
+            print("  1/4 Generate a kff file from a textual kmer count")
             kff_file = f"index_raw_k{k}_test.kff"
             validate_out = f"index_raw_k{k}_valid_test.txt"
             self.assertEqual(0, os.system(f"./bin/kff-tools instr --kmer-size {k} --data-size 0 --infile {txt_file} --outfile {kff_file}"))
@@ -256,20 +577,66 @@ class TestIndex(unittest.TestCase):
             # exit(0);
 
             # Regenerate a textual file from the kff
-            print("  2/3 Re-index the kff file")
+            print("  2/4 Re-index the kff file")
             reindexed_file = f"index_raw_k{k}_indexed_test.kff"
             self.assertEqual(0, os.system(f"./bin/kff-tools index --infile {kff_file} --outfile {reindexed_file}"))
 
             # Compate the original file to the final translated file
-            print("  3/3 Compare initial and final validation files")
+            print("  3/4 Compare initial and final validation files")
             revalidate_out = f"index_raw_k{k}_indexed_test.txt"
             self.assertEqual(0, os.system(f"./bin/kff-tools validate -v --infile {reindexed_file} > {revalidate_out}"))
             stream = os.popen(f"diff {validate_out} {revalidate_out}")
             self.assertEqual(stream.read(), "")
             stream.close()
+            # Parallel validation driven by the index
+            self.assertEqual(0, os.system(f"./bin/kff-tools validate -v -t 4 --infile {reindexed_file} > {revalidate_out}"))
+            stream = os.popen(f"diff {validate_out} {revalidate_out}")
+            self.assertEqual(stream.read(), "")
+            stream.close()
+
+            print("  4/4 Index the file in place")
+            inplace_file = f"index_raw_k{k}_inplace_test.kff"
+            self.assertEqual(0, os.system(f"cp {kff_file} {inplace_file}"))
+            self.assertEqual(0, os.system(f"./bin/kff-tools index --in-place --infile {inplace_file}"))
+            stream = os.popen(f"./bin/kff-tools validate -v --infile {inplace_file}")
+            self.assertIn("=== Section i ===", stream.read())
+            stream.close()
+            self.assertEqual(0, os.system(f"./bin/kff-tools outstr -i {kff_file} > {kff_file}.txt"))
+            self.assertEqual(0, os.system(f"./bin/kff-tools outstr -i {inplace_file} > {inplace_file}.txt"))
+            stream = os.popen(f"diff {kff_file}.txt {inplace_file}.txt")
+            self.assertEqual(stream.read(), "")
+            stream.close()
 
             print("  Clean the directory")
-            self.assertEqual(0, os.system(f"rm {txt_file} {kff_file} {validate_out} {reindexed_file} {revalidate_out}"))
+            self.assertEqual(0, os.system(f"rm {txt_file} {kff_file} {validate_out} {reindexed_file} {revalidate_out} {inplace_file} {kff_file}.txt {inplace_file}.txt"))
+
+    def test_unknown_section_type(self):
+        print("\n-- TestIndex test_unknown_section_type")
+        txt_file = "unknown_section_test.txt"
+        kff_file = "unknown_section_test.kff"
+        kg.generate_random_kmers_file(txt_file, 1000, 15, max_count=0, overlapping=True)
+        self.assertEqual(0, os.system(f"./bin/kff-tools instr --kmer-size 15 --data-size 0 --infile {txt_file} --outfile {kff_file}"))
+
+        # Zero the type of the section following the first variable section
+        with open(kff_file, "rb") as fp:
+            content = bytearray(fp.read())
+        position = 12 + struct.unpack(">I", content[8:12])[0]
+        self.assertEqual(content[position:position+1], b"v")
+        nb_vars = struct.unpack(">Q", content[position+1:position+9])[0]
+        position += 9
+        for _ in range(nb_vars):
+            position = content.index(b"\0", position) + 9
+        content[position] = 0
+        with open(kff_file, "wb") as fp:
+            fp.write(content)
+
+        # Both the sequential and the parallel validations must report the section
+        for threads in [1, 4]:
+            result = subprocess.run(f"./bin/kff-tools validate -t {threads} --infile {kff_file}", shell=True, capture_output=True, text=True, timeout=60)
+            self.assertNotEqual(0, result.returncode)
+            self.assertIn("Unknown section", result.stderr)
+
+        os.system(f"rm {txt_file} {kff_file}")
 
 
 class TestCompaction(unittest.TestCase):
@@ -314,6 +681,141 @@ class TestCompaction(unittest.TestCase):
         print("  clean the test area")
         os.system(f"rm -r {txt} {kff_raw}* {kff_bucket}* {kff_compacted}* {kff_disjoin}")
 
+    def test_section_checksums(self):
+        print(f"\n-- TestCompaction - section checksums")
+        print("  init - generate a random sequence file")
+        txt = "test.txt"
+        kff_raw = "raw_test.kff"
+        kff_bucket = "bucket_test.kff"
+        kff_compacted = "compact_test.kff"
+        kg.generate_sequences_file(txt, 1000, 32, size_max=42, max_count=255)
+
+        print(f"  1/4 Generate files with checksums")
+        self.assertEqual(0, os.system(f"./bin/kff-tools instr -i {txt} -o {kff_raw} -k 32 -m 5 -d 1"))
+        self.assertEqual(0, os.system(f"./bin/kff-tools bucket -i {kff_raw} -o {kff_bucket} -m 11 --checksum"))
+        self.assertEqual(0, os.system(f"./bin/kff-tools compact -i {kff_bucket} -o {kff_compacted} --checksum"))
+
+        print(f"  2/4 Verify the checksums")
+        for kff_file in [kff_bucket, kff_compacted]:
+            stream = os.popen(f"./bin/kff-tools validate -t 4 --infile {kff_file}")
+            self.assertIn("section checksums verified", stream.read())
+            self.assertEqual(None, stream.close())
+
+        print(f"  3/4 Rewrite the sections without stale checksums")
+        for tool in ["sort", "shuffle"]:
+            rewritten = f"{tool}_test.kff"
+            self.assertEqual(0, os.system(f"./bin/kff-tools {tool} -i {kff_compacted} -o {rewritten}"))
+            with open(rewritten, "rb") as fp:
+                self.assertNotIn(b"crc32c_", fp.read())
+            self.assertEqual(0, os.system(f"./bin/kff-tools validate -t 4 --infile {rewritten}"))
+            self.assertEqual(0, os.system(f"./bin/kff-tools outstr -c -i {kff_compacted} | sort > {kff_compacted}_sorted.txt"))
+            self.assertEqual(0, os.system(f"./bin/kff-tools outstr -c -i {rewritten} | sort > {rewritten}_sorted.txt"))
+            stream = os.popen(f"diff {kff_compacted}_sorted.txt {rewritten}_sorted.txt")
+            self.assertEqual(stream.read(), "")
+            stream.close()
+            os.system(f"rm {rewritten} {rewritten}_sorted.txt {kff_compacted}_sorted.txt")
+
+        print(f"  4/4 Detect a corrupted section")
+        with open(kff_compacted, "rb") as fp:
+            content = bytearray(fp.read())
+        # Section positions from the footer variables crc32c_<position>
+        positions = [int(name[7:]) for name in re.findall(rb"crc32c_[0-9]+", content)]
+        content[min(positions) + 1] ^= 0b11
+        with open(kff_compacted, "wb") as fp:
+            fp.write(content)
+        self.assertNotEqual(0, os.system(f"./bin/kff-tools validate --infile {kff_compacted}"))
+
+        print("  clean the test area")
+        os.system(f"rm -r {txt} {kff_raw} {kff_bucket} {kff_compacted}")
+
+
+
+class TestCount(unittest.TestCase):
+
+    def test_count_reads(self):
+        print(f"\n-- TestCount test_count_reads")
+        k = 21
+        reads = "count_test.fa"
+        kff_file = "count_test.kff"
+        code = {"A": 0, "C": 1, "G": 3, "T": 2}
+        complement = {"A": "T", "C": "G", "G": "C", "T": "A"}
+
+        print(f"  1/3 Generate reads from a random genome")
+        genome = next(kg.generate_sequences(1, 2000))
+        sequences = []
+        with open(reads, "w") as fp:
+            for idx in range(300):
+                start = idx * 5 % (len(genome) - 100)
+                sequences.append(genome[start:start + 100])
+                fp.write(f">read{idx}\n{sequences[-1][:60]}\n{sequences[-1][60:]}\n")
+
+        # Canonical kmers regarding the encoding order
+        expected = {}
+        for seq in sequences:
+            for i in range(len(seq) - k + 1):
+                kmer = seq[i:i+k]
+                rev = "".join(complement[c] for c in reversed(kmer))
+                canonical = min(kmer, rev, key=lambda s: [code[c] for c in s])
+                expected[canonical] = expected.get(canonical, 0) + 1
+        expected = {kmer: count for kmer, count in expected.items() if count >= 2}
+
+        print(f"  2/3 Count the kmers")
+        self.assertEqual(0, os.system(f"./bin/kff-tools count -i {reads} -o {kff_file} -k {k} -m 8 -a 2 -t 4"))
+        self.assertEqual(0, os.system(f"./bin/kff-tools validate --infile {kff_file}"))
+
+        print(f"  3/3 Compare the counts")
+        stream = os.popen(f"./bin/kff-tools outstr -i {kff_file}")
+        counts = {}
+        for line in stream.read().strip().split("\n"):
+            kmer, count = line.split()
+            counts[kmer] = int(count)
+        stream.close()
+        self.assertEqual(counts, expected)
+
+        print("  clean the test area")
+        os.system(f"rm {reads} {kff_file}")
+
+
+class TestPipeline(unittest.TestCase):
+
+    def test_pipeline_files(self):
+        print(f"\n-- TestPipeline - pipeline vs intermediate files")
+        print("  init - generate a random sequence file")
+        txt = "pipeline_test.txt"
+        kff_raw = "raw_pipeline.kff"
+        kff_bucket = "bucket_pipeline.kff"
+        kff_compacted = "compact_pipeline.kff"
+        kff_pipeline = "pipeline_test.kff"
+        kg.generate_sequences_file(txt, 1000, 32, size_max=42, max_count=255)
+
+        print(f"  1/4 Tools one by one")
+        self.assertEqual(0, os.system(f"./bin/kff-tools instr -i {txt} -o {kff_raw} -k 32 -m 5 -d 1"))
+        self.assertEqual(0, os.system(f"./bin/kff-tools bucket -i {kff_raw} -o {kff_bucket} -m 11"))
+        self.assertEqual(0, os.system(f"./bin/kff-tools compact -i {kff_bucket} -o {kff_compacted}"))
+
+        print(f"  2/4 Same tools in a pipeline")
+        self.assertEqual(0, os.system(f"./bin/kff-tools pipeline -i {txt} -o {kff_pipeline} \"instr -k 32 -m 5 -d 1\" \"bucket -m 11\" compact sort index"))
+        self.assertEqual(0, os.system(f"./bin/kff-tools validate --infile {kff_pipeline}"))
+        # The intermediate files are written next to the output and removed
+        self.assertEqual([], [f for f in os.listdir(".") if f.startswith("kff_pipeline_")])
+
+        print(f"  3/4 Compare outputs")
+        self.assertEqual(0, os.system(f"./bin/kff-tools outstr -c -i {kff_compacted} | sort > {kff_compacted}_sorted.txt"))
+        self.assertEqual(0, os.system(f"./bin/kff-tools outstr -c -i {kff_pipeline} | sort > {kff_pipeline}_sorted.txt"))
+        stream = os.popen(f"diff {kff_compacted}_sorted.txt {kff_pipeline}_sorted.txt")
+        stream_val = stream.read()
+        stream.close()
+        self.assertEqual(stream_val, "")
+
+        print(f"  4/4 A stage that only prints its help is an error")
+        kff_help = "help_pipeline.kff"
+        self.assertNotEqual(0, os.system(f"./bin/kff-tools pipeline -i {txt} -o {kff_help} \"instr -k 32 -m 5 -d 1\" \"bucket -h\" compact"))
+        self.assertFalse(os.path.exists(kff_help))
+        self.assertEqual([], [f for f in os.listdir(".") if f.startswith("kff_pipeline_")])
+
+        print("  clean the test area")
+        os.system(f"rm {txt} {kff_raw} {kff_bucket} {kff_compacted}* {kff_pipeline}*")
+
 
 if __name__ == '__main__':
   unittest.main()